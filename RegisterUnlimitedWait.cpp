@@ -0,0 +1,581 @@
+#include "RegisterUnlimitedWait.h"
+#include "UnlimitedWait.h"
+
+// maximum number of signals retrieved by the dispatcher at once
+
+#define UNLIMITED_WAIT_REGISTER_BATCH 64
+
+// UnlimitedWaitRegistration
+//  - single RegisterUnlimitedWaitForSingleObject registration, its pointer is the returned handle
+//  - all fields but the constant ones are protected by the dispatcher's lock
+//  - 'heap' is position in the timeout heap, or -1 when not in it (INFINITE timeout, deactivated or cancelled)
+//  - released by the dispatcher when unregistered, or by the last callback to finish, if any was still running
+//
+struct UnlimitedWaitRegistration {
+    HANDLE              hObject; // duplicated
+    WAITORTIMERCALLBACK pfnCallback;
+    PVOID               lpContext;
+    ULONG               dwMilliseconds;
+    ULONG               dwFlags;
+    ULONGLONG           deadline; // GetTickCount64 time
+    SIZE_T              heap;
+    LONG                nSignalled; // signals retrieved by the current wait, callbacks not yet started
+    LONG                nRunning;   // callbacks in progress, on the dispatcher thread or in the thread pool
+    BOOL                bInactive;  // WT_EXECUTEONLYONCE callback was called
+    BOOL                bCancelled; // unregistered, waiting for dispatcher to release it
+    BOOL                bDetached;  // cancelled and removed from the UnlimitedWait by the dispatcher
+    HANDLE              hCompletionEvent;
+    volatile LONG *     lpReleased; // blocking UnregisterUnlimitedWaitEx waits on this
+    volatile LONG *     lpAdded;    // RegisterUnlimitedWaitForSingleObject waits on this for the dispatcher to add it
+    DWORD               dwAddError; // result of the add, set before 'lpAdded'
+    UnlimitedWaitRegistration * nextAdded;     // in list of registrations to add
+    UnlimitedWaitRegistration * nextCancelled; // in list of registrations to release
+};
+
+// UnlimitedWaitDispatcher
+//  - the single process-wide dispatcher thread with its UnlimitedWait
+//  - objects are added and removed only by the dispatcher thread, between waits, as the wait holds the UnlimitedWait
+//    lock; callbacks are started after the wait returns, so that they can register or unregister
+//  - 'hWake' is virtual object that interrupts the wait when new, cancelled or earlier timed registrations need attention
+//  - 'heap' is binary min-heap of registrations by deadline, 'nCapacity' items allocated
+//
+struct UnlimitedWaitDispatcher {
+    SRWLOCK         lock;
+    UnlimitedWait * instance;
+    HANDLE          hWake;
+    DWORD           dwThreadId;
+    UnlimitedWaitRegistration ** heap;
+    SIZE_T          nHeap;
+    SIZE_T          nCapacity;
+    UnlimitedWaitRegistration * added;
+    UnlimitedWaitRegistration * cancelled;
+};
+
+namespace {
+    SRWLOCK                   lockInitialization = SRWLOCK_INIT;
+    UnlimitedWaitDispatcher * dispatcher = NULL;
+
+    thread_local UnlimitedWaitRegistration * current = NULL; // registration whose callback this thread runs
+
+    // timeout heap
+    //  - dispatcher lock must be held
+
+    void SetHeapItem (SIZE_T i, UnlimitedWaitRegistration * registration) {
+        dispatcher->heap [i] = registration;
+        registration->heap = i;
+    }
+
+    void SiftUp (SIZE_T i) {
+        UnlimitedWaitRegistration * registration = dispatcher->heap [i];
+        while (i) {
+            SIZE_T parent = (i - 1) / 2;
+            if (dispatcher->heap [parent]->deadline <= registration->deadline)
+                break;
+
+            SetHeapItem (i, dispatcher->heap [parent]);
+            i = parent;
+        }
+        SetHeapItem (i, registration);
+    }
+
+    void SiftDown (SIZE_T i) {
+        UnlimitedWaitRegistration * registration = dispatcher->heap [i];
+        while (true) {
+            SIZE_T child = 2 * i + 1;
+            if (child >= dispatcher->nHeap)
+                break;
+            if ((child + 1 < dispatcher->nHeap) && (dispatcher->heap [child + 1]->deadline < dispatcher->heap [child]->deadline)) {
+                ++child;
+            }
+            if (registration->deadline <= dispatcher->heap [child]->deadline)
+                break;
+
+            SetHeapItem (i, dispatcher->heap [child]);
+            i = child;
+        }
+        SetHeapItem (i, registration);
+    }
+
+    BOOL InsertTimeout (UnlimitedWaitRegistration * registration) {
+        if (dispatcher->nHeap == dispatcher->nCapacity) {
+            SIZE_T nCapacity = dispatcher->nCapacity ? 2 * dispatcher->nCapacity : 16;
+            PVOID heap;
+            if (dispatcher->heap) {
+                heap = HeapReAlloc (GetProcessHeap (), 0, dispatcher->heap, nCapacity * sizeof (UnlimitedWaitRegistration *));
+            } else {
+                heap = HeapAlloc (GetProcessHeap (), 0, nCapacity * sizeof (UnlimitedWaitRegistration *));
+            }
+            if (!heap) {
+                SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+                return FALSE;
+            }
+            dispatcher->heap = (UnlimitedWaitRegistration **) heap;
+            dispatcher->nCapacity = nCapacity;
+        }
+
+        SetHeapItem (dispatcher->nHeap++, registration);
+        SiftUp (registration->heap);
+        return TRUE;
+    }
+
+    void RemoveTimeout (UnlimitedWaitRegistration * registration) {
+        SIZE_T i = registration->heap;
+        if (i != (SIZE_T) -1) {
+            registration->heap = (SIZE_T) -1;
+
+            if (i != --dispatcher->nHeap) {
+                SetHeapItem (i, dispatcher->heap [dispatcher->nHeap]);
+                SiftDown (i);
+                SiftUp (i);
+            }
+        }
+    }
+
+    void RestartTimeout (UnlimitedWaitRegistration * registration, ULONGLONG now) {
+        if (registration->heap != (SIZE_T) -1) {
+            registration->deadline = now + registration->dwMilliseconds;
+            SiftDown (registration->heap);
+        }
+    }
+
+    // Release
+    //  - signals unregistration completion and frees the registration
+    //
+    void Release (UnlimitedWaitRegistration * registration) {
+        if (registration->hCompletionEvent) {
+            SetEvent (registration->hCompletionEvent);
+        }
+        if (registration->lpReleased) {
+            InterlockedExchange (registration->lpReleased, TRUE);
+            WakeByAddressAll ((PVOID) registration->lpReleased);
+        }
+        HeapFree (GetProcessHeap (), 0, registration);
+    }
+
+    // Invoke
+    //  - calls the registration's callback, the last callback to finish after unregistration releases it
+    //
+    void Invoke (UnlimitedWaitRegistration * registration, BOOLEAN bTimedOut) {
+        UnlimitedWaitRegistration * outer = current;
+
+        current = registration;
+        registration->pfnCallback (registration->lpContext, bTimedOut);
+        current = outer;
+
+        AcquireSRWLockExclusive (&dispatcher->lock);
+        BOOL bRelease = !--registration->nRunning && registration->bDetached;
+        ReleaseSRWLockExclusive (&dispatcher->lock);
+
+        if (bRelease) {
+            Release (registration);
+        }
+    }
+
+    // SignalledWork/TimedOutWork
+    //  - thread pool callbacks, 'parameter' is the registration
+    //
+    void Work (PTP_CALLBACK_INSTANCE instance, UnlimitedWaitRegistration * registration, BOOLEAN bTimedOut) {
+        if (registration->dwFlags & WT_EXECUTELONGFUNCTION) {
+            CallbackMayRunLong (instance);
+        }
+        Invoke (registration, bTimedOut);
+    }
+    VOID CALLBACK SignalledWork (PTP_CALLBACK_INSTANCE instance, PVOID parameter) {
+        Work (instance, (UnlimitedWaitRegistration *) parameter, FALSE);
+    }
+    VOID CALLBACK TimedOutWork (PTP_CALLBACK_INSTANCE instance, PVOID parameter) {
+        Work (instance, (UnlimitedWaitRegistration *) parameter, TRUE);
+    }
+
+    // Run
+    //  - starts callback, 'nRunning' must already be incremented
+    //  - hands it off to the thread pool, unless WT_EXECUTEINWAITTHREAD was requested or the submission fails
+    //
+    void Run (UnlimitedWaitRegistration * registration, BOOLEAN bTimedOut) {
+        if (!(registration->dwFlags & WT_EXECUTEINWAITTHREAD)) {
+            if (TrySubmitThreadpoolCallback (bTimedOut ? TimedOutWork : SignalledWork, registration, NULL))
+                return;
+        }
+        Invoke (registration, bTimedOut);
+    }
+
+    // SignalCallback
+    //  - UnlimitedWait object callback of every registration, called by the dispatcher thread inside the wait
+    //  - only counts the signal, the callback is started by 'RunSignalled' after the wait returns
+    //
+    BOOL WINAPI SignalCallback (PVOID lpObjectContext, HANDLE) {
+        UnlimitedWaitRegistration * registration = (UnlimitedWaitRegistration *) lpObjectContext;
+
+        AcquireSRWLockExclusive (&dispatcher->lock);
+        if (registration->bCancelled || registration->bInactive) {
+            ReleaseSRWLockExclusive (&dispatcher->lock);
+            return FALSE;
+        }
+        if (registration->dwFlags & WT_EXECUTEONLYONCE) {
+            registration->bInactive = TRUE;
+            RemoveTimeout (registration);
+        } else {
+            RestartTimeout (registration, GetTickCount64 ());
+        }
+        registration->nSignalled++;
+
+        BOOL bKeep = !registration->bInactive;
+        ReleaseSRWLockExclusive (&dispatcher->lock);
+        return bKeep;
+    }
+
+    // RunSignalled
+    //  - starts callbacks of signals retrieved by the last wait, in order
+    //  - signals of registrations unregistered meanwhile are dropped
+    //
+    void RunSignalled (PVOID * contexts, ULONG n) {
+        for (ULONG i = 0; i != n; ++i) {
+            UnlimitedWaitRegistration * registration = (UnlimitedWaitRegistration *) contexts [i];
+            if (registration) {
+
+                // signals refused by 'SignalCallback' are in the batch too, but weren't counted
+
+                AcquireSRWLockExclusive (&dispatcher->lock);
+                BOOL bRun = FALSE;
+                if (registration->nSignalled) {
+                    registration->nSignalled--;
+                    bRun = !registration->bCancelled;
+                }
+                if (bRun) {
+                    registration->nRunning++;
+                }
+                ReleaseSRWLockExclusive (&dispatcher->lock);
+
+                if (bRun) {
+                    Run (registration, FALSE);
+                }
+            }
+        }
+    }
+
+    // ExpireTimeouts
+    //  - starts callbacks of registrations whose timeout elapsed, and restarts or deactivates them
+    //
+    void ExpireTimeouts () {
+        while (true) {
+            AcquireSRWLockExclusive (&dispatcher->lock);
+
+            ULONGLONG now = GetTickCount64 ();
+            if (!dispatcher->nHeap || (dispatcher->heap [0]->deadline > now)) {
+                ReleaseSRWLockExclusive (&dispatcher->lock);
+                break;
+            }
+
+            UnlimitedWaitRegistration * registration = dispatcher->heap [0];
+            BOOL bOnce = registration->dwFlags & WT_EXECUTEONLYONCE;
+            if (bOnce) {
+                registration->bInactive = TRUE;
+                RemoveTimeout (registration);
+            } else {
+                RestartTimeout (registration, now);
+            }
+            registration->nRunning++;
+            ReleaseSRWLockExclusive (&dispatcher->lock);
+
+            // signal retrieved meanwhile finds the registration inactive and doesn't call the callback
+
+            if (bOnce) {
+                RemoveUnlimitedWaitObject (dispatcher->instance, registration->hObject, FALSE);
+            }
+            Run (registration, TRUE);
+        }
+    }
+
+    // Activate
+    //  - adds object of new registration to the UnlimitedWait and schedules its timeout
+    //  - called only by the dispatcher thread, outside of the wait
+    //  - on failure nothing is left behind and GetLastError () has the reason
+    //
+    BOOL Activate (UnlimitedWaitRegistration * registration) {
+        if (!AddUnlimitedWaitObject (dispatcher->instance, registration->hObject, SignalCallback, registration, 0))
+            return FALSE;
+
+        if (registration->dwMilliseconds != INFINITE) {
+            AcquireSRWLockExclusive (&dispatcher->lock);
+            BOOL bScheduled = InsertTimeout (registration);
+            ReleaseSRWLockExclusive (&dispatcher->lock);
+
+            if (!bScheduled) {
+                RemoveUnlimitedWaitObject (dispatcher->instance, registration->hObject, FALSE);
+                SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+                return FALSE;
+            }
+        }
+        return TRUE;
+    }
+
+    // AddRegistered
+    //  - activates new registrations and hands the result back to the waiting RegisterUnlimitedWaitForSingleObject
+    //
+    void AddRegistered () {
+        AcquireSRWLockExclusive (&dispatcher->lock);
+        UnlimitedWaitRegistration * registration = dispatcher->added;
+        dispatcher->added = NULL;
+        ReleaseSRWLockExclusive (&dispatcher->lock);
+
+        while (registration) {
+            UnlimitedWaitRegistration * next = registration->nextAdded;
+            volatile LONG * lpAdded = registration->lpAdded;
+
+            registration->dwAddError = Activate (registration) ? ERROR_SUCCESS : GetLastError ();
+
+            // failed registration is freed by the registering thread as soon as this is set
+
+            InterlockedExchange (lpAdded, TRUE);
+            WakeByAddressAll ((PVOID) lpAdded);
+            registration = next;
+        }
+    }
+
+    // ReleaseCancelled
+    //  - removes unregistered objects from the UnlimitedWait and releases the registrations without running callbacks
+    //
+    void ReleaseCancelled () {
+        AcquireSRWLockExclusive (&dispatcher->lock);
+        UnlimitedWaitRegistration * registration = dispatcher->cancelled;
+        dispatcher->cancelled = NULL;
+        ReleaseSRWLockExclusive (&dispatcher->lock);
+
+        while (registration) {
+            UnlimitedWaitRegistration * next = registration->nextCancelled;
+
+            RemoveUnlimitedWaitObject (dispatcher->instance, registration->hObject, FALSE);
+            CloseHandle (registration->hObject);
+
+            // callbacks still running in the thread pool release the registration when the last one finishes
+
+            AcquireSRWLockExclusive (&dispatcher->lock);
+            registration->bDetached = TRUE;
+            BOOL bRelease = !registration->nRunning;
+            ReleaseSRWLockExclusive (&dispatcher->lock);
+
+            if (bRelease) {
+                Release (registration);
+            }
+            registration = next;
+        }
+    }
+
+    DWORD NextTimeout () {
+        DWORD timeout = INFINITE;
+
+        AcquireSRWLockShared (&dispatcher->lock);
+        if (dispatcher->nHeap) {
+            ULONGLONG now = GetTickCount64 ();
+            ULONGLONG deadline = dispatcher->heap [0]->deadline;
+
+            if (deadline <= now) {
+                timeout = 0;
+            } else
+            if (deadline - now < INFINITE) {
+                timeout = (DWORD) (deadline - now);
+            } else {
+                timeout = INFINITE - 1;
+            }
+        }
+        ReleaseSRWLockShared (&dispatcher->lock);
+        return timeout;
+    }
+
+    DWORD WINAPI DispatcherThread (LPVOID) {
+        PVOID contexts [UNLIMITED_WAIT_REGISTER_BATCH];
+        while (true) {
+            ULONG n = 0;
+            WaitUnlimitedWaitEx (dispatcher->instance, contexts, NULL, UNLIMITED_WAIT_REGISTER_BATCH, &n, NextTimeout (), FALSE);
+
+            RunSignalled (contexts, n);
+            AddRegistered ();
+            ExpireTimeouts ();
+            ReleaseCancelled ();
+        }
+    }
+
+    // StartDispatcher
+    //  - creates the dispatcher on first use, the dispatcher is never destroyed
+    //
+    BOOL StartDispatcher () {
+        AcquireSRWLockExclusive (&lockInitialization);
+        if (dispatcher) {
+            ReleaseSRWLockExclusive (&lockInitialization);
+            return TRUE;
+        }
+
+        DWORD error = ERROR_NOT_ENOUGH_MEMORY;
+        auto candidate = (UnlimitedWaitDispatcher *) HeapAlloc (GetProcessHeap (), 0, sizeof (UnlimitedWaitDispatcher));
+        if (candidate) {
+            candidate->lock = SRWLOCK_INIT;
+            candidate->heap = NULL;
+            candidate->nHeap = 0;
+            candidate->nCapacity = 0;
+            candidate->added = NULL;
+            candidate->cancelled = NULL;
+            candidate->instance = CreateUnlimitedWait (NULL, 0, NULL, NULL);
+
+            if (candidate->instance) {
+                candidate->hWake = AddUnlimitedWaitVirtualObject (candidate->instance, NULL, NULL, 0);
+                if (candidate->hWake) {
+                    dispatcher = candidate;
+
+                    HANDLE hThread = CreateThread (NULL, 0, DispatcherThread, NULL, 0, &candidate->dwThreadId);
+                    if (hThread) {
+                        CloseHandle (hThread);
+                        ReleaseSRWLockExclusive (&lockInitialization);
+                        return TRUE;
+                    }
+                    dispatcher = NULL;
+                }
+                error = GetLastError ();
+                DeleteUnlimitedWait (candidate->instance);
+            } else {
+                error = GetLastError ();
+            }
+            HeapFree (GetProcessHeap (), 0, candidate);
+        }
+
+        ReleaseSRWLockExclusive (&lockInitialization);
+        SetLastError (error);
+        return FALSE;
+    }
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI RegisterUnlimitedWaitForSingleObject (
+    _Out_ PHANDLE phNewWaitObject,
+    _In_ HANDLE hObject,
+    _In_ WAITORTIMERCALLBACK Callback,
+    _In_opt_ PVOID Context,
+    _In_ ULONG dwMilliseconds,
+    _In_ ULONG dwFlags
+) {
+    if (!phNewWaitObject || !hObject || !Callback) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+    if (!StartDispatcher ())
+        return FALSE;
+
+    auto registration = (UnlimitedWaitRegistration *) HeapAlloc (GetProcessHeap (), 0, sizeof (UnlimitedWaitRegistration));
+    if (!registration) {
+        SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+        return FALSE;
+    }
+
+    // own handle, unique key in the UnlimitedWait even when the same object is registered multiple times
+
+    if (DuplicateHandle (GetCurrentProcess (), hObject, GetCurrentProcess (), &registration->hObject, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+        registration->pfnCallback = Callback;
+        registration->lpContext = Context;
+        registration->dwMilliseconds = dwMilliseconds;
+        registration->dwFlags = dwFlags;
+        registration->deadline = GetTickCount64 () + dwMilliseconds;
+        registration->heap = (SIZE_T) -1;
+        registration->nSignalled = 0;
+        registration->nRunning = 0;
+        registration->bInactive = FALSE;
+        registration->bCancelled = FALSE;
+        registration->bDetached = FALSE;
+        registration->hCompletionEvent = NULL;
+        registration->lpReleased = NULL;
+        registration->lpAdded = NULL;
+        registration->dwAddError = ERROR_SUCCESS;
+        registration->nextAdded = NULL;
+        registration->nextCancelled = NULL;
+
+        // callbacks on the dispatcher thread run outside of the wait and can add directly,
+        // other threads hand the registration over to the dispatcher and wait for the result
+
+        if (GetCurrentThreadId () == dispatcher->dwThreadId) {
+            if (!Activate (registration)) {
+                registration->dwAddError = GetLastError ();
+            }
+        } else {
+            volatile LONG bAdded = FALSE;
+            registration->lpAdded = &bAdded;
+
+            AcquireSRWLockExclusive (&dispatcher->lock);
+            registration->nextAdded = dispatcher->added;
+            dispatcher->added = registration;
+            ReleaseSRWLockExclusive (&dispatcher->lock);
+
+            SetUnlimitedWaitVirtualObject (dispatcher->hWake);
+
+            LONG bNotAdded = FALSE;
+            while (!bAdded) {
+                WaitOnAddress (&bAdded, &bNotAdded, sizeof bAdded, INFINITE);
+            }
+        }
+
+        if (registration->dwAddError == ERROR_SUCCESS) {
+            *phNewWaitObject = (HANDLE) registration;
+            return TRUE;
+        }
+        CloseHandle (registration->hObject);
+        SetLastError (registration->dwAddError);
+    }
+    HeapFree (GetProcessHeap (), 0, registration);
+    return FALSE;
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI UnregisterUnlimitedWaitEx (
+    _In_ HANDLE WaitHandle,
+    _In_opt_ HANDLE CompletionEvent
+) {
+    if (!WaitHandle || !dispatcher) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    UnlimitedWaitRegistration * registration = (UnlimitedWaitRegistration *) WaitHandle;
+
+    // the callback unregistering its own registration cannot wait for itself,
+    // and the dispatcher thread cannot wait for the registration it is to release
+
+    BOOL bBlocking = (CompletionEvent == INVALID_HANDLE_VALUE) && (GetCurrentThreadId () != dispatcher->dwThreadId)
+                  && (current != registration);
+    volatile LONG bReleased = FALSE;
+
+    AcquireSRWLockExclusive (&dispatcher->lock);
+
+    BOOL bRunning = registration->nRunning != 0;
+    registration->bCancelled = TRUE;
+    RemoveTimeout (registration);
+
+    if (bBlocking) {
+        registration->lpReleased = &bReleased;
+    } else
+    if (CompletionEvent != INVALID_HANDLE_VALUE) {
+        registration->hCompletionEvent = CompletionEvent;
+    }
+    registration->nextCancelled = dispatcher->cancelled;
+    dispatcher->cancelled = registration;
+
+    ReleaseSRWLockExclusive (&dispatcher->lock);
+
+    SetUnlimitedWaitVirtualObject (dispatcher->hWake);
+
+    if (bBlocking) {
+        LONG bNotReleased = FALSE;
+        while (!bReleased) {
+            WaitOnAddress (&bReleased, &bNotReleased, sizeof bReleased, INFINITE);
+        }
+        return TRUE;
+    }
+    if (bRunning && !CompletionEvent) {
+        SetLastError (ERROR_IO_PENDING);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI UnregisterUnlimitedWait (
+    _In_ HANDLE WaitHandle
+) {
+    return UnregisterUnlimitedWaitEx (WaitHandle, NULL);
+}
@@ -0,0 +1,65 @@
+#ifndef WINDOWS_REGISTERUNLIMITEDWAIT_H
+#define WINDOWS_REGISTERUNLIMITEDWAIT_H
+
+#include <Windows.h>
+
+// RegisterUnlimitedWaitForSingleObject
+//  - drop-in replacement for RegisterWaitForSingleObject, same parameters and semantics, but all registered waits
+//    are served by a single dispatcher thread, with a single UnlimitedWait, instead of spreading them over
+//    thread pool threads
+//  - parameters:
+//     - phNewWaitObject - receives handle of the registration, for UnregisterUnlimitedWait(Ex)
+//     - hObject - object to wait for, the handle is duplicated, so it can be closed after this call
+//     - Callback - called with 'Context' and TRUE on timeout, or FALSE when the object got signalled
+//     - dwMilliseconds - timeout, restarted after every callback, INFINITE for none
+//     - dwFlags - WT_EXECUTEONLYONCE - the callback is called only once, then the wait is deactivated
+//                                    - the registration still needs to be unregistered
+//               - WT_EXECUTEINWAITTHREAD - the callback runs on the dispatcher thread, long callbacks delay all other
+//                                          waits and registrations
+//               - WT_EXECUTELONGFUNCTION - hints the thread pool that the callback may block
+//               - without WT_EXECUTEINWAITTHREAD callbacks are handed off to the thread pool, so they may run
+//                 concurrently, even for the same registration; other WT_ flags are accepted and ignored
+//  - the dispatcher thread is started by the first call and runs until the process exits
+//  - the object is added to the wait before this call returns, by the dispatcher thread right after its current batch,
+//    or directly when called from WT_EXECUTEINWAITTHREAD callback; if that fails, e.g. for unsupported object or out of
+//    memory, the call fails and no registration is created
+//  - IMPORTANT DIFFERENCES:
+//     - does NOT support Mutexes (see UnlimitedWait)
+//     - the timeout resolution is one millisecond, as GetTickCount64, no timer coalescing
+//  - returns: TRUE on success, FALSE on failure, call GetLastError () to get more information
+//
+_Success_ (return != FALSE)
+BOOL WINAPI RegisterUnlimitedWaitForSingleObject (
+    _Out_ PHANDLE phNewWaitObject,
+    _In_ HANDLE hObject,
+    _In_ WAITORTIMERCALLBACK Callback,
+    _In_opt_ PVOID Context,
+    _In_ ULONG dwMilliseconds,
+    _In_ ULONG dwFlags
+);
+
+// UnregisterUnlimitedWaitEx
+//  - cancels registration created by RegisterUnlimitedWaitForSingleObject, no new callbacks are started after this
+//  - parameters:
+//     - CompletionEvent - NULL - returns immediately, FALSE with ERROR_IO_PENDING if callback is in progress
+//                       - INVALID_HANDLE_VALUE - waits for callbacks in progress to complete
+//                                                (returns immediately when called from its own callback,
+//                                                 or from any WT_EXECUTEINWAITTHREAD callback)
+//                       - event handle - returns immediately, the event is set once the registration is released
+//  - the registration handle is no longer valid after this call
+//
+_Success_ (return != FALSE)
+BOOL WINAPI UnregisterUnlimitedWaitEx (
+    _In_ HANDLE WaitHandle,
+    _In_opt_ HANDLE CompletionEvent
+);
+
+// UnregisterUnlimitedWait
+//  - same as UnregisterUnlimitedWaitEx with NULL 'CompletionEvent'
+//
+_Success_ (return != FALSE)
+BOOL WINAPI UnregisterUnlimitedWait (
+    _In_ HANDLE WaitHandle
+);
+
+#endif
@@ -0,0 +1,456 @@
+#include "ShardedUnlimitedWait.h"
+
+// how often threads blocked on their own shard come to steal from shards without any bound thread,
+// in milliseconds, the system rounds it up to the timer tick; the interval doubles while nothing is found
+
+#define SHARDED_UNLIMITED_WAIT_STEAL_INTERVAL     1
+#define SHARDED_UNLIMITED_WAIT_STEAL_INTERVAL_MAX 64
+
+namespace {
+    struct ShardedUnlimitedWaitShard {
+        UnlimitedWait * wait;
+        HANDLE          hReady; // signalled while the shard has signals nobody retrieved yet, these are stolen
+    };
+
+    // ShardedUnlimitedWaitPlacement
+    //  - shard of object placed by SHARDED_UNLIMITED_WAIT_OBJECT_SHARD, other objects are found by the handle hash
+    //
+    struct ShardedUnlimitedWaitPlacement {
+        HANDLE hObject; // NULL for free entry
+        DWORD  shard;
+    };
+}
+
+struct ShardedUnlimitedWait {
+    DWORD   nShards;
+    DWORD   dwTlsIndex; // per-thread home shard index + 1
+    DWORD   dwFlags;
+    LONG    nBoundThreads; // threads ever bound, shards stay without one while this is below 'nShards'
+    PVOID   lpWaitContext;
+    PUNLIMITED_WAIT_CALLBACK pfnTimeoutCallback;
+    PUNLIMITED_WAIT_CALLBACK pfnApcWakeCallback;
+
+    // open addressing table of explicitly placed objects, capacity is power of 2
+
+    SRWLOCK                         lockPlacements;
+    SIZE_T                          nPlacements;
+    SIZE_T                          nPlacementsCapacity;
+    ShardedUnlimitedWaitPlacement * placements;
+
+    ShardedUnlimitedWaitShard shards [1]; // 'nShards' items
+};
+
+_Success_ (return != NULL)
+ShardedUnlimitedWait * WINAPI CreateShardedUnlimitedWait (
+    _In_opt_ PVOID lpWaitContext,
+    _In_     DWORD nPreAllocatedSlots,
+    _In_     DWORD nShards,
+    _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnTimeoutCallback,
+    _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnApcWakeCallback,
+    _In_     DWORD dwFlags
+) {
+    if (nShards == 0) {
+        nShards = GetActiveProcessorCount (ALL_PROCESSOR_GROUPS);
+    }
+    if ((nShards == 0) || (nShards > 0x8000)) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return NULL;
+    }
+
+    HANDLE hHeap = GetProcessHeap ();
+    ShardedUnlimitedWait * instance = (ShardedUnlimitedWait *) HeapAlloc (hHeap, 0, sizeof (ShardedUnlimitedWait)
+                                                                                    + (nShards - 1) * sizeof (ShardedUnlimitedWaitShard));
+    if (instance) {
+        instance->dwTlsIndex = TlsAlloc ();
+        if (instance->dwTlsIndex != TLS_OUT_OF_INDEXES) {
+            instance->nShards = nShards;
+            instance->dwFlags = dwFlags;
+            instance->nBoundThreads = 0;
+            instance->lpWaitContext = lpWaitContext;
+            instance->pfnTimeoutCallback = pfnTimeoutCallback;
+            instance->pfnApcWakeCallback = pfnApcWakeCallback;
+
+            InitializeSRWLock (&instance->lockPlacements);
+            instance->nPlacements = 0;
+            instance->nPlacementsCapacity = 0;
+            instance->placements = NULL;
+
+            // shards don't get the callbacks, zero-timeout steal attempts would trigger them
+
+            DWORD nCreatedShards = 0;
+            while ((instance->shards [nCreatedShards].wait = CreateUnlimitedWait (lpWaitContext, (nPreAllocatedSlots + nShards - 1) / nShards, NULL, NULL)) != NULL) {
+                instance->shards [nCreatedShards].hReady = GetUnlimitedWaitReadinessHandle (instance->shards [nCreatedShards].wait);
+                if (++nCreatedShards == nShards) {
+                    return instance;
+                }
+            }
+
+            DWORD error = GetLastError ();
+            while (nCreatedShards--) {
+                DeleteUnlimitedWait (instance->shards [nCreatedShards].wait);
+            }
+            TlsFree (instance->dwTlsIndex);
+            SetLastError (error);
+        }
+        HeapFree (hHeap, 0, instance);
+    }
+    return NULL;
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI DeleteShardedUnlimitedWait (
+    _In_ ShardedUnlimitedWait * instance
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    BOOL result = TRUE;
+    for (DWORD i = 0; i != instance->nShards; ++i) {
+        if (!DeleteUnlimitedWait (instance->shards [i].wait)) {
+            result = FALSE;
+        }
+    }
+    if (instance->placements && !HeapFree (GetProcessHeap (), 0, instance->placements)) {
+        result = FALSE;
+    }
+    if (!TlsFree (instance->dwTlsIndex)) {
+        result = FALSE;
+    }
+    if (!HeapFree (GetProcessHeap (), 0, instance)) {
+        result = FALSE;
+    }
+    return result;
+}
+
+namespace {
+    DWORD GetObjectShard (ShardedUnlimitedWait * instance, HANDLE hObjectHandle) {
+
+        // Fibonacci hashing, low 2 bits of kernel handles are always zero
+
+        ULONGLONG hash = ((ULONGLONG) (ULONG_PTR) hObjectHandle >> 2) * 0x9E3779B97F4A7C15uLL;
+        return (DWORD) ((hash >> 32) % instance->nShards);
+    }
+
+    // GetShardProcessor
+    //  - shard N is served on N-th active processor (modulo their number), counted over all processor groups
+    //
+    PROCESSOR_NUMBER GetShardProcessor (DWORD shard) {
+        PROCESSOR_NUMBER processor = {};
+        DWORD index = shard % GetActiveProcessorCount (ALL_PROCESSOR_GROUPS);
+
+        WORD nGroups = GetActiveProcessorGroupCount ();
+        for (WORD group = 0; group != nGroups; ++group) {
+            DWORD n = GetActiveProcessorCount (group);
+            if (index < n) {
+                processor.Group = group;
+                processor.Number = (BYTE) index;
+                break;
+            }
+            index -= n;
+        }
+        return processor;
+    }
+
+    DWORD GetHomeShard (ShardedUnlimitedWait * instance) {
+        ULONG_PTR value = (ULONG_PTR) TlsGetValue (instance->dwTlsIndex);
+        if (value && (value <= instance->nShards)) {
+            return (DWORD) (value - 1);
+        }
+
+        // first wait on this thread, bind it round-robin and move it to the shard's processor group,
+        // restricted to the processor, or with the processor only set as ideal one
+
+        DWORD shard = (DWORD) (InterlockedIncrement (&instance->nBoundThreads) - 1) % instance->nShards;
+        PROCESSOR_NUMBER processor = GetShardProcessor (shard);
+
+        GROUP_AFFINITY affinity = {};
+        affinity.Group = processor.Group;
+
+        if (instance->dwFlags & SHARDED_UNLIMITED_WAIT_PIN_THREADS) {
+            affinity.Mask = (KAFFINITY) 1 << processor.Number;
+            SetThreadGroupAffinity (GetCurrentThread (), &affinity, NULL);
+        } else {
+            DWORD n = GetActiveProcessorCount (processor.Group);
+            affinity.Mask = (n >= sizeof (KAFFINITY) * 8) ? ~(KAFFINITY) 0 : ((KAFFINITY) 1 << n) - 1;
+            SetThreadGroupAffinity (GetCurrentThread (), &affinity, NULL);
+            SetThreadIdealProcessorEx (GetCurrentThread (), &processor, NULL);
+        }
+
+        TlsSetValue (instance->dwTlsIndex, (LPVOID) (ULONG_PTR) (shard + 1));
+        return shard;
+    }
+
+    SIZE_T HashPlacement (ShardedUnlimitedWait * instance, HANDLE hObjectHandle) {
+        ULONGLONG hash = ((ULONGLONG) (ULONG_PTR) hObjectHandle >> 2) * 0x9E3779B97F4A7C15uLL;
+        return (SIZE_T) (hash >> 32) & (instance->nPlacementsCapacity - 1);
+    }
+
+    // FindPlacement
+    //  - returns index of the object's entry, or of the free entry that ends its probe sequence
+    //  - lock must be held, the table must not be empty
+    //
+    SIZE_T FindPlacement (ShardedUnlimitedWait * instance, HANDLE hObjectHandle) {
+        SIZE_T mask = instance->nPlacementsCapacity - 1;
+        SIZE_T i = HashPlacement (instance, hObjectHandle);
+
+        while (instance->placements [i].hObject && (instance->placements [i].hObject != hObjectHandle)) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    // RecordPlacement
+    //  - records shard of explicitly placed object, growing the table to keep it at most half full
+    //  - lock must be held (exclusive)
+    //
+    BOOL RecordPlacement (ShardedUnlimitedWait * instance, HANDLE hObjectHandle, DWORD shard) {
+        if (2 * (instance->nPlacements + 1) > instance->nPlacementsCapacity) {
+            SIZE_T nCapacity = instance->nPlacementsCapacity ? 2 * instance->nPlacementsCapacity : 16;
+            auto placements = (ShardedUnlimitedWaitPlacement *) HeapAlloc (GetProcessHeap (), HEAP_ZERO_MEMORY,
+                                                                            nCapacity * sizeof (ShardedUnlimitedWaitPlacement));
+            if (!placements) {
+                SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+                return FALSE;
+            }
+
+            auto previous = instance->placements;
+            SIZE_T nPrevious = instance->nPlacementsCapacity;
+
+            instance->placements = placements;
+            instance->nPlacementsCapacity = nCapacity;
+
+            for (SIZE_T i = 0; i != nPrevious; ++i) {
+                if (previous [i].hObject) {
+                    instance->placements [FindPlacement (instance, previous [i].hObject)] = previous [i];
+                }
+            }
+            if (previous) {
+                HeapFree (GetProcessHeap (), 0, previous);
+            }
+        }
+
+        SIZE_T i = FindPlacement (instance, hObjectHandle);
+        if (!instance->placements [i].hObject) {
+            instance->placements [i].hObject = hObjectHandle;
+            ++instance->nPlacements;
+        }
+        instance->placements [i].shard = shard;
+        return TRUE;
+    }
+
+    // ErasePlacement
+    //  - removes entry 'i', entries later in the same probe sequence are shifted back into the hole
+    //  - lock must be held (exclusive)
+    //
+    void ErasePlacement (ShardedUnlimitedWait * instance, SIZE_T i) {
+        SIZE_T mask = instance->nPlacementsCapacity - 1;
+        SIZE_T hole = i;
+
+        while (true) {
+            i = (i + 1) & mask;
+            if (!instance->placements [i].hObject)
+                break;
+
+            // entry can fill the hole if its home position isn't cyclically in (hole, i]
+
+            SIZE_T home = HashPlacement (instance, instance->placements [i].hObject);
+            if (((i - home) & mask) >= ((i - hole) & mask)) {
+                instance->placements [hole] = instance->placements [i];
+                hole = i;
+            }
+        }
+        instance->placements [hole].hObject = NULL;
+        --instance->nPlacements;
+    }
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI AddShardedUnlimitedWaitObject (
+    _In_     ShardedUnlimitedWait * instance,
+    _In_     HANDLE hObjectHandle,
+    _In_opt_ PUNLIMITED_WAIT_OBJECT_CALLBACK ptrCallbackFunction,
+    _In_opt_ PVOID lpObjectContext,
+    _In_     DWORD dwFlags
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    if (!(dwFlags & SHARDED_UNLIMITED_WAIT_OBJECT_SHARD (0))) {
+        return AddUnlimitedWaitObject (instance->shards [GetObjectShard (instance, hObjectHandle)].wait,
+                                       hObjectHandle, ptrCallbackFunction, lpObjectContext, dwFlags & 0x0000FFFF);
+    }
+
+    // explicitly placed, recorded so that the removal finds the shard without searching all of them
+
+    DWORD shard = ((dwFlags >> 16) & 0x7FFF) % instance->nShards;
+
+    AcquireSRWLockExclusive (&instance->lockPlacements);
+    BOOL result = RecordPlacement (instance, hObjectHandle, shard);
+    if (result) {
+        result = AddUnlimitedWaitObject (instance->shards [shard].wait, hObjectHandle, ptrCallbackFunction, lpObjectContext, dwFlags & 0x0000FFFF);
+        if (!result) {
+            DWORD error = GetLastError ();
+            ErasePlacement (instance, FindPlacement (instance, hObjectHandle));
+            SetLastError (error);
+        }
+    }
+    ReleaseSRWLockExclusive (&instance->lockPlacements);
+    return result;
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI RemoveShardedUnlimitedWaitObject (
+    _In_ ShardedUnlimitedWait * instance,
+    _In_ HANDLE hObjectHandle,
+    _In_ BOOL bKeepSignalsEnqueued
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    // explicitly placed objects have their shard recorded, the rest are in the shard given by hash
+
+    DWORD shard = GetObjectShard (instance, hObjectHandle);
+    BOOL bPlaced = FALSE;
+
+    AcquireSRWLockShared (&instance->lockPlacements);
+    if (instance->nPlacements) {
+        SIZE_T i = FindPlacement (instance, hObjectHandle);
+        if (instance->placements [i].hObject) {
+            shard = instance->placements [i].shard;
+            bPlaced = TRUE;
+        }
+    }
+    ReleaseSRWLockShared (&instance->lockPlacements);
+
+    if (!RemoveUnlimitedWaitObject (instance->shards [shard].wait, hObjectHandle, bKeepSignalsEnqueued))
+        return FALSE;
+
+    if (bPlaced) {
+        AcquireSRWLockExclusive (&instance->lockPlacements);
+        SIZE_T i = FindPlacement (instance, hObjectHandle);
+        if (instance->placements [i].hObject) {
+            ErasePlacement (instance, i);
+        }
+        ReleaseSRWLockExclusive (&instance->lockPlacements);
+    }
+    return TRUE;
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI WaitShardedUnlimitedWait (
+    _In_ ShardedUnlimitedWait * instance,
+    _Out_opt_ PVOID * lpSignalledObjectContext,
+    _In_ DWORD dwMilliseconds,
+    _In_ BOOL bAlertable
+) {
+    OVERLAPPED_ENTRY oResult = {};
+    return WaitShardedUnlimitedWaitEx (instance, lpSignalledObjectContext, &oResult, 1, NULL, dwMilliseconds, bAlertable);
+}
+
+namespace {
+
+    // Steal
+    //  - retrieves ready batch from other shard with backlog, i.e. one whose threads are all busy, or that has none
+    //  - returns FALSE with WAIT_TIMEOUT when there was nothing to steal
+    //
+    BOOL Steal (ShardedUnlimitedWait * instance, DWORD home, PVOID * lpSignalledObjectContexts, PVOID lpTemporaryBuffer,
+                ULONG ulCount, ULONG * ulNumEntriesProcessed) {
+        for (DWORD i = 1; i != instance->nShards; ++i) {
+            ShardedUnlimitedWaitShard * shard = &instance->shards [(home + i) % instance->nShards];
+            if (WaitForSingleObject (shard->hReady, 0) != WAIT_OBJECT_0)
+                continue;
+
+            if (WaitUnlimitedWaitEx (shard->wait, lpSignalledObjectContexts, lpTemporaryBuffer, ulCount, ulNumEntriesProcessed, 0, FALSE))
+                return TRUE;
+
+            if (GetLastError () != WAIT_TIMEOUT)
+                return FALSE;
+        }
+        SetLastError (WAIT_TIMEOUT);
+        return FALSE;
+    }
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI WaitShardedUnlimitedWaitEx (
+    _In_ ShardedUnlimitedWait * instance,
+    _Out_writes_to_opt_ (ulCount, *ulNumEntriesProcessed) PVOID * lpSignalledObjectContexts,
+    _Out_writes_bytes_all_opt_ (32 * ulCount) PVOID lpTemporaryBuffer,
+    _In_ _In_range_ (1, ULONG_MAX) ULONG ulCount,
+    _Out_opt_ ULONG * ulNumEntriesProcessed,
+    _In_ DWORD dwMilliseconds,
+    _In_ BOOL bAlertable
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    DWORD home = GetHomeShard (instance);
+
+    // own shard is polled first, then, when it's empty, other shards with backlog are stolen from, and only then
+    // the thread blocks on own shard; while some shard has no thread bound to it, and so nobody to block on it,
+    // the blocking wait is cut into slices, stealing in between, each slice twice as long as previous one, up to max
+
+    BOOL bSliced = (DWORD) InterlockedCompareExchange (&instance->nBoundThreads, 0, 0) < instance->nShards;
+
+    ULONGLONG tStart = GetTickCount64 ();
+    DWORD dwInterval = SHARDED_UNLIMITED_WAIT_STEAL_INTERVAL;
+    DWORD dwSlice = 0;
+    DWORD error;
+
+    while (true) {
+        if (WaitUnlimitedWaitEx (instance->shards [home].wait, lpSignalledObjectContexts, lpTemporaryBuffer,
+                                 ulCount, ulNumEntriesProcessed, dwSlice, bAlertable))
+            return TRUE;
+
+        error = GetLastError ();
+        if (error != WAIT_TIMEOUT)
+            break;
+
+        if (Steal (instance, home, lpSignalledObjectContexts, lpTemporaryBuffer, ulCount, ulNumEntriesProcessed))
+            return TRUE;
+
+        error = GetLastError ();
+        if (error != WAIT_TIMEOUT)
+            return FALSE;
+
+        DWORD dwRemaining = dwMilliseconds;
+        if (dwMilliseconds != INFINITE) {
+            ULONGLONG elapsed = GetTickCount64 () - tStart;
+            if (elapsed >= dwMilliseconds)
+                break;
+
+            dwRemaining = (DWORD) (dwMilliseconds - elapsed);
+        }
+
+        if (dwSlice && (dwInterval < SHARDED_UNLIMITED_WAIT_STEAL_INTERVAL_MAX)) {
+            dwInterval *= 2;
+        }
+        dwSlice = dwRemaining;
+        if (bSliced && (dwSlice > dwInterval)) {
+            dwSlice = dwInterval;
+        }
+    }
+
+    switch (error) {
+        case WAIT_TIMEOUT:
+            if (instance->pfnTimeoutCallback) {
+                instance->pfnTimeoutCallback (instance->lpWaitContext);
+            }
+            break;
+        case WAIT_IO_COMPLETION:
+            if (instance->pfnApcWakeCallback) {
+                instance->pfnApcWakeCallback (instance->lpWaitContext);
+            }
+            break;
+    }
+    SetLastError (error);
+    return FALSE;
+}
@@ -0,0 +1,116 @@
+#ifndef WINDOWS_SHARDEDUNLIMITEDWAIT_H
+#define WINDOWS_SHARDEDUNLIMITEDWAIT_H
+
+#include "UnlimitedWait.h"
+
+struct ShardedUnlimitedWait;
+
+// SHARDED_UNLIMITED_WAIT flags
+
+#define SHARDED_UNLIMITED_WAIT_PIN_THREADS  0x00000001
+
+// CreateShardedUnlimitedWait
+//  - creates front end over 'nShards' independent 'UnlimitedWait' objects, each with own IOCP and lock
+//  - waiting threads are bound to shards round-robin, on their first call to WaitShardedUnlimitedWait(Ex),
+//    and shard N is served on processor N (modulo the number of processors), counted over all processor groups,
+//    the thread is moved to the processor's group
+//  - threads with nothing in own shard steal ready batches from shards with backlog, see WaitShardedUnlimitedWaitEx
+//  - parameters:
+//     - lpWaitContext - user-defined value, that is passed to callback functions
+//     - nPreAllocatedSlots - total number of slots to prepare in advance, split evenly among shards
+//     - nShards - number of shards, 0 to create one per active processor
+//     - pfnTimeoutCallback - called with 'lpWaitContext' by WaitShardedUnlimitedWait(Ex) on timeout
+//     - pfnApcWakeCallback - called with 'lpWaitContext' by WaitShardedUnlimitedWait(Ex) after APC interrupted the wait
+//     - dwFlags - additional behavior options, can be one or more of:
+//               - SHARDED_UNLIMITED_WAIT_PIN_THREADS - restricts affinity of bound threads to the shard's processor,
+//                                                      otherwise the processor is only set as ideal, within its group
+//  - returns:
+//     - 'handle' to the ShardedUnlimitedWait object to be used in the remaining functions
+//     - NULL on error - call 'GetLastError()' to get the underlying reason
+//  - NOTE: shard without any bound thread is served only by stealing, by other threads that wake up for it
+//          periodically, from once per timer tick, backing off to 64 ms while there's nothing;
+//          use at least 'nShards' waiting threads to avoid the latency and wake-ups
+//
+_Success_ (return != NULL)
+ShardedUnlimitedWait * WINAPI CreateShardedUnlimitedWait (
+    _In_opt_ PVOID lpWaitContext,
+    _In_     DWORD nPreAllocatedSlots,
+    _In_     DWORD nShards,
+    _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnTimeoutCallback,
+    _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnApcWakeCallback,
+    _In_     DWORD dwFlags
+);
+
+// DeleteShardedUnlimitedWait
+//  - destroys all shards and releases all resources, see DeleteUnlimitedWait
+//
+_Success_ (return != FALSE)
+BOOL WINAPI DeleteShardedUnlimitedWait (
+    _In_ ShardedUnlimitedWait * hShardedUnlimitedWait
+);
+
+// SHARDED_UNLIMITED_WAIT_OBJECT_SHARD
+//  - combine with AddShardedUnlimitedWaitObject 'dwFlags' to place the object into particular shard,
+//    otherwise the shard is selected by hash of the object handle
+//  - the shard of such object is recorded (in a hash table), so that the removal goes straight to it
+//
+#define SHARDED_UNLIMITED_WAIT_OBJECT_SHARD(n) (0x80000000 | (((n) & 0x7FFF) << 16))
+
+// AddShardedUnlimitedWaitObject
+//  - adds object handle to one of the shards, parameters and return values are the same as AddUnlimitedWaitObject
+//
+_Success_ (return != FALSE)
+BOOL WINAPI AddShardedUnlimitedWaitObject (
+    _In_     ShardedUnlimitedWait * hShardedUnlimitedWait,
+    _In_     HANDLE          hObjectHandle,
+    _In_opt_ PUNLIMITED_WAIT_OBJECT_CALLBACK ptrCallbackFunction,
+    _In_opt_ PVOID           lpObjectContext,
+    _In_     DWORD           dwFlags
+);
+
+// RemoveShardedUnlimitedWaitObject
+//  - removes object from its shard, parameters and return values are the same as RemoveUnlimitedWaitObject
+//  - only that one shard is searched, the one recorded for explicitly placed object, or the one given by hash
+//
+_Success_ (return != FALSE)
+BOOL WINAPI RemoveShardedUnlimitedWaitObject (
+    _In_ ShardedUnlimitedWait * hShardedUnlimitedWait,
+    _In_ HANDLE          hObjectHandle,
+    _In_ BOOL            bKeepSignalsEnqueued
+);
+
+// WaitShardedUnlimitedWait
+//  - retrieves one object signalled status notification from the calling thread's shard, or steals one
+//  - parameters and return values are the same as WaitUnlimitedWait
+//
+_Success_ (return != FALSE)
+BOOL WINAPI WaitShardedUnlimitedWait (
+    _In_      ShardedUnlimitedWait * hShardedUnlimitedWait,
+    _Out_opt_ PVOID *         lpSignalledObjectContext,
+    _In_      DWORD           dwMilliseconds,
+    _In_      BOOL            bAlertable
+);
+
+// WaitShardedUnlimitedWaitEx
+//  - retrieves up to 'ulCount' of object signalled status notifications from the calling thread's shard,
+//    or, if there are none, steals batch of ready notifications from other shard
+//  - own shard is polled first, when it's empty, batch is stolen from other shard that has signals queued
+//    that none of its threads retrieved yet (they are all busy, or there are none), and only then the thread
+//    blocks on own shard:
+//     - while every shard has thread bound to it, this is single blocking wait, blocked threads don't steal
+//     - otherwise the blocking wait is cut into slices, stealing in between, starting at timer tick and
+//       doubling up to 64 ms while nothing is found
+//  - parameters and return values are the same as WaitUnlimitedWaitEx
+//
+_Success_ (return != FALSE)
+BOOL WINAPI WaitShardedUnlimitedWaitEx (
+    _In_ ShardedUnlimitedWait * hShardedUnlimitedWait,
+    _Out_writes_to_opt_ (ulCount,*ulNumEntriesProcessed) PVOID * lpSignalledObjectContexts, // array of 'ulCount'
+    _Out_writes_bytes_all_opt_ (32 * ulCount)            PVOID lpTemporaryBuffer, // 32 * ulCount buffer
+    _In_ _In_range_ (1, ULONG_MAX)                       ULONG ulCount,
+    _Out_opt_                                            ULONG * ulNumEntriesProcessed,
+    _In_ DWORD dwMilliseconds,
+    _In_ BOOL bAlertable
+);
+
+#endif
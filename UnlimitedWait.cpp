@@ -1,16 +1,104 @@
 #include "UnlimitedWait.h"
+#include "WaitCompletionPacketPool.h"
 #include <Winternl.h>
+#include <cassert>
 
+#ifndef STATUS_SUCCESS
+#define STATUS_SUCCESS                   ((NTSTATUS)0x00000000L)
+#endif
 #ifndef STATUS_INVALID_PARAMETER_3
 #define STATUS_INVALID_PARAMETER_3       ((NTSTATUS)0xC00000F1L)
 #endif
+#ifndef STATUS_OBJECT_TYPE_MISMATCH
+#define STATUS_OBJECT_TYPE_MISMATCH      ((NTSTATUS)0xC0000024L)
+#endif
+#ifndef STATUS_CANCELLED
+#define STATUS_CANCELLED                 ((NTSTATUS)0xC0000120L)
+#endif
+#ifndef STATUS_TIMEOUT
+#define STATUS_TIMEOUT                   ((NTSTATUS)0x00000102L)
+#endif
+#ifndef STATUS_USER_APC
+#define STATUS_USER_APC                  ((NTSTATUS)0x000000C0L)
+#endif
+#ifndef STATUS_ABANDONED_WAIT_0
+#define STATUS_ABANDONED_WAIT_0          ((NTSTATUS)0x00000080L)
+#endif
+
+// internal slot flags
+
+#define UNLIMITED_WAIT_SLOT_DRAINING        0x80000000 // removed, but its signal is still enqueued
+#define UNLIMITED_WAIT_SLOT_DISCARD         0x40000000 // with DRAINING, the enqueued signal is not reported
+#define UNLIMITED_WAIT_SLOT_VIRTUAL         0x20000000 // hObject is virtual object handle
+#define UNLIMITED_WAIT_SLOT_DRAIN_SEMAPHORE 0x10000000 // callback is PUNLIMITED_WAIT_SEMAPHORE_CALLBACK
+#define UNLIMITED_WAIT_SLOT_CALLBACK_EX     0x08000000 // callback is PUNLIMITED_WAIT_OBJECT_CALLBACK_EX
+#define UNLIMITED_WAIT_SLOT_DEFERRED        0x04000000 // callback deferred re-arming to ReArmUnlimitedWaitObject
+#define UNLIMITED_WAIT_SLOT_OFFLOADED       0x02000000 // retrieved, callback and re-arming is queued to worker pool
+#define UNLIMITED_WAIT_SLOT_CARRIED         0x01000000 // retrieved, left for next wait by exhausted time budget
+#define UNLIMITED_WAIT_SLOT_REPOSTED        0x00800000 // moved while signalled, the signal was posted again with new index
+
+// slot claim states, see SetAssociation
+
+#define UNLIMITED_WAIT_CLAIM_NONE           0
+#define UNLIMITED_WAIT_CLAIM_ARMING         1 // being re-armed, completion retrieved meanwhile is handed over
+#define UNLIMITED_WAIT_CLAIM_HANDED         2 // completion was retrieved and handed over to the re-arming thread
+
+// virtual object state bits
+
+#define UNLIMITED_WAIT_VIRTUAL_SIGNALLED    0x00000001
+#define UNLIMITED_WAIT_VIRTUAL_QUEUED       0x00000002 // completion is posted or being dispatched
+
+// number of temporary OVERLAPPED_ENTRY buffers kept by each instance for concurrent waits
+
+#define UNLIMITED_WAIT_SCRATCH_BUFFERS      4
+
+// maximum number of retrieved signals a worker dispatches under single acquisition of the lock
+
+#define UNLIMITED_WAIT_WORKER_BATCH         16
+
+// maximum number of signals delivered inline, without going through the completion port, per retrieved batch
+//  - bounds how long a constantly signalled object can keep the dispatching thread to itself
+
+#define UNLIMITED_WAIT_INLINE_BUDGET        16
+
+// adaptive batch size, see SetUnlimitedWaitBatchPolicy
+
+#define UNLIMITED_WAIT_BATCH_INITIAL        16
+#define UNLIMITED_WAIT_BATCH_MAXIMUM        4096
+
+// maximum number of pause instructions between two polls of adaptive spinning, the pause doubles after each poll
+
+#define UNLIMITED_WAIT_SPIN_BACKOFF_LIMIT   64
+
+// slot teardown in DeleteUnlimitedWait
+//  - instances with more slots than this are torn down by thread pool in chunks of this many slots
+
+#define UNLIMITED_WAIT_TEARDOWN_CHUNK       4096
+
+// maximum number of child's signals drained inline at once, see AddUnlimitedWaitChild
+
+#define UNLIMITED_WAIT_CHILD_BATCH          64
+
+// maximum number of slots tracked by SetUnlimitedWaitHeavyHitterTracking
+
+#define UNLIMITED_WAIT_HEAVY_HITTERS_MAXIMUM 1024
+
+// information value of completions posted by DeleteUnlimitedWait to wake threads waiting on the instance
+
+#define UNLIMITED_WAIT_QUIT_INDEX           0xFFFFFFFF
+
+// internal instance flags
+
+#define UNLIMITED_WAIT_FOREIGN_PORT         0x00000001 // hIOCP is owned by the application
+#define UNLIMITED_WAIT_SINGLE_OWNER         0x00000002 // created with UNLIMITED_WAIT_CREATE_SINGLE_THREADED, no locking
+#define UNLIMITED_WAIT_CALLER_MEMORY        0x00000004 // by InitializeUnlimitedWait, instance and fixed slot array not freed
+#define UNLIMITED_WAIT_PRECISE              0x00000008 // created with UNLIMITED_WAIT_CREATE_PRECISE_TIMEOUTS, last tick polled
+
+// creation flags accepted by CreateUnlimitedWaitEx(2) and InitializeUnlimitedWait
+
+#define UNLIMITED_WAIT_CREATE_FLAGS         (UNLIMITED_WAIT_CREATE_SINGLE_THREADED | UNLIMITED_WAIT_CREATE_PRECISE_TIMEOUTS)
 
 extern "C" {
-    WINBASEAPI NTSTATUS WINAPI NtCreateWaitCompletionPacket (
-        _Out_ PHANDLE WaitCompletionPacketHandle,
-        _In_ ACCESS_MASK DesiredAccess,
-        _In_opt_ POBJECT_ATTRIBUTES ObjectAttributes
-    );
     WINBASEAPI NTSTATUS WINAPI NtAssociateWaitCompletionPacket (
         _In_ HANDLE WaitCompletionPacketHandle,
         _In_ HANDLE IoCompletionHandle,
@@ -25,23 +113,456 @@ extern "C" {
         _In_ HANDLE WaitCompletionPacketHandle,
         _In_ BOOLEAN RemoveSignaledPacket
     );
+    WINBASEAPI NTSTATUS WINAPI NtRemoveIoCompletionEx (
+        _In_ HANDLE IoCompletionHandle,
+        _Out_writes_to_ (Count, *NumEntriesRemoved) PVOID IoCompletionInformation, // layout of OVERLAPPED_ENTRY
+        _In_ ULONG Count,
+        _Out_ PULONG NumEntriesRemoved,
+        _In_opt_ PLARGE_INTEGER Timeout,
+        _In_ BOOLEAN Alertable
+    );
+    WINBASEAPI NTSTATUS WINAPI NtQueryEvent (
+        _In_ HANDLE EventHandle,
+        _In_ ULONG EventInformationClass, // EventBasicInformation (0)
+        _Out_writes_bytes_ (EventInformationLength) PVOID EventInformation,
+        _In_ ULONG EventInformationLength,
+        _Out_opt_ PULONG ReturnLength
+    );
+    WINBASEAPI NTSTATUS WINAPI NtQuerySemaphore (
+        _In_ HANDLE SemaphoreHandle,
+        _In_ ULONG SemaphoreInformationClass, // SemaphoreBasicInformation (0)
+        _Out_writes_bytes_ (SemaphoreInformationLength) PVOID SemaphoreInformation,
+        _In_ ULONG SemaphoreInformationLength,
+        _Out_opt_ PULONG ReturnLength
+    );
+    WINBASEAPI NTSTATUS WINAPI NtQueryIoCompletion (
+        _In_ HANDLE IoCompletionHandle,
+        _In_ ULONG IoCompletionInformationClass, // IoCompletionBasicInformation (0)
+        _Out_writes_bytes_ (IoCompletionInformationLength) PVOID IoCompletionInformation,
+        _In_ ULONG IoCompletionInformationLength,
+        _Out_opt_ PULONG ReturnLength
+    );
+    WINBASEAPI NTSTATUS WINAPI NtQueryTimerResolution (
+        _Out_ PULONG MaximumTime,
+        _Out_ PULONG MinimumTime,
+        _Out_ PULONG CurrentTime
+    );
+
+    struct EVENT_BASIC_INFORMATION {
+        ULONG EventType;
+        LONG  EventState;
+    };
+    struct SEMAPHORE_BASIC_INFORMATION {
+        LONG CurrentCount;
+        LONG MaximumCount;
+    };
+    struct IO_COMPLETION_BASIC_INFORMATION {
+        LONG Depth;
+    };
+
+    // UnlimitedWaitCallback
+    //  - slot's callback, the member in use is selected by UNLIMITED_WAIT_SLOT_DRAIN_SEMAPHORE and _CALLBACK_EX flags,
+    //    all are NULL together when there's no callback
+    //
+    union UnlimitedWaitCallback {
+        PUNLIMITED_WAIT_OBJECT_CALLBACK    pfnObject;
+        PUNLIMITED_WAIT_SEMAPHORE_CALLBACK pfnSemaphore;
+        PUNLIMITED_WAIT_OBJECT_CALLBACK_EX pfnObjectEx;
+    };
 
     struct UnlimitedWaitSlot {
         HANDLE hWaitPacket;
         HANDLE hObject;
         DWORD  dwFlags;
+        UnlimitedWaitCallback callback;
+        PVOID  lpContext;
+        BOOL   bEnqueued; // association found the object signalled, completion is in the port until retrieved
+        volatile LONG claim; // UNLIMITED_WAIT_CLAIM_*
     };
 }
 
+// UnlimitedWaitVirtualObject
+//  - Set/Reset/Pulse don't take the instance lock, so everything they need is here, not in the slot
+//  - the handle value is pointer to this with lowest bit set, never colliding with kernel handles
+//
+struct UnlimitedWaitVirtualObject {
+    volatile LONG   state;
+    DWORD           dwFlags;
+    UnlimitedWait * instance;
+    SIZE_T          index;
+    PVOID           lpContext;
+};
+
+// UnlimitedWaitScratch
+//  - reusable buffer for GetQueuedCompletionStatusEx results, when application doesn't provide one
+//  - followed by 'nEntries' items of each of the UnlimitedWaitBatch arrays
+//
+struct UnlimitedWaitScratch {
+    ULONG            nEntries;
+    OVERLAPPED_ENTRY entries [1]; // 'nEntries' items
+};
+
+// UnlimitedWaitBatch
+//  - arrays collecting objects for the instance-level batch callback, as many items as retrieved entries
+//
+struct UnlimitedWaitBatch {
+    PVOID *  lpObjectContexts;
+    HANDLE * hObjects;
+    SIZE_T * indices;
+    BOOL *   bReArm;
+};
+
+// UnlimitedWaitWorkItem/UnlimitedWaitWorkers
+//  - bounded multi-producer multi-consumer ring of slot indices, from waiting threads to workers
+//  - each cell's 'sequence' tells whether it's free for push at that position, or filled for pop
+//  - idle workers sleep on 'nPending' with WaitOnAddress, stopping changes it too so no worker can miss it
+//
+struct UnlimitedWaitWorkItem {
+    volatile LONGLONG sequence;
+    SIZE_T            index;
+};
+
+struct UnlimitedWaitWorkers {
+    UnlimitedWait *   instance;
+    HANDLE *          hThreads;
+    DWORD             nThreads;
+    volatile LONG     bStop;
+    volatile LONG     nPending;
+    volatile LONGLONG head; // next position to pop
+    volatile LONGLONG tail; // next position to push
+    LONGLONG          mask;
+    UnlimitedWaitWorkItem ring [1]; // 'mask' + 1 items
+};
+
+// UnlimitedWaitSpin
+//  - state of adaptive polling before blocking wait, see SetUnlimitedWaitSpin
+//  - the average is updated by all waiting threads without synchronization, it needs to be approximate only
+//
+struct UnlimitedWaitSpin {
+    volatile LONGLONG nMaximum;     // longest spin window in 100 ns units, 0 when disabled
+    volatile LONGLONG tLastArrival; // when completions were last retrieved
+    volatile LONGLONG tAverageGap;  // moving average of time between retrievals
+    volatile LONGLONG nHits;
+    volatile LONGLONG nMisses;
+};
+
+// UnlimitedWaitBatching
+//  - state of adaptive batch sizing and time budget, see SetUnlimitedWaitBatchPolicy
+//  - 'carry' is ring of retrieved entries left unprocessed when the budget ran out, taken by the next wait first,
+//    'nCapacity' is power of 2
+//
+struct UnlimitedWaitBatching {
+    volatile LONGLONG  tBudget; // in 100 ns units, 0 when disabled
+    volatile LONG      nSize;
+    volatile LONGLONG  nCarriedOver;
+    SRWLOCK            carryLock;
+    OVERLAPPED_ENTRY * carry;
+    ULONG              nCapacity;
+    ULONG              head;
+    ULONG              nCarried;
+};
+
+// UnlimitedWaitHotSlot/UnlimitedWaitHeavyHitters
+//  - space-saving summaries of signals per slot, see SetUnlimitedWaitHeavyHitterTracking
+//  - slot not in the summary replaces the one with the lowest count, inheriting the count as its error bound
+//  - 'current' counts the window starting at 'tEpoch', 'previous' the one before, for sliding estimate
+//  - both arrays are allocated with this structure, 'nCapacity' items each
+//
+struct UnlimitedWaitHotSlot {
+    SIZE_T   index;
+    LONGLONG nCount;
+    LONGLONG nError;
+};
+
+struct UnlimitedWaitHeavyHitters {
+    SRWLOCK  lock;
+    ULONG    nCapacity;
+    ULONG    nCurrent;
+    ULONG    nPrevious;
+    LONGLONG tWindow; // in 100 ns units
+    LONGLONG tEpoch;
+    UnlimitedWaitHotSlot * current;
+    UnlimitedWaitHotSlot * previous;
+};
+
 struct UnlimitedWait {
     HANDLE  hIOCP;
     SRWLOCK srwLock;
+    DWORD   dwFlags;
+    DWORD   dwOwnerThreadId; // with UNLIMITED_WAIT_SINGLE_OWNER, checked in debug builds
     PVOID   lpWaitContext;
     PUNLIMITED_WAIT_CALLBACK pfnTimeoutCallback;
     PUNLIMITED_WAIT_CALLBACK pfnApcWakeCallback;
+    PUNLIMITED_WAIT_BATCH_CALLBACK pfnBatchCallback;
     UnlimitedWaitSlot *      slots;
+    SIZE_T                   nSlots;    // slots initialized, free or used
+    SIZE_T                   nCapacity; // slots allocated
+    UnlimitedWaitScratch * volatile scratch [UNLIMITED_WAIT_SCRATCH_BUFFERS];
+    volatile LONGLONG        nHeapOperations;
+    volatile LONGLONG        nInlineDeliveries;
+    UnlimitedWaitWorkers *   workers; // NULL unless started by StartUnlimitedWaitWorkers
+    volatile LONG            nWaiters; // threads in WaitUnlimitedWait(Ex), see DeleteUnlimitedWait
+    volatile LONG            bClosing;
+    UnlimitedWaitSpin        spin;
+    UnlimitedWaitBatching    batching;
+    UnlimitedWaitHeavyHitters * hitters; // NULL unless enabled by SetUnlimitedWaitHeavyHitterTracking
+    UNLIMITED_WAIT_ALLOCATOR    allocator; // 'hHeap' is set when there are no callbacks
 };
 
+namespace {
+    BOOL IsSingleOwner (const UnlimitedWait * instance) {
+        return instance->dwFlags & UNLIMITED_WAIT_SINGLE_OWNER;
+    }
+
+    // LockExclusive/UnlockExclusive/LockShared/UnlockShared
+    //  - the instance lock, elided for instances created with UNLIMITED_WAIT_CREATE_SINGLE_THREADED,
+    //    debug builds check that those are used by their owner thread only
+    //
+    void LockExclusive (UnlimitedWait * instance) {
+        if (IsSingleOwner (instance)) {
+            assert (instance->dwOwnerThreadId == GetCurrentThreadId ());
+        } else {
+            AcquireSRWLockExclusive (&instance->srwLock);
+        }
+    }
+    void UnlockExclusive (UnlimitedWait * instance) {
+        if (!IsSingleOwner (instance)) {
+            ReleaseSRWLockExclusive (&instance->srwLock);
+        }
+    }
+    void LockShared (UnlimitedWait * instance) {
+        if (IsSingleOwner (instance)) {
+            assert (instance->dwOwnerThreadId == GetCurrentThreadId ());
+        } else {
+            AcquireSRWLockShared (&instance->srwLock);
+        }
+    }
+    void UnlockShared (UnlimitedWait * instance) {
+        if (!IsSingleOwner (instance)) {
+            ReleaseSRWLockShared (&instance->srwLock);
+        }
+    }
+
+    // Count
+    //  - adds to statistics counter, without interlocked operation when there's single owner
+    //
+    void Count (UnlimitedWait * instance, volatile LONGLONG * counter, LONGLONG n = 1) {
+        if (IsSingleOwner (instance)) {
+            *counter += n;
+        } else {
+            InterlockedExchangeAdd64 (counter, n);
+        }
+    }
+
+    // AllocateWith/FreeWith
+    //  - allocation through application's callbacks, or from heap, see UNLIMITED_WAIT_ALLOCATOR
+    //
+    PVOID AllocateWith (const UNLIMITED_WAIT_ALLOCATOR * allocator, SIZE_T size) {
+        if (allocator->pfnAllocate)
+            return allocator->pfnAllocate (allocator->lpAllocatorContext, size);
+        else
+            return HeapAlloc (allocator->hHeap, 0, size);
+    }
+    BOOL FreeWith (const UNLIMITED_WAIT_ALLOCATOR * allocator, PVOID memory) {
+        if (allocator->pfnFree)
+            return allocator->pfnFree (allocator->lpAllocatorContext, memory);
+        else
+            return HeapFree (allocator->hHeap, 0, memory);
+    }
+
+    // SameAllocator
+    //  - whether memory allocated by one instance can be freed by the other
+    //
+    BOOL SameAllocator (const UnlimitedWait * a, const UnlimitedWait * b) {
+        return a->allocator.hHeap == b->allocator.hHeap
+            && a->allocator.pfnAllocate == b->allocator.pfnAllocate
+            && a->allocator.pfnFree == b->allocator.pfnFree
+            && a->allocator.lpAllocatorContext == b->allocator.lpAllocatorContext;
+    }
+
+    // Allocate/Reallocate/Free
+    //  - all heap operations on behalf of an instance go through here, so they can be counted
+    //  - Reallocate needs the current size for allocators without 'pfnReallocate'
+    //
+    PVOID Allocate (UnlimitedWait * instance, SIZE_T size) {
+        Count (instance, &instance->nHeapOperations);
+        return AllocateWith (&instance->allocator, size);
+    }
+    BOOL Free (UnlimitedWait * instance, PVOID memory) {
+        if (memory) {
+            Count (instance, &instance->nHeapOperations);
+            return FreeWith (&instance->allocator, memory);
+        } else
+            return TRUE;
+    }
+    PVOID Reallocate (UnlimitedWait * instance, PVOID memory, SIZE_T current, SIZE_T size) {
+        if (memory) {
+            if (instance->allocator.pfnAllocate) {
+                if (instance->allocator.pfnReallocate) {
+                    Count (instance, &instance->nHeapOperations);
+                    return instance->allocator.pfnReallocate (instance->allocator.lpAllocatorContext, memory, size);
+                }
+                PVOID reallocated = Allocate (instance, size);
+                if (reallocated) {
+                    CopyMemory (reallocated, memory, (current < size) ? current : size);
+                    Free (instance, memory);
+                }
+                return reallocated;
+            }
+            Count (instance, &instance->nHeapOperations);
+            return HeapReAlloc (instance->allocator.hHeap, 0, memory, size);
+        } else
+            return Allocate (instance, size);
+    }
+
+    // SlotsOffset
+    //  - where the fixed slot array follows the instance in memory provided to InitializeUnlimitedWait
+    //
+    constexpr SIZE_T SlotsOffset () {
+        return (sizeof (UnlimitedWait) + alignof (UnlimitedWaitSlot) - 1) & ~(alignof (UnlimitedWaitSlot) - 1);
+    }
+
+    // CounterNow
+    //  - performance counter in 100 ns units
+    //
+    LONGLONG CounterNow () {
+        LARGE_INTEGER frequency;
+        LARGE_INTEGER counter;
+        QueryPerformanceFrequency (&frequency);
+        QueryPerformanceCounter (&counter);
+
+        return (counter.QuadPart / frequency.QuadPart) * 10'000'000
+             + (counter.QuadPart % frequency.QuadPart) * 10'000'000 / frequency.QuadPart;
+    }
+}
+
+static
+UnlimitedWait * WINAPI CreateUnlimitedWaitImplementation (
+    _In_opt_ HANDLE hExistingIOCP,
+    _In_opt_ PVOID lpWaitContext,
+    _In_     DWORD nPreAllocatedSlots,
+    _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnTimeoutCallback,
+    _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnApcWakeCallback,
+    _In_     DWORD dwFlags,
+    _In_opt_ const UNLIMITED_WAIT_ALLOCATOR * lpAllocator,
+    _In_opt_ PVOID lpMemory
+) {
+    UNLIMITED_WAIT_ALLOCATOR allocator = {};
+    if (lpAllocator) {
+        if (!lpAllocator->pfnAllocate != !lpAllocator->pfnFree) {
+            SetLastError (ERROR_INVALID_PARAMETER);
+            return NULL;
+        }
+        allocator = *lpAllocator;
+    }
+    if (!allocator.pfnAllocate) {
+        allocator.pfnReallocate = NULL;
+        if (!allocator.hHeap) {
+            allocator.hHeap = GetProcessHeap ();
+        }
+    } else {
+        allocator.hHeap = NULL;
+    }
+
+    UnlimitedWait * instance = (UnlimitedWait *) (lpMemory ? lpMemory : AllocateWith (&allocator, sizeof (UnlimitedWait)));
+    if (instance) {
+        if (hExistingIOCP) {
+            instance->hIOCP = hExistingIOCP;
+            instance->dwFlags = UNLIMITED_WAIT_FOREIGN_PORT;
+        } else {
+            instance->hIOCP = CreateIoCompletionPort (INVALID_HANDLE_VALUE, NULL, 0, 0);
+            instance->dwFlags = 0;
+        }
+        if (dwFlags & UNLIMITED_WAIT_CREATE_SINGLE_THREADED) {
+            instance->dwFlags |= UNLIMITED_WAIT_SINGLE_OWNER;
+        }
+        if (dwFlags & UNLIMITED_WAIT_CREATE_PRECISE_TIMEOUTS) {
+            instance->dwFlags |= UNLIMITED_WAIT_PRECISE;
+        }
+        if (lpMemory) {
+            instance->dwFlags |= UNLIMITED_WAIT_CALLER_MEMORY;
+        }
+        if (instance->hIOCP) {
+            instance->srwLock = SRWLOCK_INIT;
+            instance->dwOwnerThreadId = GetCurrentThreadId ();
+            instance->lpWaitContext = lpWaitContext;
+            instance->pfnTimeoutCallback = pfnTimeoutCallback;
+            instance->pfnApcWakeCallback = pfnApcWakeCallback;
+            instance->pfnBatchCallback = NULL;
+            instance->slots = NULL;
+            instance->nSlots = 0;
+            instance->nCapacity = 0;
+            instance->nHeapOperations = 0;
+            instance->nInlineDeliveries = 0;
+            instance->workers = NULL;
+            instance->nWaiters = 0;
+            instance->bClosing = FALSE;
+            instance->spin.nMaximum = 0;
+            instance->spin.tLastArrival = 0;
+            instance->spin.tAverageGap = 0;
+            instance->spin.nHits = 0;
+            instance->spin.nMisses = 0;
+            instance->batching.tBudget = 0;
+            instance->batching.nSize = UNLIMITED_WAIT_BATCH_INITIAL;
+            instance->batching.nCarriedOver = 0;
+            instance->batching.carryLock = SRWLOCK_INIT;
+            instance->batching.carry = NULL;
+            instance->batching.nCapacity = 0;
+            instance->batching.head = 0;
+            instance->batching.nCarried = 0;
+            instance->hitters = NULL;
+            instance->allocator = allocator;
+
+            for (auto & scratch : instance->scratch) {
+                scratch = NULL;
+            }
+
+            if (nPreAllocatedSlots == 0) {
+                return instance;
+            }
+
+            if (lpMemory) {
+                instance->slots = (UnlimitedWaitSlot *) ((BYTE *) lpMemory + SlotsOffset ());
+            } else {
+                instance->slots = (UnlimitedWaitSlot *) Allocate (instance, nPreAllocatedSlots * sizeof (UnlimitedWaitSlot));
+            }
+            if (instance->slots) {
+                instance->nCapacity = nPreAllocatedSlots;
+
+                while ((instance->slots [instance->nSlots].hWaitPacket = AcquireWaitCompletionPacket ()) != NULL) {
+                    instance->slots [instance->nSlots].hObject = NULL;
+                    instance->slots [instance->nSlots].dwFlags = 0;
+                    instance->slots [instance->nSlots].bEnqueued = FALSE;
+                    instance->slots [instance->nSlots].claim = UNLIMITED_WAIT_CLAIM_NONE;
+
+                    if (++instance->nSlots == nPreAllocatedSlots) {
+                        return instance;
+                    }
+                }
+
+                DWORD error = GetLastError ();
+                while (instance->nSlots--) {
+                    ReleaseWaitCompletionPacket (instance->slots [instance->nSlots].hWaitPacket);
+                }
+                if (!lpMemory) {
+                    FreeWith (&allocator, instance->slots);
+                }
+                SetLastError (error);
+            } else {
+                SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+            }
+
+            if (!hExistingIOCP) {
+                CloseHandle (instance->hIOCP);
+            }
+        }
+        if (!lpMemory) {
+            FreeWith (&allocator, instance);
+        }
+    }
+    return NULL;
+}
+
 _Success_ (return != NULL)
 UnlimitedWait * WINAPI CreateUnlimitedWait (
     _In_opt_ PVOID lpWaitContext,
@@ -49,335 +570,2968 @@ UnlimitedWait * WINAPI CreateUnlimitedWait (
     _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnTimeoutCallback,
     _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnApcWakeCallback
 ) {
-    HANDLE hHeap = GetProcessHeap ();
-    UnlimitedWait * instance = (UnlimitedWait *) HeapAlloc (hHeap, 0, sizeof (UnlimitedWait));
+    return CreateUnlimitedWaitImplementation (NULL, lpWaitContext, nPreAllocatedSlots, pfnTimeoutCallback, pfnApcWakeCallback, 0, NULL, NULL);
+}
+
+_Success_ (return != NULL)
+UnlimitedWait * WINAPI CreateUnlimitedWaitEx (
+    _In_opt_ PVOID lpWaitContext,
+    _In_     DWORD nPreAllocatedSlots,
+    _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnTimeoutCallback,
+    _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnApcWakeCallback,
+    _In_     DWORD dwFlags
+) {
+    if (dwFlags & ~UNLIMITED_WAIT_CREATE_FLAGS) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return NULL;
+    }
+    return CreateUnlimitedWaitImplementation (NULL, lpWaitContext, nPreAllocatedSlots, pfnTimeoutCallback, pfnApcWakeCallback, dwFlags, NULL, NULL);
+}
+
+_Success_ (return != NULL)
+UnlimitedWait * WINAPI CreateUnlimitedWaitEx2 (
+    _In_opt_ PVOID lpWaitContext,
+    _In_     DWORD nPreAllocatedSlots,
+    _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnTimeoutCallback,
+    _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnApcWakeCallback,
+    _In_     DWORD dwFlags,
+    _In_opt_ const UNLIMITED_WAIT_ALLOCATOR * lpAllocator
+) {
+    if (dwFlags & ~UNLIMITED_WAIT_CREATE_FLAGS) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return NULL;
+    }
+    return CreateUnlimitedWaitImplementation (NULL, lpWaitContext, nPreAllocatedSlots, pfnTimeoutCallback, pfnApcWakeCallback, dwFlags, lpAllocator, NULL);
+}
+
+SIZE_T WINAPI GetUnlimitedWaitMemorySize (
+    _In_ DWORD nSlots
+) {
+    return SlotsOffset () + nSlots * sizeof (UnlimitedWaitSlot);
+}
+
+_Success_ (return != NULL)
+UnlimitedWait * WINAPI InitializeUnlimitedWait (
+    _Out_writes_bytes_ (cbMemory) PVOID lpMemory,
+    _In_     SIZE_T cbMemory,
+    _In_opt_ PVOID lpWaitContext,
+    _In_     DWORD nSlots,
+    _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnTimeoutCallback,
+    _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnApcWakeCallback,
+    _In_     DWORD dwFlags,
+    _In_opt_ const UNLIMITED_WAIT_ALLOCATOR * lpAllocator
+) {
+    if (!lpMemory || ((ULONG_PTR) lpMemory % alignof (UnlimitedWait)) || !nSlots
+            || (dwFlags & ~UNLIMITED_WAIT_CREATE_FLAGS)) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return NULL;
+    }
+    if (cbMemory < GetUnlimitedWaitMemorySize (nSlots)) {
+        SetLastError (ERROR_INSUFFICIENT_BUFFER);
+        return NULL;
+    }
+    return CreateUnlimitedWaitImplementation (NULL, lpWaitContext, nSlots, pfnTimeoutCallback, pfnApcWakeCallback, dwFlags, lpAllocator, lpMemory);
+}
+
+_Success_ (return != NULL)
+UnlimitedWait * WINAPI CreateUnlimitedWaitOnPort (
+    _In_     HANDLE hExistingIOCP,
+    _In_opt_ PVOID lpWaitContext,
+    _In_     DWORD nPreAllocatedSlots
+) {
+    if (!hExistingIOCP || (hExistingIOCP == INVALID_HANDLE_VALUE)) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return NULL;
+    }
+    return CreateUnlimitedWaitImplementation (hExistingIOCP, lpWaitContext, nPreAllocatedSlots, NULL, NULL, 0, NULL, NULL);
+}
+
+namespace {
+
+    // StopWorkers
+    //  - tells workers to exit once the ring is drained, caller then joins the threads
+    //  - 'nPending' is bumped too, a worker that saw 'bStop' clear right before would otherwise sleep on unchanged zero forever
+    //
+    void StopWorkers (UnlimitedWaitWorkers * workers) {
+        InterlockedExchange (&workers->bStop, TRUE);
+        InterlockedIncrement (&workers->nPending);
+        WakeByAddressAll ((PVOID) &workers->nPending);
+    }
+
+    // DetachWorkers
+    //  - stops dispatching to worker pool, waits for workers to finish what's queued, and frees the pool
+    //  - lock must NOT be held, the workers need it to finish
+    //
+    BOOL DetachWorkers (UnlimitedWait * instance) {
+        LockExclusive (instance);
+        UnlimitedWaitWorkers * workers = instance->workers;
+        instance->workers = NULL;
+        UnlockExclusive (instance);
+
+        if (!workers)
+            return FALSE;
+
+        StopWorkers (workers);
+
+        for (DWORD i = 0; i != workers->nThreads; ++i) {
+            WaitForSingleObject (workers->hThreads [i], INFINITE);
+            CloseHandle (workers->hThreads [i]);
+        }
+
+        Free (instance, workers->hThreads);
+        Free (instance, workers);
+        return TRUE;
+    }
+
+    // WakeWaiters
+    //  - posts one quit completion for each thread waiting on the instance, so they release the lock and leave
+    //  - threads entering the wait after 'bClosing' is set see it and leave without waiting
+    //
+    void WakeWaiters (UnlimitedWait * instance) {
+        if (IsSingleOwner (instance)) {
+            instance->bClosing = TRUE;
+            return;
+        }
+        InterlockedExchange (&instance->bClosing, TRUE);
+
+        if (!(instance->dwFlags & UNLIMITED_WAIT_FOREIGN_PORT)) {
+            LONG n = InterlockedCompareExchange (&instance->nWaiters, 0, 0);
+            while (n-- > 0) {
+                PostQueuedCompletionStatus (instance->hIOCP, UNLIMITED_WAIT_QUIT_INDEX, (ULONG_PTR) instance, NULL);
+            }
+        }
+    }
+
+    // TeardownSlots
+    //  - cancels and releases wait packets, and closes or frees objects, of slots 'begin' to 'end'
+    //
+    BOOL TeardownSlots (UnlimitedWait * instance, SIZE_T begin, SIZE_T end) {
+        BOOL result = TRUE;
+        for (SIZE_T i = begin; i != end; ++i) {
+            UnlimitedWaitSlot * slot = &instance->slots [i];
+            if (slot->hWaitPacket) {
+                NtCancelWaitCompletionPacket (slot->hWaitPacket, TRUE);
+                ReleaseWaitCompletionPacket (slot->hWaitPacket);
+            }
+
+            if (slot->hObject) {
+                if (slot->dwFlags & UNLIMITED_WAIT_SLOT_VIRTUAL) {
+                    if (!Free (instance, (PVOID) ((ULONG_PTR) slot->hObject & ~(ULONG_PTR) 1))) {
+                        result = FALSE;
+                    }
+                } else
+                if (slot->dwFlags & UNLIMITED_WAIT_OBJECT_CLOSE_HANDLE) {
+                    if (!CloseHandle (slot->hObject)) {
+                        result = FALSE;
+                    }
+                }
+            }
+        }
+        return result;
+    }
+
+    // UnlimitedWaitTeardown
+    //  - shared by DeleteUnlimitedWait and the thread pool callbacks it submits, all take chunks from 'next'
+    //  - 'nActive' counts submitted callbacks that may yet touch this structure, plus the deleting thread
+    //
+    struct UnlimitedWaitTeardown {
+        UnlimitedWait *   instance;
+        volatile LONGLONG next;
+        volatile LONG     nActive;
+        volatile LONG     bResult;
+    };
+
+    void TeardownChunks (UnlimitedWaitTeardown * teardown) {
+        SIZE_T nSlots = teardown->instance->nSlots;
+        SIZE_T begin;
+
+        while ((begin = (SIZE_T) InterlockedExchangeAdd64 (&teardown->next, UNLIMITED_WAIT_TEARDOWN_CHUNK)) < nSlots) {
+            SIZE_T end = begin + UNLIMITED_WAIT_TEARDOWN_CHUNK;
+            if (end > nSlots) {
+                end = nSlots;
+            }
+            if (!TeardownSlots (teardown->instance, begin, end)) {
+                InterlockedExchange (&teardown->bResult, FALSE);
+            }
+        }
+    }
+
+    VOID CALLBACK TeardownCallback (PTP_CALLBACK_INSTANCE, PVOID parameter) {
+        UnlimitedWaitTeardown * teardown = (UnlimitedWaitTeardown *) parameter;
+        TeardownChunks (teardown);
+
+        if (InterlockedDecrement (&teardown->nActive) == 0) {
+            WakeByAddressSingle ((PVOID) &teardown->nActive);
+        }
+    }
+
+    // TeardownAllSlots
+    //  - large instances are torn down in parallel, closing a million handles serially takes seconds
+    //  - the deleting thread takes chunks too, so it completes even when no pool thread gets to run
+    //
+    BOOL TeardownAllSlots (UnlimitedWait * instance) {
+        SIZE_T nChunks = (instance->nSlots + UNLIMITED_WAIT_TEARDOWN_CHUNK - 1) / UNLIMITED_WAIT_TEARDOWN_CHUNK;
+
+        // single owner instance's counters are not interlocked, keep it on this thread
+
+        if ((nChunks < 2) || IsSingleOwner (instance))
+            return TeardownSlots (instance, 0, instance->nSlots);
+
+        SIZE_T nHelpers = GetActiveProcessorCount (ALL_PROCESSOR_GROUPS);
+        if (nHelpers > nChunks) {
+            nHelpers = nChunks;
+        }
+
+        UnlimitedWaitTeardown teardown;
+        teardown.instance = instance;
+        teardown.next = 0;
+        teardown.nActive = 1;
+        teardown.bResult = TRUE;
+
+        while (--nHelpers) {
+            InterlockedIncrement (&teardown.nActive);
+            if (!TrySubmitThreadpoolCallback (TeardownCallback, &teardown, NULL)) {
+                InterlockedDecrement (&teardown.nActive);
+                break;
+            }
+        }
+
+        TeardownChunks (&teardown);
+
+        LONG nActive = InterlockedDecrement (&teardown.nActive);
+        while (nActive != 0) {
+            WaitOnAddress (&teardown.nActive, &nActive, sizeof nActive, INFINITE);
+            nActive = teardown.nActive;
+        }
+        return teardown.bResult;
+    }
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI DeleteUnlimitedWait (
+    _In_ UnlimitedWait * instance
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    BOOL result = TRUE;
+
+    // woken waiters release their shared locks, after this no other thread uses the instance
+
+    WakeWaiters (instance);
+    DetachWorkers (instance);
+
+    LockExclusive (instance);
+
+    if (instance->slots) {
+        if (!TeardownAllSlots (instance)) {
+            result = FALSE;
+        }
+        if (!(instance->dwFlags & UNLIMITED_WAIT_CALLER_MEMORY)) {
+            if (!Free (instance, instance->slots)) {
+                result = FALSE;
+            }
+        }
+    }
+    for (auto & scratch : instance->scratch) {
+        if (!Free (instance, scratch)) {
+            result = FALSE;
+        }
+    }
+    if (!Free (instance, instance->batching.carry)) {
+        result = FALSE;
+    }
+    if (!Free (instance, instance->hitters)) {
+        result = FALSE;
+    }
+
+    UnlockExclusive (instance);
+
+    if (!(instance->dwFlags & UNLIMITED_WAIT_FOREIGN_PORT)) {
+        if (!CloseHandle (instance->hIOCP)) {
+            result = FALSE;
+        }
+    }
+    if (!(instance->dwFlags & UNLIMITED_WAIT_CALLER_MEMORY)) {
+        UNLIMITED_WAIT_ALLOCATOR allocator = instance->allocator;
+        if (!FreeWith (&allocator, instance)) {
+            result = FALSE;
+        }
+    }
+    return result;
+}
+
+namespace {
+
+    // SetAssociation
+    //  - arms slot's packet to complete with: key = instance, APC context = object context, information = slot index
+    //  - the instance pointer as completion key is what tells our completions apart on a shared IOCP
+    //  - the handle is stored before arming, the completion may be retrieved by other thread right away
+    //  - 'bShared' - only shared lock is held, so other threads may retrieve and dispatch the completion,
+    //    and re-arm the slot, as soon as it's armed; nothing in the slot is written after that then
+    //    ('bEnqueued' stays clear, it's only a hint for QueryUnlimitedWaitReadiness)
+    //  - with 'bSignalled', when the object was already signalled, the completion just queued is taken back and
+    //    TRUE returned there, the caller then delivers the signal itself
+    //     - with 'bShared' the slot is claimed first, the thread that retrieves its completion meanwhile hands it over
+    //       (see HandOver) instead of dispatching and re-arming it, so that the cancel can't hit association made
+    //       by other thread; completion handed over is delivered by the caller too
+    //
+    BOOL SetAssociation (UnlimitedWait * instance, SIZE_T i, HANDLE hObjectHandle, BOOL bShared, BOOL * bSignalled = NULL) {
+        UnlimitedWaitSlot * slot = &instance->slots [i];
+        HANDLE hPrevious = slot->hObject;
+        BOOLEAN bAlreadySignaled = FALSE;
+
+        if (IsSingleOwner (instance)) {
+            bShared = FALSE;
+        }
+        if (bShared && bSignalled) {
+            slot->claim = UNLIMITED_WAIT_CLAIM_ARMING;
+        }
+        slot->hObject = hObjectHandle;
+        slot->bEnqueued = FALSE;
+
+        HRESULT status = NtAssociateWaitCompletionPacket (slot->hWaitPacket, instance->hIOCP, hObjectHandle,
+                                                          instance, slot->lpContext, 0, i, &bAlreadySignaled);
+        if (SUCCEEDED (status)) {
+            if (bSignalled) {
+                *bSignalled = bAlreadySignaled
+                           && (NtCancelWaitCompletionPacket (slot->hWaitPacket, TRUE) == STATUS_CANCELLED);
+
+                // completion retrieved by other thread was either handed over, or is dispatched by it after this
+
+                if (bShared) {
+                    if (InterlockedExchange (&slot->claim, UNLIMITED_WAIT_CLAIM_NONE) == UNLIMITED_WAIT_CLAIM_HANDED) {
+                        *bSignalled = TRUE;
+                    }
+                    return TRUE;
+                }
+                if (*bSignalled) {
+                    bAlreadySignaled = FALSE;
+                }
+            }
+            if (!bShared) {
+                slot->bEnqueued = bAlreadySignaled;
+            }
+            return TRUE;
+
+        } else {
+            slot->claim = UNLIMITED_WAIT_CLAIM_NONE;
+            slot->hObject = hPrevious;
+
+            if (status == STATUS_INVALID_PARAMETER_3) {
+                SetLastError (ERROR_INVALID_HANDLE);
+            } else {
+                SetLastError (RtlNtStatusToDosError (status));
+            }
+            return FALSE;
+        }
+    }
+
+    // HandOver
+    //  - hands retrieved completion of slot that is being re-armed by other thread over to it, see SetAssociation
+    //  - returns TRUE if it did, the entry is then skipped, the slot belongs to the re-arming thread
+    //
+    BOOL HandOver (UnlimitedWaitSlot * slot) {
+        return (slot->claim == UNLIMITED_WAIT_CLAIM_ARMING)
+            && (InterlockedCompareExchange (&slot->claim, UNLIMITED_WAIT_CLAIM_HANDED, UNLIMITED_WAIT_CLAIM_ARMING) == UNLIMITED_WAIT_CLAIM_ARMING);
+    }
+
+    void SetSlot (UnlimitedWaitSlot * slot, UnlimitedWaitCallback callback, PVOID lpObjectContext, DWORD dwFlags) {
+        slot->callback = callback;
+        slot->lpContext = lpObjectContext;
+        slot->dwFlags = dwFlags;
+        slot->bEnqueued = FALSE;
+        slot->claim = UNLIMITED_WAIT_CLAIM_NONE;
+    }
+
+    // FindFreeSlot
+    //  - finds unused slot, or appends new one with fresh packet
+    //  - lock must be held (exclusive)
+    //  - returns slot index or (SIZE_T) -1 on failure
+    //
+    SIZE_T FindFreeSlot (UnlimitedWait * instance) {
+        SIZE_T nSlots = instance->nSlots;
+
+        for (SIZE_T i = 0; i != nSlots; ++i) {
+            if ((instance->slots [i].hWaitPacket != NULL) && (instance->slots [i].hObject == NULL)
+                    && !(instance->slots [i].dwFlags & UNLIMITED_WAIT_SLOT_DRAINING)) {
+                return i;
+            }
+        }
+
+        // grow geometrically, so that adding N objects costs O(log N) reallocations
+
+        if (nSlots == instance->nCapacity) {
+            if (instance->dwFlags & UNLIMITED_WAIT_CALLER_MEMORY) {
+                SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+                return (SIZE_T) -1;
+            }
+
+            SIZE_T nCapacity = nSlots ? 2 * nSlots : 4;
+            if (auto newSlots = Reallocate (instance, instance->slots, instance->nCapacity * sizeof (UnlimitedWaitSlot),
+                                            nCapacity * sizeof (UnlimitedWaitSlot))) {
+                instance->slots = (UnlimitedWaitSlot *) newSlots;
+                instance->nCapacity = nCapacity;
+            } else {
+                SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+                return (SIZE_T) -1;
+            }
+        }
+
+        instance->slots [nSlots].hWaitPacket = AcquireWaitCompletionPacket ();
+        if (instance->slots [nSlots].hWaitPacket) {
+            instance->slots [nSlots].hObject = NULL;
+            SetSlot (&instance->slots [nSlots], UnlimitedWaitCallback { NULL }, NULL, 0);
+
+            instance->nSlots = nSlots + 1;
+            return nSlots;
+        }
+        return (SIZE_T) -1;
+    }
+}
+
+static
+BOOL WINAPI AddUnlimitedWaitObjectImplementation (
+    _In_ UnlimitedWait * instance,
+    _In_ HANDLE hObjectHandle,
+    _In_ UnlimitedWaitCallback callback,
+    _In_opt_ PVOID lpObjectContext,
+    _In_     DWORD dwFlags
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    if (!hObjectHandle) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    LockExclusive (instance);
+
+    BOOL result = FALSE;
+    SIZE_T i = FindFreeSlot (instance);
+    if (i != (SIZE_T) -1) {
+        SetSlot (&instance->slots [i], callback, lpObjectContext, dwFlags);
+
+        result = SetAssociation (instance, i, hObjectHandle, FALSE);
+        if (!result) {
+            instance->slots [i].dwFlags = 0;
+        }
+    }
+
+    UnlockExclusive (instance);
+    return result;
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI AddUnlimitedWaitObject (
+    _In_ UnlimitedWait * instance,
+    _In_ HANDLE hObjectHandle,
+    _In_opt_ PUNLIMITED_WAIT_OBJECT_CALLBACK ptrCallbackFunction,
+    _In_opt_ PVOID lpObjectContext,
+    _In_     DWORD dwFlags
+) {
+    UnlimitedWaitCallback callback;
+    callback.pfnObject = ptrCallbackFunction;
+
+    return AddUnlimitedWaitObjectImplementation (instance, hObjectHandle, callback, lpObjectContext, dwFlags & 0x0000FFFF);
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI AddUnlimitedWaitObjectEx (
+    _In_ UnlimitedWait * instance,
+    _In_ HANDLE hObjectHandle,
+    _In_opt_ PUNLIMITED_WAIT_OBJECT_CALLBACK_EX ptrCallbackFunction,
+    _In_opt_ PVOID lpObjectContext,
+    _In_     DWORD dwFlags
+) {
+    UnlimitedWaitCallback callback;
+    callback.pfnObjectEx = ptrCallbackFunction;
+
+    return AddUnlimitedWaitObjectImplementation (instance, hObjectHandle, callback, lpObjectContext,
+                                                 (dwFlags & 0x0000FFFF) | UNLIMITED_WAIT_SLOT_CALLBACK_EX);
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI AddUnlimitedWaitSemaphore (
+    _In_ UnlimitedWait * instance,
+    _In_ HANDLE hSemaphoreHandle,
+    _In_opt_ PUNLIMITED_WAIT_SEMAPHORE_CALLBACK ptrCallbackFunction,
+    _In_opt_ PVOID lpObjectContext,
+    _In_     DWORD dwFlags
+) {
+    UnlimitedWaitCallback callback;
+    callback.pfnSemaphore = ptrCallbackFunction;
+
+    return AddUnlimitedWaitObjectImplementation (instance, hSemaphoreHandle, callback, lpObjectContext,
+                                                 (dwFlags & 0x0000FFFF) | UNLIMITED_WAIT_SLOT_DRAIN_SEMAPHORE);
+}
+
+namespace {
+    UnlimitedWaitVirtualObject * GetVirtualObject (HANDLE hVirtualObject) {
+        if ((ULONG_PTR) hVirtualObject & 1) {
+            return (UnlimitedWaitVirtualObject *) ((ULONG_PTR) hVirtualObject & ~(ULONG_PTR) 1);
+        } else
+            return NULL;
+    }
+
+    BOOL PostVirtualObject (UnlimitedWaitVirtualObject * object) {
+        return PostQueuedCompletionStatus (object->instance->hIOCP, (DWORD) object->index,
+                                           (ULONG_PTR) object->instance, (LPOVERLAPPED) object->lpContext);
+    }
+
+    // ReArmVirtualObject
+    //  - called after the callback, posts again if the object was signalled meanwhile (or is manual-reset),
+    //    otherwise clears QUEUED so that next Set posts
+    //
+    BOOL ReArmVirtualObject (UnlimitedWaitVirtualObject * object) {
+        LONG state = object->state;
+        while (true) {
+            if (state & UNLIMITED_WAIT_VIRTUAL_SIGNALLED)
+                return PostVirtualObject (object);
+
+            LONG previous = InterlockedCompareExchange (&object->state, state & ~UNLIMITED_WAIT_VIRTUAL_QUEUED, state);
+            if (previous == state)
+                return TRUE;
+
+            state = previous;
+        }
+    }
+}
+
+_Success_ (return != NULL)
+HANDLE WINAPI AddUnlimitedWaitVirtualObject (
+    _In_     UnlimitedWait * instance,
+    _In_opt_ PUNLIMITED_WAIT_OBJECT_CALLBACK ptrCallbackFunction,
+    _In_opt_ PVOID lpObjectContext,
+    _In_     DWORD dwFlags
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return NULL;
+    }
+
+    UnlimitedWaitVirtualObject * object = (UnlimitedWaitVirtualObject *) Allocate (instance, sizeof (UnlimitedWaitVirtualObject));
+    if (!object) {
+        SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+        return NULL;
+    }
+
+    LockExclusive (instance);
+
+    SIZE_T i = FindFreeSlot (instance);
+    if (i != (SIZE_T) -1) {
+        HANDLE hVirtualObject = (HANDLE) ((ULONG_PTR) object | 1);
+
+        object->state = 0;
+        object->dwFlags = dwFlags;
+        object->instance = instance;
+        object->index = i;
+        object->lpContext = lpObjectContext;
+
+        SetSlot (&instance->slots [i], UnlimitedWaitCallback { ptrCallbackFunction }, lpObjectContext, UNLIMITED_WAIT_SLOT_VIRTUAL);
+        instance->slots [i].hObject = hVirtualObject;
+
+        UnlockExclusive (instance);
+
+        if (dwFlags & UNLIMITED_WAIT_OBJECT_INITIAL_STATE) {
+            SetUnlimitedWaitVirtualObject (hVirtualObject);
+        }
+        return hVirtualObject;
+    }
+
+    UnlockExclusive (instance);
+    Free (instance, object);
+    return NULL;
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI SetUnlimitedWaitVirtualObject (
+    _In_ HANDLE hVirtualObject
+) {
+    UnlimitedWaitVirtualObject * object = GetVirtualObject (hVirtualObject);
+    if (!object) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    // already queued signal coalesces this one
+
+    LONG previous = InterlockedOr (&object->state, UNLIMITED_WAIT_VIRTUAL_SIGNALLED | UNLIMITED_WAIT_VIRTUAL_QUEUED);
+    if (!(previous & UNLIMITED_WAIT_VIRTUAL_QUEUED)) {
+        return PostVirtualObject (object);
+    }
+    return TRUE;
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI ResetUnlimitedWaitVirtualObject (
+    _In_ HANDLE hVirtualObject
+) {
+    UnlimitedWaitVirtualObject * object = GetVirtualObject (hVirtualObject);
+    if (!object) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    InterlockedAnd (&object->state, ~UNLIMITED_WAIT_VIRTUAL_SIGNALLED);
+    return TRUE;
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI PulseUnlimitedWaitVirtualObject (
+    _In_ HANDLE hVirtualObject
+) {
+    UnlimitedWaitVirtualObject * object = GetVirtualObject (hVirtualObject);
+    if (!object) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    LONG state = object->state;
+    while (true) {
+        LONG previous = InterlockedCompareExchange (&object->state, (state | UNLIMITED_WAIT_VIRTUAL_QUEUED) & ~UNLIMITED_WAIT_VIRTUAL_SIGNALLED, state);
+        if (previous == state)
+            break;
+
+        state = previous;
+    }
+
+    if (!(state & UNLIMITED_WAIT_VIRTUAL_QUEUED)) {
+        return PostVirtualObject (object);
+    }
+    return TRUE;
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI ReArmUnlimitedWaitObject (
+    _In_ UnlimitedWait * instance,
+    _In_ HANDLE hObjectHandle
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    if (!hObjectHandle) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    // deferred slot is owned by the caller until re-armed, shared lock suffices
+
+    LockShared (instance);
+
+    for (SIZE_T i = 0; i != instance->nSlots; ++i) {
+        if ((instance->slots [i].hObject == hObjectHandle) && (instance->slots [i].dwFlags & UNLIMITED_WAIT_SLOT_DEFERRED)) {
+            instance->slots [i].dwFlags &= ~UNLIMITED_WAIT_SLOT_DEFERRED;
+
+            BOOL result = SetAssociation (instance, i, hObjectHandle, TRUE);
+            if (!result) {
+                instance->slots [i].dwFlags |= UNLIMITED_WAIT_SLOT_DEFERRED;
+            }
+
+            UnlockShared (instance);
+            return result;
+        }
+    }
+
+    UnlockShared (instance);
+    SetLastError (ERROR_FILE_NOT_FOUND);
+    return FALSE;
+}
+
+namespace {
+
+    // RemoveSlot
+    //  - stops waiting on object in slot 'i', see RemoveUnlimitedWaitObject for 'bKeepSignalsEnqueued'
+    //  - lock must be held (exclusive)
+    //
+    BOOL RemoveSlot (UnlimitedWait * instance, SIZE_T i, BOOL bKeepSignalsEnqueued) {
+        if (instance->slots [i].dwFlags & UNLIMITED_WAIT_SLOT_VIRTUAL) {
+            UnlimitedWaitVirtualObject * object = GetVirtualObject (instance->slots [i].hObject);
+
+            // setting QUEUED stops further posts, if it was already set, the completion is in the port
+
+            if (InterlockedOr (&object->state, UNLIMITED_WAIT_VIRTUAL_QUEUED) & UNLIMITED_WAIT_VIRTUAL_QUEUED) {
+                instance->slots [i].dwFlags |= UNLIMITED_WAIT_SLOT_DRAINING;
+                if (!bKeepSignalsEnqueued) {
+                    instance->slots [i].dwFlags |= UNLIMITED_WAIT_SLOT_DISCARD;
+                }
+            }
+            instance->slots [i].hObject = NULL;
+
+            Free (instance, object);
+            return TRUE;
+        }
+
+        // the signal was retrieved and is queued for worker, which will find the slot draining
+
+        if (instance->slots [i].dwFlags & UNLIMITED_WAIT_SLOT_OFFLOADED) {
+            instance->slots [i].dwFlags |= UNLIMITED_WAIT_SLOT_DRAINING | UNLIMITED_WAIT_SLOT_DISCARD;
+            instance->slots [i].hObject = NULL;
+            return TRUE;
+        }
+
+        // the signal was retrieved and carried over to next wait, or posted again by MoveSlot, not reported yet,
+        // the packet is idle and the completion can't be recalled
+
+        if (instance->slots [i].dwFlags & (UNLIMITED_WAIT_SLOT_CARRIED | UNLIMITED_WAIT_SLOT_REPOSTED)) {
+            instance->slots [i].dwFlags |= UNLIMITED_WAIT_SLOT_DRAINING;
+            if (!bKeepSignalsEnqueued) {
+                instance->slots [i].dwFlags |= UNLIMITED_WAIT_SLOT_DISCARD;
+            }
+            instance->slots [i].hObject = NULL;
+            return TRUE;
+        }
+
+        HRESULT status = NtCancelWaitCompletionPacket (instance->slots [i].hWaitPacket, !bKeepSignalsEnqueued);
+        if (SUCCEEDED (status) || (status == STATUS_CANCELLED)) {
+            instance->slots [i].hObject = NULL;
+
+            // STATUS_CANCELLED means the object was already signalled, if the completion
+            // was left enqueued, the slot cannot be reused until it's retrieved
+
+            if ((status == STATUS_CANCELLED) && bKeepSignalsEnqueued) {
+                instance->slots [i].dwFlags |= UNLIMITED_WAIT_SLOT_DRAINING;
+            }
+            return TRUE;
+        } else {
+            SetLastError (RtlNtStatusToDosError (status));
+            return FALSE;
+        }
+    }
+
+    // HashHandle
+    //  - index into power of two sized table, handle values are multiples of 4
+    //
+    SIZE_T HashHandle (HANDLE hObject, SIZE_T mask) {
+        return (SIZE_T) (((ULONGLONG) (ULONG_PTR) hObject >> 2) * 0x9E3779B97F4A7C15uLL >> 32) & mask;
+    }
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI RemoveUnlimitedWaitObject (
+    _In_ UnlimitedWait * instance,
+    _In_ HANDLE hObjectHandle,
+    _In_ BOOL bKeepSignalsEnqueued
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    if (!hObjectHandle) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    LockExclusive (instance);
+
+    for (SIZE_T i = 0; i != instance->nSlots; ++i) {
+        if (instance->slots [i].hObject == hObjectHandle) {
+            BOOL result = RemoveSlot (instance, i, bKeepSignalsEnqueued);
+
+            UnlockExclusive (instance);
+            return result;
+        }
+    }
+
+    UnlockExclusive (instance);
+    SetLastError (ERROR_FILE_NOT_FOUND);
+    return FALSE;
+}
+
+_Success_ (return != 0)
+ULONG WINAPI RemoveUnlimitedWaitObjects (
+    _In_ UnlimitedWait * instance,
+    _In_ ULONG nCount,
+    _In_reads_ (nCount) const HANDLE * hObjectHandles,
+    _In_ BOOL bKeepSignalsEnqueued,
+    _Out_writes_opt_ (nCount) DWORD * dwErrors
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return 0;
+    }
+    if (!nCount || !hObjectHandles) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return 0;
+    }
+
+    // open addressing table of 'hObjectHandles' indices + 1, at most half full,
+    // so that the slots are scanned once, not once per handle
+
+    ULONG local [64];
+    ULONG * table = local;
+    SIZE_T size = 64;
+
+    while (size < 2 * (SIZE_T) nCount) {
+        size *= 2;
+    }
+    if (size > sizeof local / sizeof local [0]) {
+        table = (ULONG *) Allocate (instance, size * sizeof (ULONG));
+        if (!table) {
+            SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+            return 0;
+        }
+    }
+    for (SIZE_T i = 0; i != size; ++i) {
+        table [i] = 0;
+    }
+
+    for (ULONG i = 0; i != nCount; ++i) {
+        if (dwErrors) {
+            dwErrors [i] = hObjectHandles [i] ? ERROR_FILE_NOT_FOUND : ERROR_INVALID_PARAMETER;
+        }
+        if (hObjectHandles [i]) {
+            SIZE_T h = HashHandle (hObjectHandles [i], size - 1);
+            while (table [h] && (hObjectHandles [table [h] - 1] != hObjectHandles [i])) {
+                h = (h + 1) & (size - 1);
+            }
+            if (!table [h]) {
+                table [h] = i + 1;
+            }
+        }
+    }
+
+    ULONG nRemoved = 0;
+    DWORD error = ERROR_SUCCESS;
+
+    LockExclusive (instance);
+
+    for (SIZE_T i = 0; (i != instance->nSlots) && (nRemoved != nCount); ++i) {
+        HANDLE hObject = instance->slots [i].hObject;
+        if (!hObject)
+            continue;
+
+        SIZE_T h = HashHandle (hObject, size - 1);
+        while (table [h] && (hObjectHandles [table [h] - 1] != hObject)) {
+            h = (h + 1) & (size - 1);
+        }
+        if (!table [h])
+            continue;
+
+        DWORD result = ERROR_SUCCESS;
+        if (RemoveSlot (instance, i, bKeepSignalsEnqueued)) {
+            ++nRemoved;
+        } else {
+            result = GetLastError ();
+            error = result;
+        }
+        if (dwErrors) {
+            dwErrors [table [h] - 1] = result;
+        }
+    }
+
+    UnlockExclusive (instance);
+
+    if (table != local) {
+        Free (instance, table);
+    }
+    if (nRemoved != nCount) {
+        SetLastError ((error != ERROR_SUCCESS) ? error : ERROR_FILE_NOT_FOUND);
+    }
+    return nRemoved;
+}
+
+ULONG WINAPI RemoveUnlimitedWaitObjectsIf (
+    _In_ UnlimitedWait * instance,
+    _In_ PUNLIMITED_WAIT_REMOVE_PREDICATE pfnPredicate,
+    _In_opt_ PVOID lpParameter,
+    _In_ BOOL bKeepSignalsEnqueued
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return 0;
+    }
+    if (!pfnPredicate) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return 0;
+    }
+
+    ULONG nRemoved = 0;
+    DWORD error = ERROR_SUCCESS;
+
+    LockExclusive (instance);
+
+    for (SIZE_T i = 0; i != instance->nSlots; ++i) {
+        if (instance->slots [i].hObject && pfnPredicate (lpParameter, instance->slots [i].lpContext, instance->slots [i].hObject)) {
+            if (RemoveSlot (instance, i, bKeepSignalsEnqueued)) {
+                ++nRemoved;
+            } else {
+                error = GetLastError ();
+            }
+        }
+    }
+
+    UnlockExclusive (instance);
+
+    SetLastError (error);
+    return nRemoved;
+}
+
+namespace {
+    BOOL IsFreeSlot (const UnlimitedWaitSlot * slot) {
+        return (slot->hObject == NULL) && !(slot->dwFlags & UNLIMITED_WAIT_SLOT_DRAINING);
+    }
+
+    // MoveSlot
+    //  - moves object, with its wait packet, from slot 'from' to free slot 'to' of 'destination' (which may be
+    //    the same instance), and swaps the free one back
+    //  - completion already queued for the object is removed and posted again with the new index (and instance),
+    //    the slot is marked REPOSTED until it's retrieved, as such completion cannot be recalled
+    //  - returns FALSE if the object cannot be moved, because its completion with the old index can't be recalled
+    //  - locks of both instances must be held (exclusive)
+    //
+    BOOL MoveSlot (UnlimitedWait * instance, SIZE_T from, UnlimitedWait * destination, SIZE_T to, BOOL * result) {
+        UnlimitedWaitSlot * source = &instance->slots [from];
+        UnlimitedWaitSlot * target = &destination->slots [to];
+        UnlimitedWaitSlot free = *target;
+
+        if (source->dwFlags & UNLIMITED_WAIT_SLOT_VIRTUAL) {
+            UnlimitedWaitVirtualObject * object = GetVirtualObject (source->hObject);
+
+            // setting QUEUED stops Set from posting while the index changes
+
+            if (InterlockedOr (&object->state, UNLIMITED_WAIT_VIRTUAL_QUEUED) & UNLIMITED_WAIT_VIRTUAL_QUEUED)
+                return FALSE;
+
+            *target = *source;
+            *source = free;
+            object->instance = destination;
+            object->index = to;
+
+            if (!ReArmVirtualObject (object)) {
+                *result = FALSE;
+            }
+            return TRUE;
+        }
+
+        NTSTATUS status = STATUS_SUCCESS;
+        if (!(source->dwFlags & UNLIMITED_WAIT_SLOT_DEFERRED)) {
+            status = NtCancelWaitCompletionPacket (source->hWaitPacket, TRUE);
+            if (!SUCCEEDED (status) && (status != STATUS_CANCELLED)) {
+                SetLastError (RtlNtStatusToDosError (status));
+                *result = FALSE;
+                return FALSE;
+            }
+        }
+
+        *target = *source;
+        *source = free;
+
+        if (!(target->dwFlags & UNLIMITED_WAIT_SLOT_DEFERRED)) {
+            if (status == STATUS_CANCELLED) {
+
+                // already signalled, the packet had the signal consumed, deliver it with the new index
+
+                if (PostQueuedCompletionStatus (destination->hIOCP, (DWORD) to, (ULONG_PTR) destination, (LPOVERLAPPED) target->lpContext)) {
+                    target->dwFlags |= UNLIMITED_WAIT_SLOT_REPOSTED;
+                } else {
+                    *result = FALSE;
+                }
+            } else {
+                if (!SetAssociation (destination, to, target->hObject, FALSE)) {
+                    *result = FALSE;
+                }
+            }
+        }
+        return TRUE;
+    }
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI CompactUnlimitedWait (
+    _In_ UnlimitedWait * instance,
+    _In_ DWORD nKeepFree
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    LockExclusive (instance);
+
+    // move objects from the end into the free slots at the beginning
+
+    BOOL result = TRUE;
+    SIZE_T hole = 0;
+    SIZE_T i = instance->nSlots;
+
+    while (i--) {
+        if (IsFreeSlot (&instance->slots [i])
+                || (instance->slots [i].dwFlags & (UNLIMITED_WAIT_SLOT_DRAINING | UNLIMITED_WAIT_SLOT_OFFLOADED
+                                                   | UNLIMITED_WAIT_SLOT_CARRIED | UNLIMITED_WAIT_SLOT_REPOSTED)))
+            continue;
+
+        while ((hole < i) && !IsFreeSlot (&instance->slots [hole])) {
+            ++hole;
+        }
+        if (hole >= i)
+            break;
+
+        if (MoveSlot (instance, i, instance, hole, &result)) {
+            ++hole;
+        }
+    }
+
+    // release packets of free slots beyond the last used one (and those to keep)
+
+    SIZE_T nUsed = instance->nSlots;
+    while (nUsed && IsFreeSlot (&instance->slots [nUsed - 1])) {
+        --nUsed;
+    }
+
+    SIZE_T nKeep = nUsed + nKeepFree;
+    if (nKeep > instance->nSlots) {
+        nKeep = instance->nSlots;
+    }
+    while (instance->nSlots > nKeep) {
+        ReleaseWaitCompletionPacket (instance->slots [--instance->nSlots].hWaitPacket);
+    }
+
+    // shrink the array
+
+    if ((instance->nCapacity > instance->nSlots) && !(instance->dwFlags & UNLIMITED_WAIT_CALLER_MEMORY)) {
+        if (instance->nSlots) {
+            if (auto newSlots = Reallocate (instance, instance->slots, instance->nCapacity * sizeof (UnlimitedWaitSlot),
+                                            instance->nSlots * sizeof (UnlimitedWaitSlot))) {
+                instance->slots = (UnlimitedWaitSlot *) newSlots;
+                instance->nCapacity = instance->nSlots;
+            }
+        } else {
+            Free (instance, instance->slots);
+            instance->slots = NULL;
+            instance->nCapacity = 0;
+        }
+    }
+
+    UnlockExclusive (instance);
+    return result;
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI MoveUnlimitedWaitObject (
+    _In_ UnlimitedWait * instance,
+    _In_ UnlimitedWait * destination,
+    _In_ HANDLE hObjectHandle
+) {
+    if (!instance || !destination) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    if (!hObjectHandle || (instance == destination)) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    // always in the same order, so that concurrent moves in opposite directions don't deadlock
+
+    UnlimitedWait * first = (instance < destination) ? instance : destination;
+    UnlimitedWait * second = (instance < destination) ? destination : instance;
+
+    LockExclusive (first);
+    LockExclusive (second);
+
+    BOOL result = FALSE;
+    DWORD error = ERROR_FILE_NOT_FOUND;
+
+    for (SIZE_T i = 0; i != instance->nSlots; ++i) {
+        if (instance->slots [i].hObject == hObjectHandle) {
+
+            // retrieved, and queued to worker or carried over, or posted by previous move and not retrieved yet,
+            // the signal is on its way with the old index
+
+            if (instance->slots [i].dwFlags & (UNLIMITED_WAIT_SLOT_OFFLOADED | UNLIMITED_WAIT_SLOT_CARRIED | UNLIMITED_WAIT_SLOT_REPOSTED)) {
+                error = ERROR_BUSY;
+                break;
+            }
+
+            // virtual object is freed by whichever instance it ends up in
+
+            if ((instance->slots [i].dwFlags & UNLIMITED_WAIT_SLOT_VIRTUAL) && !SameAllocator (instance, destination)) {
+                error = ERROR_NOT_SUPPORTED;
+                break;
+            }
+
+            SIZE_T to = FindFreeSlot (destination);
+            if (to == (SIZE_T) -1) {
+                error = GetLastError ();
+                break;
+            }
+
+            result = TRUE;
+            if (MoveSlot (instance, i, destination, to, &result)) {
+                error = GetLastError ();
+            } else {
+                if (result) {
+                    error = ERROR_BUSY;
+                    result = FALSE;
+                } else {
+                    error = GetLastError ();
+                }
+            }
+            break;
+        }
+    }
+
+    UnlockExclusive (second);
+    UnlockExclusive (first);
+
+    if (!result) {
+        SetLastError (error);
+    }
+    return result;
+}
+
+namespace {
+
+    // DrainSemaphore
+    //  - acquires the units available when called, returns their number
+    //  - there's no call acquiring more than one unit, so this is one count query plus one zero timeout wait per unit;
+    //    bounded by the queried count, a thread releasing continuously can't hold the callback here, units released
+    //    meanwhile are found by the re-association
+    //
+    LONG DrainSemaphore (HANDLE hSemaphore) {
+        SEMAPHORE_BASIC_INFORMATION semaphore;
+        if (!SUCCEEDED (NtQuerySemaphore (hSemaphore, 0, &semaphore, sizeof semaphore, NULL))) {
+            semaphore.CurrentCount = MAXLONG;
+        }
+
+        LONG n = 0;
+        while ((n != semaphore.CurrentCount) && (WaitForSingleObject (hSemaphore, 0) == WAIT_OBJECT_0)) {
+            ++n;
+        }
+        return n;
+    }
+
+    // HarvestExit
+    //  - fills exit record for terminated process or thread
+    //
+    void HarvestExit (HANDLE hObject, UNLIMITED_WAIT_EXIT_RECORD * record) {
+        record->bHarvested = TRUE;
+        record->dwExitCode = 0;
+
+        if (GetProcessTimes (hObject, &record->ftCreationTime, &record->ftExitTime, &record->ftKernelTime, &record->ftUserTime)) {
+            GetExitCodeProcess (hObject, &record->dwExitCode);
+            if (GetProcessIoCounters (hObject, &record->ioCounters))
+                return;
+
+        } else {
+            if (!GetThreadTimes (hObject, &record->ftCreationTime, &record->ftExitTime, &record->ftKernelTime, &record->ftUserTime)) {
+                record->bHarvested = FALSE;
+            }
+            GetExitCodeThread (hObject, &record->dwExitCode);
+        }
+        ZeroMemory (&record->ioCounters, sizeof record->ioCounters);
+    }
+
+    // InvokeCallback
+    //  - calls slot's callback of whichever type and translates the result to action
+    //  - for UnlimitedWaitActionReArmWith the callback has updated 'phObject' and 'lpObjectContext'
+    //
+    UNLIMITED_WAIT_ACTION InvokeCallback (UnlimitedWaitSlot * slot, HANDLE * phObject, PVOID * lpObjectContext) {
+        if (slot->dwFlags & UNLIMITED_WAIT_SLOT_DRAIN_SEMAPHORE) {
+
+            // the completed wait already acquired one unit, take the rest now, so that
+            // the whole release is single delivery and single re-association
+
+            LONG nDrained = 1 + DrainSemaphore (slot->hObject);
+            if (slot->callback.pfnSemaphore) {
+                if (!slot->callback.pfnSemaphore (slot->lpContext, slot->hObject, nDrained))
+                    return UnlimitedWaitActionRemove;
+            }
+            return UnlimitedWaitActionReArm;
+        }
+
+        // TODO: user may want to call add/remove inside the callback
+
+        if (slot->dwFlags & UNLIMITED_WAIT_SLOT_CALLBACK_EX) {
+            if (slot->callback.pfnObjectEx) {
+                UNLIMITED_WAIT_ACTION action = slot->callback.pfnObjectEx (lpObjectContext, phObject);
+                if ((action == UnlimitedWaitActionReArmWith) && (*phObject == NULL)) {
+                    return UnlimitedWaitActionRemove;
+                }
+                return action;
+            }
+        } else {
+            if (slot->callback.pfnObject) {
+                if (!slot->callback.pfnObject (slot->lpContext, slot->hObject))
+                    return UnlimitedWaitActionRemove;
+            }
+        }
+        return UnlimitedWaitActionReArm;
+    }
+
+    // PushWork
+    //  - enqueues slot index for workers, returns FALSE if the ring is full
+    //
+    BOOL PushWork (UnlimitedWaitWorkers * workers, SIZE_T index) {
+        LONGLONG position = ReadAcquire64 (&workers->tail);
+        UnlimitedWaitWorkItem * item;
+
+        while (true) {
+            item = &workers->ring [position & workers->mask];
+
+            LONGLONG difference = ReadAcquire64 (&item->sequence) - position;
+            if (difference == 0) {
+                LONGLONG previous = InterlockedCompareExchange64 (&workers->tail, position + 1, position);
+                if (previous == position)
+                    break;
+
+                position = previous;
+            } else
+            if (difference < 0) {
+                return FALSE;
+            } else {
+                position = ReadAcquire64 (&workers->tail);
+            }
+        }
+
+        item->index = index;
+        WriteRelease64 (&item->sequence, position + 1);
+
+        InterlockedIncrement (&workers->nPending);
+        WakeByAddressSingle ((PVOID) &workers->nPending);
+        return TRUE;
+    }
+
+    // PopWork
+    //  - dequeues slot index, returns FALSE if the ring is empty
+    //
+    BOOL PopWork (UnlimitedWaitWorkers * workers, SIZE_T * index) {
+        LONGLONG position = ReadAcquire64 (&workers->head);
+        UnlimitedWaitWorkItem * item;
+
+        while (true) {
+            item = &workers->ring [position & workers->mask];
+
+            LONGLONG difference = ReadAcquire64 (&item->sequence) - (position + 1);
+            if (difference == 0) {
+                LONGLONG previous = InterlockedCompareExchange64 (&workers->head, position + 1, position);
+                if (previous == position)
+                    break;
+
+                position = previous;
+            } else
+            if (difference < 0) {
+                return FALSE;
+            } else {
+                position = ReadAcquire64 (&workers->head);
+            }
+        }
+
+        *index = item->index;
+        WriteRelease64 (&item->sequence, position + workers->mask + 1);
+
+        InterlockedDecrement (&workers->nPending);
+        return TRUE;
+    }
+
+    void LockHitters (UnlimitedWait * instance) {
+        if (!IsSingleOwner (instance)) {
+            AcquireSRWLockExclusive (&instance->hitters->lock);
+        }
+    }
+    void UnlockHitters (UnlimitedWait * instance) {
+        if (!IsSingleOwner (instance)) {
+            ReleaseSRWLockExclusive (&instance->hitters->lock);
+        }
+    }
+
+    // RotateHitters
+    //  - starts new window when the current one is over, the current summary becomes the previous one
+    //  - tracker lock must be held
+    //
+    void RotateHitters (UnlimitedWaitHeavyHitters * hitters, LONGLONG now) {
+        LONGLONG elapsed = now - hitters->tEpoch;
+        if (elapsed >= hitters->tWindow) {
+            UnlimitedWaitHotSlot * previous = hitters->previous;
+
+            if (elapsed < 2 * hitters->tWindow) {
+                hitters->previous = hitters->current;
+                hitters->nPrevious = hitters->nCurrent;
+            } else {
+                hitters->nPrevious = 0;
+            }
+            hitters->current = previous;
+            hitters->nCurrent = 0;
+            hitters->tEpoch = now - elapsed % hitters->tWindow;
+        }
+    }
+
+    // CountHit
+    //  - space-saving update of the current summary with one signal of slot 'index'
+    //  - tracker lock must be held
+    //
+    void CountHit (UnlimitedWaitHeavyHitters * hitters, SIZE_T index) {
+        UnlimitedWaitHotSlot * current = hitters->current;
+        ULONG lowest = 0;
+
+        for (ULONG i = 0; i != hitters->nCurrent; ++i) {
+            if (current [i].index == index) {
+                current [i].nCount++;
+                return;
+            }
+            if (current [i].nCount < current [lowest].nCount) {
+                lowest = i;
+            }
+        }
+
+        if (hitters->nCurrent != hitters->nCapacity) {
+            current [hitters->nCurrent].index = index;
+            current [hitters->nCurrent].nCount = 1;
+            current [hitters->nCurrent].nError = 0;
+            hitters->nCurrent++;
+        } else {
+            current [lowest].index = index;
+            current [lowest].nError = current [lowest].nCount;
+            current [lowest].nCount++;
+        }
+    }
+
+    // TrackHits
+    //  - counts retrieved signals of the instance's objects, once per tracker lock
+    //  - entries carried over were counted when first retrieved, signals of removed objects are not counted
+    //  - lock must be held (shared)
+    //
+    void TrackHits (UnlimitedWait * instance, const OVERLAPPED_ENTRY * oResults, ULONG nCompletions) {
+        LockHitters (instance);
+        RotateHitters (instance->hitters, CounterNow ());
+
+        for (ULONG i = 0; i != nCompletions; ++i) {
+            if (oResults [i].lpCompletionKey == (ULONG_PTR) instance) {
+                SIZE_T index = oResults [i].dwNumberOfBytesTransferred;
+                if (!(instance->slots [index].dwFlags & (UNLIMITED_WAIT_SLOT_CARRIED | UNLIMITED_WAIT_SLOT_DRAINING))) {
+                    CountHit (instance->hitters, index);
+                }
+            }
+        }
+        UnlockHitters (instance);
+    }
+
+    // DispatchCompletions
+    //  - calls callbacks and re-arms slots for completions belonging to the instance, other entries are skipped
+    //  - up to 'nInlineBudget' objects found signalled again at re-arm are delivered right away as additional entries,
+    //    output arrays must have room for 'nCompletions' + 'nInlineBudget' entries
+    //  - with workers started, callbacks of kernel and virtual objects are queued to them instead, the entries
+    //    are reported right away, and the slot is re-armed by the worker once the callback returns
+    //  - 'bWorker' is TRUE when called by worker for entry it dequeued
+    //  - with batch callback set, and 'batch' arrays for 'nCompletions' items provided, plain kernel objects
+    //    without own callback are collected, passed to the batch callback at once, and then re-armed or removed
+    //  - with nonzero 'tStop' (CounterNow time), no further entries are dispatched after it passes, once at least
+    //    one was reported; 'nConsumed' receives number of entries dispatched (or skipped)
+    //  - with heavy hitter tracking enabled, the retrieved signals are counted first, inline deliveries as they happen
+    //  - lock must be held (shared)
+    //
+    BOOL DispatchCompletions (UnlimitedWait * instance, const OVERLAPPED_ENTRY * oResults, ULONG nCompletions,
+                              PVOID * lpSignalledObjectContexts, UNLIMITED_WAIT_EXIT_RECORD * lpExitRecords,
+                              ULONG * ulNumEntriesProcessed, ULONG nInlineBudget, BOOL bWorker,
+                              UnlimitedWaitBatch * batch, LONGLONG tStop, ULONG * nConsumed) {
+        BOOL result = TRUE;
+        ULONG n = 0;
+        ULONG nBatch = 0;
+
+        if (!instance->pfnBatchCallback) {
+            batch = NULL;
+        }
+        if (instance->hitters && !bWorker) {
+            TrackHits (instance, oResults, nCompletions);
+        }
+
+        for (ULONG i = 0; i != nCompletions; ++i) {
+            if (tStop && n && (CounterNow () >= tStop)) {
+                nCompletions = i;
+                break;
+            }
+            if (oResults [i].lpCompletionKey != (ULONG_PTR) instance)
+                continue;
+
+            SIZE_T index = oResults [i].dwNumberOfBytesTransferred;
+            UnlimitedWaitSlot * slot = &instance->slots [index];
+
+            // the re-arming thread doesn't touch the flags until the claim is settled
+
+            slot->dwFlags &= ~(UNLIMITED_WAIT_SLOT_CARRIED | UNLIMITED_WAIT_SLOT_REPOSTED);
+            if (HandOver (slot))
+                continue;
+
+            slot->bEnqueued = FALSE;
+
+            if (lpSignalledObjectContexts) {
+                lpSignalledObjectContexts [n] = (PVOID) oResults [i].lpOverlapped;
+            }
+            if (lpExitRecords) {
+                lpExitRecords [n].lpObjectContext = (PVOID) oResults [i].lpOverlapped;
+                lpExitRecords [n].hObject = slot->hObject;
+                lpExitRecords [n].bHarvested = FALSE;
+            }
+
+            if (batch && !slot->callback.pfnObject
+                    && !(slot->dwFlags & (UNLIMITED_WAIT_SLOT_DRAINING | UNLIMITED_WAIT_SLOT_VIRTUAL
+                                          | UNLIMITED_WAIT_SLOT_DRAIN_SEMAPHORE | UNLIMITED_WAIT_OBJECT_HARVEST_EXIT))) {
+
+                batch->lpObjectContexts [nBatch] = slot->lpContext;
+                batch->hObjects [nBatch] = slot->hObject;
+                batch->indices [nBatch] = index;
+                batch->bReArm [nBatch] = TRUE;
+                ++nBatch;
+                ++n;
+                continue;
+            }
+
+            // auto-reset virtual object is consumed by retrieval, exactly once
+
+            BOOL bConsumed = bWorker;
+
+            if (bWorker) {
+                slot->dwFlags &= ~UNLIMITED_WAIT_SLOT_OFFLOADED;
+            } else
+            if (instance->workers && !(slot->dwFlags & (UNLIMITED_WAIT_SLOT_DRAINING | UNLIMITED_WAIT_OBJECT_HARVEST_EXIT))) {
+                if (slot->dwFlags & UNLIMITED_WAIT_SLOT_VIRTUAL) {
+                    if (!(GetVirtualObject (slot->hObject)->dwFlags & UNLIMITED_WAIT_OBJECT_MANUAL_RESET)) {
+                        InterlockedAnd (&GetVirtualObject (slot->hObject)->state, ~UNLIMITED_WAIT_VIRTUAL_SIGNALLED);
+                    }
+                    bConsumed = TRUE;
+                }
+
+                // when the ring is full, this thread dispatches it itself
+
+                slot->dwFlags |= UNLIMITED_WAIT_SLOT_OFFLOADED;
+                if (PushWork (instance->workers, index)) {
+                    ++n;
+                    continue;
+                }
+                slot->dwFlags &= ~UNLIMITED_WAIT_SLOT_OFFLOADED;
+            }
+
+            if (slot->dwFlags & UNLIMITED_WAIT_SLOT_DRAINING) {
+
+                // remaining signal of removed object, only report it, the slot is free now
+
+                BOOL bDiscard = slot->dwFlags & UNLIMITED_WAIT_SLOT_DISCARD;
+                slot->dwFlags &= ~(UNLIMITED_WAIT_SLOT_DRAINING | UNLIMITED_WAIT_SLOT_DISCARD | UNLIMITED_WAIT_SLOT_VIRTUAL);
+                if (bDiscard)
+                    continue;
+
+            } else
+            if (slot->dwFlags & UNLIMITED_WAIT_SLOT_VIRTUAL) {
+                UnlimitedWaitVirtualObject * object = GetVirtualObject (slot->hObject);
+
+                // auto-reset objects are consumed by retrieval, QUEUED stays set until re-armed
+
+                if (!(object->dwFlags & UNLIMITED_WAIT_OBJECT_MANUAL_RESET) && !bConsumed) {
+                    InterlockedAnd (&object->state, ~UNLIMITED_WAIT_VIRTUAL_SIGNALLED);
+                }
+
+                BOOL bReRegister;
+                if (slot->callback.pfnObject) {
+                    bReRegister = slot->callback.pfnObject (slot->lpContext, slot->hObject);
+                } else {
+                    bReRegister = TRUE;
+                }
+
+                if (bReRegister) {
+                    if (!ReArmVirtualObject (object)) {
+                        result = FALSE;
+                    }
+                } else {
+                    slot->hObject = NULL;
+                    slot->dwFlags = 0;
+                    Free (instance, object);
+                }
+
+            } else
+            if (slot->dwFlags & UNLIMITED_WAIT_OBJECT_HARVEST_EXIT) {
+
+                // terminated process or thread, signalled forever, collect what's left of it and remove it
+
+                if (lpExitRecords) {
+                    HarvestExit (slot->hObject, &lpExitRecords [n]);
+                }
+                HANDLE hObject = slot->hObject;
+                PVOID lpContext = slot->lpContext;
+                InvokeCallback (slot, &hObject, &lpContext);
+
+                if (slot->dwFlags & UNLIMITED_WAIT_OBJECT_CLOSE_HANDLE) {
+                    CloseHandle (slot->hObject);
+                    if (lpExitRecords) {
+                        lpExitRecords [n].hObject = NULL;
+                    }
+                }
+                slot->hObject = NULL;
+                slot->dwFlags = 0;
+
+            } else {
+
+                // the action is applied in place, on the same slot and packet
+                //  - object the re-arming association finds signalled again is delivered right away, as next entry
+                //    of this batch, its completion is taken back from the port instead of being retrieved later
+
+                while (true) {
+                    HANDLE hObject = slot->hObject;
+                    PVOID lpContext = slot->lpContext;
+                    BOOL bInline = FALSE;
+
+                    switch (InvokeCallback (slot, &hObject, &lpContext)) {
+                        case UnlimitedWaitActionReArmWith:
+                            slot->lpContext = lpContext;
+                            // fallthrough
+                        case UnlimitedWaitActionReArm:
+                            if (!SetAssociation (instance, index, hObject, TRUE, (nInlineBudget != 0) ? &bInline : NULL)) {
+                                result = FALSE;
+                            }
+                            break;
+
+                        case UnlimitedWaitActionRemoveAndClose:
+                            CloseHandle (slot->hObject);
+                            slot->dwFlags = 0;
+                            // fallthrough
+                        case UnlimitedWaitActionRemove:
+                            slot->hObject = NULL;
+                            break;
+
+                        case UnlimitedWaitActionDefer:
+                            slot->dwFlags |= UNLIMITED_WAIT_SLOT_DEFERRED;
+                            break;
+                    }
+
+                    if (!bInline)
+                        break;
+
+                    --nInlineBudget;
+                    Count (instance, &instance->nInlineDeliveries);
+
+                    if (instance->hitters) {
+                        LockHitters (instance);
+                        CountHit (instance->hitters, index);
+                        UnlockHitters (instance);
+                    }
+
+                    ++n;
+                    if (lpSignalledObjectContexts) {
+                        lpSignalledObjectContexts [n] = slot->lpContext;
+                    }
+                    if (lpExitRecords) {
+                        lpExitRecords [n].lpObjectContext = slot->lpContext;
+                        lpExitRecords [n].hObject = slot->hObject;
+                        lpExitRecords [n].bHarvested = FALSE;
+                    }
+                }
+            }
+            ++n;
+        }
+
+        // single call for the whole batch, then re-arm the survivors in one pass
+
+        if (nBatch) {
+            instance->pfnBatchCallback (instance->lpWaitContext, nBatch, batch->lpObjectContexts, batch->hObjects, batch->bReArm);
+
+            for (ULONG i = 0; i != nBatch; ++i) {
+                if (batch->bReArm [i]) {
+                    if (!SetAssociation (instance, batch->indices [i], instance->slots [batch->indices [i]].hObject, TRUE)) {
+                        result = FALSE;
+                    }
+                } else {
+                    instance->slots [batch->indices [i]].hObject = NULL;
+                }
+            }
+        }
+
+        if (ulNumEntriesProcessed) {
+            *ulNumEntriesProcessed = n;
+        }
+        if (nConsumed) {
+            *nConsumed = nCompletions;
+        }
+        return result;
+    }
+}
+
+namespace {
+
+    // AcquireScratch
+    //  - takes one of instance's scratch buffers, large enough for 'ulCount' entries, or allocates new one
+    //  - in steady state (the same or smaller 'ulCount', up to UNLIMITED_WAIT_SCRATCH_BUFFERS concurrent waits)
+    //    this never touches the heap
+    //
+    UnlimitedWaitScratch * AcquireScratch (UnlimitedWait * instance, ULONG ulCount) {
+        for (auto & slot : instance->scratch) {
+            if (slot) {
+                UnlimitedWaitScratch * scratch;
+                if (IsSingleOwner (instance)) {
+                    scratch = slot;
+                    slot = NULL;
+                } else {
+                    scratch = (UnlimitedWaitScratch *) InterlockedExchangePointer ((PVOID volatile *) &slot, NULL);
+                }
+                if (scratch) {
+                    if (scratch->nEntries >= ulCount)
+                        return scratch;
+
+                    Free (instance, scratch);
+                    break;
+                }
+            }
+        }
+
+        auto scratch = (UnlimitedWaitScratch *) Allocate (instance, sizeof (UnlimitedWaitScratch) + (ulCount - 1) * sizeof (OVERLAPPED_ENTRY)
+                                                                  + ulCount * (sizeof (PVOID) + sizeof (HANDLE) + sizeof (SIZE_T) + sizeof (BOOL)));
+        if (scratch) {
+            scratch->nEntries = ulCount;
+        }
+        return scratch;
+    }
+
+    // GetBatch
+    //  - retrieves UnlimitedWaitBatch arrays that follow the scratch entries
+    //
+    void GetBatch (UnlimitedWaitScratch * scratch, UnlimitedWaitBatch * batch) {
+        batch->lpObjectContexts = (PVOID *) &scratch->entries [scratch->nEntries];
+        batch->hObjects = (HANDLE *) &batch->lpObjectContexts [scratch->nEntries];
+        batch->indices = (SIZE_T *) &batch->hObjects [scratch->nEntries];
+        batch->bReArm = (BOOL *) &batch->indices [scratch->nEntries];
+    }
+
+    // ReleaseScratch
+    //  - returns the scratch buffer to the first free slot of the instance, frees it if there is none
+    //
+    void ReleaseScratch (UnlimitedWait * instance, UnlimitedWaitScratch * scratch) {
+        for (auto & slot : instance->scratch) {
+            if (!slot) {
+                if (IsSingleOwner (instance)) {
+                    slot = scratch;
+                    return;
+                }
+                if (InterlockedCompareExchangePointer ((PVOID volatile *) &slot, scratch, NULL) == NULL)
+                    return;
+            }
+        }
+        Free (instance, scratch);
+    }
+}
+
+namespace {
+
+    // UnlimitedWaitDeadline
+    //  - the timeout is converted to a deadline once, on entry, so that internal retries don't extend it
+    //  - relative timeouts are measured on performance counter, unaffected by system time changes,
+    //    absolute ones are system time (UTC FILETIME), like in the kernel
+    //
+    struct UnlimitedWaitDeadline {
+        LONGLONG t; // in 100 ns units
+        BOOL     bInfinite;
+        BOOL     bAbsolute;
+    };
+
+    LONGLONG SystemTimeNow () {
+        FILETIME ft;
+        GetSystemTimePreciseAsFileTime (&ft);
+        return ((LONGLONG) ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    }
+
+    void SetDeadline (UnlimitedWaitDeadline * deadline, DWORD dwMilliseconds) {
+        deadline->bInfinite = (dwMilliseconds == INFINITE);
+        deadline->bAbsolute = FALSE;
+        deadline->t = deadline->bInfinite ? 0 : CounterNow () + dwMilliseconds * 10'000LL;
+    }
+
+    void SetDeadline (UnlimitedWaitDeadline * deadline, const LARGE_INTEGER * lpTimeout) {
+        deadline->bInfinite = (lpTimeout == NULL);
+        deadline->bAbsolute = !deadline->bInfinite && (lpTimeout->QuadPart > 0);
+
+        if (deadline->bInfinite) {
+            deadline->t = 0;
+        } else
+        if (deadline->bAbsolute) {
+            deadline->t = lpTimeout->QuadPart;
+        } else {
+            deadline->t = CounterNow () - lpTimeout->QuadPart;
+        }
+    }
+
+    // Remaining
+    //  - returns time left until the deadline in 100 ns units, zero or negative if already passed
+    //
+    LONGLONG Remaining (const UnlimitedWaitDeadline * deadline) {
+        if (deadline->bAbsolute) {
+            return deadline->t - SystemTimeNow ();
+        } else {
+            return deadline->t - CounterNow ();
+        }
+    }
+
+    NTSTATUS Remove (HANDLE hIOCP, OVERLAPPED_ENTRY * oResults, ULONG ulCount, ULONG * nCompletions, PLARGE_INTEGER timeout, BOOL bAlertable) {
+        *nCompletions = 0;
+        return NtRemoveIoCompletionEx (hIOCP, oResults, ulCount, nCompletions, timeout, (BOOLEAN) bAlertable);
+    }
+
+    // RemoveCompletions
+    //  - GetQueuedCompletionStatusEx with the remaining time until 'deadline'
+    //  - with 'bPrecise' (UNLIMITED_WAIT_CREATE_PRECISE_TIMEOUTS) the kernel wait ends one timer tick early
+    //    and the rest is polled, as kernel timeouts are rounded up to the timer resolution
+    //  - returns ERROR_SUCCESS or the same error codes as GetQueuedCompletionStatusEx
+    //
+    DWORD RemoveCompletions (HANDLE hIOCP, OVERLAPPED_ENTRY * oResults, ULONG ulCount, ULONG * nCompletions,
+                             const UnlimitedWaitDeadline * deadline, BOOL bPrecise, BOOL bAlertable) {
+        NTSTATUS status;
+
+        if (deadline->bInfinite) {
+            status = Remove (hIOCP, oResults, ulCount, nCompletions, NULL, bAlertable);
+        } else {
+            LARGE_INTEGER timeout;
+            LONGLONG remaining = Remaining (deadline);
+            LONGLONG tick = 0;
+
+            if (bPrecise && (remaining > 0)) {
+                ULONG maximum, minimum, current;
+                if (SUCCEEDED (NtQueryTimerResolution (&maximum, &minimum, &current))) {
+                    tick = current;
+                }
+            }
+
+            status = STATUS_TIMEOUT;
+            if (remaining > tick) {
+                if (deadline->bAbsolute) {
+                    timeout.QuadPart = deadline->t - tick;
+                } else {
+                    timeout.QuadPart = tick - remaining;
+                }
+                status = Remove (hIOCP, oResults, ulCount, nCompletions, &timeout, bAlertable);
+            }
+
+            if ((status == STATUS_TIMEOUT) && (bPrecise || (remaining <= 0))) {
+                timeout.QuadPart = 0;
+                do {
+                    status = Remove (hIOCP, oResults, ulCount, nCompletions, &timeout, bAlertable);
+                    if (status != STATUS_TIMEOUT)
+                        break;
+
+                    YieldProcessor ();
+                } while (Remaining (deadline) > 0);
+            }
+        }
+
+        switch (status) {
+            case STATUS_SUCCESS:
+                return ERROR_SUCCESS;
+            case STATUS_TIMEOUT:
+                return WAIT_TIMEOUT;
+            case STATUS_USER_APC:
+                return WAIT_IO_COMPLETION;
+            case STATUS_ABANDONED_WAIT_0:
+                return ERROR_ABANDONED_WAIT_0;
+            default:
+                return RtlNtStatusToDosError (status);
+        }
+    }
+
+    // SpinForCompletions
+    //  - polls the port, with exponential backoff between polls, for up to twice the recent average gap between
+    //    retrievals, so that the next signal is likely to arrive within it
+    //  - doesn't spin at all when signals come further apart than the configured maximum, or when none came
+    //    for longer than that, i.e. when idle; each miss also moves the average towards the maximum
+    //  - returns TRUE if completions were retrieved
+    //
+    BOOL SpinForCompletions (UnlimitedWait * instance, OVERLAPPED_ENTRY * oResults, ULONG ulCount, ULONG * nCompletions,
+                             const UnlimitedWaitDeadline * deadline) {
+        LONGLONG maximum = instance->spin.nMaximum;
+        if (!maximum)
+            return FALSE;
+
+        LONGLONG start = CounterNow ();
+        LONGLONG window = 2 * instance->spin.tAverageGap;
+        if ((window > maximum) || (start - instance->spin.tLastArrival > maximum))
+            return FALSE;
+
+        if (!deadline->bInfinite) {
+            LONGLONG remaining = Remaining (deadline);
+            if (window > remaining) {
+                window = remaining;
+            }
+            if (window <= 0)
+                return FALSE;
+        }
+
+        LARGE_INTEGER zero;
+        zero.QuadPart = 0;
+
+        ULONG backoff = 1;
+        do {
+            if (Remove (instance->hIOCP, oResults, ulCount, nCompletions, &zero, FALSE) == STATUS_SUCCESS) {
+                Count (instance, &instance->spin.nHits);
+                return TRUE;
+            }
+            for (ULONG i = 0; i != backoff; ++i) {
+                YieldProcessor ();
+            }
+            if (backoff < UNLIMITED_WAIT_SPIN_BACKOFF_LIMIT) {
+                backoff *= 2;
+            }
+        } while (CounterNow () - start < window);
+
+        LONGLONG average = instance->spin.tAverageGap;
+        instance->spin.tAverageGap = average + (maximum - average) / 8;
+
+        Count (instance, &instance->spin.nMisses);
+        return FALSE;
+    }
+
+    void LockCarry (UnlimitedWait * instance) {
+        if (!IsSingleOwner (instance)) {
+            AcquireSRWLockExclusive (&instance->batching.carryLock);
+        }
+    }
+    void UnlockCarry (UnlimitedWait * instance) {
+        if (!IsSingleOwner (instance)) {
+            ReleaseSRWLockExclusive (&instance->batching.carryLock);
+        }
+    }
+
+    // TakeCarried
+    //  - moves up to 'nMaximum' entries, carried over from previous waits, to 'oResults'
+    //
+    ULONG TakeCarried (UnlimitedWait * instance, OVERLAPPED_ENTRY * oResults, ULONG nMaximum) {
+        UnlimitedWaitBatching * batching = &instance->batching;
+        ULONG n = 0;
+
+        LockCarry (instance);
+        while ((n != nMaximum) && batching->nCarried) {
+            oResults [n++] = batching->carry [batching->head];
+            batching->head = (batching->head + 1) & (batching->nCapacity - 1);
+            batching->nCarried--;
+        }
+        UnlockCarry (instance);
+        return n;
+    }
+
+    // CarryOver
+    //  - stores entries for next wait, in front of those already carried if they were carried before too,
+    //    so that they are processed in the order retrieved
+    //  - if the ring cannot grow, the entries are posted back to the port instead, losing the order only
+    //  - lock must be held (shared)
+    //
+    void CarryOver (UnlimitedWait * instance, const OVERLAPPED_ENTRY * entries, ULONG n, BOOL bFront) {
+        UnlimitedWaitBatching * batching = &instance->batching;
+
+        for (ULONG i = 0; i != n; ++i) {
+            instance->slots [entries [i].dwNumberOfBytesTransferred].dwFlags |= UNLIMITED_WAIT_SLOT_CARRIED;
+        }
+        Count (instance, &batching->nCarriedOver, n);
+
+        LockCarry (instance);
+
+        if (batching->nCarried + n > batching->nCapacity) {
+            ULONG capacity = batching->nCapacity ? batching->nCapacity : UNLIMITED_WAIT_BATCH_INITIAL;
+            while (capacity < batching->nCarried + n) {
+                capacity *= 2;
+            }
+
+            if (auto carry = (OVERLAPPED_ENTRY *) Allocate (instance, capacity * sizeof (OVERLAPPED_ENTRY))) {
+                for (ULONG i = 0; i != batching->nCarried; ++i) {
+                    carry [i] = batching->carry [(batching->head + i) & (batching->nCapacity - 1)];
+                }
+                Free (instance, batching->carry);
+
+                batching->carry = carry;
+                batching->nCapacity = capacity;
+                batching->head = 0;
+            } else {
+                UnlockCarry (instance);
+
+                for (ULONG i = 0; i != n; ++i) {
+                    PostQueuedCompletionStatus (instance->hIOCP, entries [i].dwNumberOfBytesTransferred,
+                                                entries [i].lpCompletionKey, entries [i].lpOverlapped);
+                }
+                return;
+            }
+        }
+
+        ULONG mask = batching->nCapacity - 1;
+        if (bFront) {
+            batching->head = (batching->head - n) & mask;
+            for (ULONG i = 0; i != n; ++i) {
+                batching->carry [(batching->head + i) & mask] = entries [i];
+            }
+        } else {
+            for (ULONG i = 0; i != n; ++i) {
+                batching->carry [(batching->head + batching->nCarried + i) & mask] = entries [i];
+            }
+        }
+        batching->nCarried += n;
+
+        UnlockCarry (instance);
+    }
+
+    // FinishBatch
+    //  - carries entries left unprocessed by exhausted time budget over to the next wait, and adapts the batch size:
+    //    halves it when the budget ran out, doubles it when the retrieval filled it, i.e. the queue is deep
+    //
+    void FinishBatch (UnlimitedWait * instance, const OVERLAPPED_ENTRY * oResults, ULONG nCompletions, ULONG nConsumed, BOOL bCarried) {
+        LONG size = instance->batching.nSize;
+
+        if (nConsumed != nCompletions) {
+            CarryOver (instance, oResults + nConsumed, nCompletions - nConsumed, bCarried);
+            if (size > 1) {
+                instance->batching.nSize = size / 2;
+            }
+        } else
+        if (!bCarried && (nCompletions >= (ULONG) size) && (size < UNLIMITED_WAIT_BATCH_MAXIMUM)) {
+            instance->batching.nSize = size * 2;
+        }
+    }
+
+    // RetrieveCompletions
+    //  - RemoveCompletions, preceded by spinning when enabled, and feeding the spin window with the arrival times
+    //  - gaps are capped, so that the average recovers quickly when signals resume after idle period
+    //  - entries carried over from previous waits are returned first, setting 'bCarried',
+    //    and with time budget set, at most the adaptive batch size is retrieved
+    //
+    DWORD RetrieveCompletions (UnlimitedWait * instance, OVERLAPPED_ENTRY * oResults, ULONG ulCount, ULONG * nCompletions,
+                               const UnlimitedWaitDeadline * deadline, BOOL bAlertable, BOOL * bCarried) {
+        *bCarried = FALSE;
+
+        if (instance->batching.tBudget) {
+            ULONG size = (ULONG) instance->batching.nSize;
+            if (ulCount > size) {
+                ulCount = size;
+            }
+        }
+
+        // also after the budget was disabled, until the last carried entry is taken
+
+        if (instance->batching.nCarried) {
+            if ((*nCompletions = TakeCarried (instance, oResults, ulCount)) != 0) {
+                *bCarried = TRUE;
+                return ERROR_SUCCESS;
+            }
+        }
+
+        DWORD error = ERROR_SUCCESS;
+        if (!SpinForCompletions (instance, oResults, ulCount, nCompletions, deadline)) {
+            error = RemoveCompletions (instance->hIOCP, oResults, ulCount, nCompletions, deadline,
+                                       instance->dwFlags & UNLIMITED_WAIT_PRECISE, bAlertable);
+        }
+
+        if ((error == ERROR_SUCCESS) && instance->spin.nMaximum) {
+            LONGLONG now = CounterNow ();
+            LONGLONG gap = now - instance->spin.tLastArrival;
+            instance->spin.tLastArrival = now;
+            LONGLONG cap = 8 * instance->spin.nMaximum;
+            if (gap > cap) {
+                gap = cap;
+            }
+
+            LONGLONG average = instance->spin.tAverageGap;
+            instance->spin.tAverageGap = average + (gap - average) / 8;
+        }
+        return error;
+    }
+
+    // CountWaiter
+    //  - threads in the wait, only single one can be there with single owner
+    //
+    void CountWaiter (UnlimitedWait * instance, LONG delta) {
+        if (IsSingleOwner (instance)) {
+            instance->nWaiters += delta;
+        } else {
+            InterlockedExchangeAdd (&instance->nWaiters, delta);
+        }
+    }
+
+    // LeaveClosing
+    //  - leaves wait on instance being deleted, retrieved signals are dropped, DeleteUnlimitedWait cancels them anyway
+    //  - quit completions retrieved beyond the one for this thread are posted again for the others
+    //  - the caller's scratch buffer is returned to the instance while still locked, DeleteUnlimitedWait frees it
+    //
+    BOOL LeaveClosing (UnlimitedWait * instance, const OVERLAPPED_ENTRY * oResults, ULONG nCompletions, UnlimitedWaitScratch * scratch) {
+        BOOL bOwn = FALSE;
+        for (ULONG i = 0; i != nCompletions; ++i) {
+            if ((oResults [i].lpCompletionKey == (ULONG_PTR) instance) && (oResults [i].dwNumberOfBytesTransferred == UNLIMITED_WAIT_QUIT_INDEX)) {
+                if (bOwn) {
+                    PostQueuedCompletionStatus (instance->hIOCP, UNLIMITED_WAIT_QUIT_INDEX, (ULONG_PTR) instance, NULL);
+                } else {
+                    bOwn = TRUE;
+                }
+            }
+        }
+
+        if (scratch) {
+            ReleaseScratch (instance, scratch);
+        }
+        CountWaiter (instance, -1);
+        UnlockShared (instance);
+
+        SetLastError (ERROR_ABANDONED_WAIT_0);
+        return FALSE;
+    }
+}
+
+static
+BOOL WINAPI WaitUnlimitedWaitExImplementation (
+    _In_ UnlimitedWait * instance,
+    _Out_writes_to_opt_ (ulCount, *ulNumEntriesProcessed) PVOID * lpSignalledObjectContexts,
+    _Out_writes_to_opt_ (ulCount, *ulNumEntriesProcessed) UNLIMITED_WAIT_EXIT_RECORD * lpExitRecords,
+    _In_ ULONG ulCount,
+    _Out_opt_ ULONG * ulNumEntriesProcessed,
+    _Out_writes_all_ (ulCount) OVERLAPPED_ENTRY * oResults,
+    _In_ const UnlimitedWaitDeadline * deadline,
+    _In_ BOOL bAlertable,
+    _In_opt_ UnlimitedWaitBatch * batch,
+    _In_opt_ UnlimitedWaitScratch * scratch
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    if (instance->dwFlags & UNLIMITED_WAIT_FOREIGN_PORT) {
+        SetLastError (ERROR_INVALID_FUNCTION);
+        return FALSE;
+    }
+
+    LockShared (instance);
+
+    // counted for DeleteUnlimitedWait to post enough quit completions, see WakeWaiters
+
+    CountWaiter (instance, +1);
+    if (instance->bClosing) {
+        return LeaveClosing (instance, NULL, 0, scratch);
+    }
+
+    ULONG nCompletions;
+    BOOL bCarried;
+    DWORD error;
+    while ((error = RetrieveCompletions (instance, oResults, ulCount, &nCompletions, deadline, bAlertable, &bCarried)) == ERROR_SUCCESS) {
+        if (instance->bClosing) {
+            return LeaveClosing (instance, oResults, nCompletions, scratch);
+        }
+
+        // entries not filled by this retrieval leave room for inline deliveries
+
+        ULONG nInlineBudget = ulCount - nCompletions;
+        if (nInlineBudget > UNLIMITED_WAIT_INLINE_BUDGET) {
+            nInlineBudget = UNLIMITED_WAIT_INLINE_BUDGET;
+        }
+
+        // with time budget, entries not dispatched by then are left for the next wait
+
+        LONGLONG tStop = instance->batching.tBudget;
+        if (tStop) {
+            tStop += CounterNow ();
+        }
+
+        ULONG n;
+        ULONG nConsumed;
+        BOOL result = DispatchCompletions (instance, oResults, nCompletions, lpSignalledObjectContexts, lpExitRecords, &n, nInlineBudget, FALSE, batch,
+                                           tStop, &nConsumed);
+        if (tStop) {
+            FinishBatch (instance, oResults, nCompletions, nConsumed, bCarried);
+        }
+
+        // retrieved only discarded signals of removed virtual objects, wait again for the remaining time
+
+        if (n || !result) {
+            if (ulNumEntriesProcessed) {
+                *ulNumEntriesProcessed = n;
+            }
+            CountWaiter (instance, -1);
+            UnlockShared (instance);
+            return result;
+        }
+    }
+
+    if (ulNumEntriesProcessed) {
+        *ulNumEntriesProcessed = 0;
+    }
+    if (error != ERROR_ABANDONED_WAIT_0) {
+        CountWaiter (instance, -1);
+    }
+
+    switch (error) {
+        case WAIT_TIMEOUT:
+            if (instance->pfnTimeoutCallback) {
+                instance->pfnTimeoutCallback (instance->lpWaitContext);
+            }
+            break;
+        case WAIT_IO_COMPLETION:
+            if (instance->pfnApcWakeCallback) {
+                instance->pfnApcWakeCallback (instance->lpWaitContext);
+            }
+            break;
+
+        case ERROR_ABANDONED_WAIT_0:
+            // object deleted, srwLock is no longer valid, cannot unlock
+            SetLastError (error);
+            return FALSE;
+
+        default:
+            UnlockShared (instance);
+            SetLastError (error);
+            return FALSE;
+    }
+    UnlockShared (instance);
+    SetLastError (error);
+    return FALSE;
+}
+
+static
+BOOL WINAPI WaitUnlimitedWaitSingle (
+    _In_ UnlimitedWait * instance,
+    _Out_opt_ PVOID * lpSignalledObjectContext,
+    _In_ const UnlimitedWaitDeadline * deadline,
+    _In_ BOOL bAlertable
+) {
+    OVERLAPPED_ENTRY oResult = {};
+
+    // single retrieved entry needs single item batch
+
+    PVOID lpObjectContext;
+    HANDLE hObject;
+    SIZE_T index;
+    BOOL bReArm;
+    UnlimitedWaitBatch batch = { &lpObjectContext, &hObject, &index, &bReArm };
+
+    return WaitUnlimitedWaitExImplementation (instance, lpSignalledObjectContext, NULL, 1, NULL, &oResult, deadline, bAlertable, &batch, NULL);
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI WaitUnlimitedWait (
+    _In_ UnlimitedWait * instance,
+    _Out_opt_ PVOID * lpSignalledObjectContext,
+    _In_ DWORD dwMilliseconds,
+    _In_ BOOL bAlertable
+) {
+    UnlimitedWaitDeadline deadline;
+    SetDeadline (&deadline, dwMilliseconds);
+
+    return WaitUnlimitedWaitSingle (instance, lpSignalledObjectContext, &deadline, bAlertable);
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI WaitUnlimitedWait2 (
+    _In_ UnlimitedWait * instance,
+    _Out_opt_ PVOID * lpSignalledObjectContext,
+    _In_opt_ const LARGE_INTEGER * lpTimeout,
+    _In_ BOOL bAlertable
+) {
+    UnlimitedWaitDeadline deadline;
+    SetDeadline (&deadline, lpTimeout);
+
+    return WaitUnlimitedWaitSingle (instance, lpSignalledObjectContext, &deadline, bAlertable);
+}
+
+static
+BOOL WINAPI WaitUnlimitedWaitExBuffered (
+    _In_ UnlimitedWait * instance,
+    _Out_writes_to_opt_ (ulCount, *ulNumEntriesProcessed) PVOID * lpSignalledObjectContexts,
+    _Out_writes_to_opt_ (ulCount, *ulNumEntriesProcessed) UNLIMITED_WAIT_EXIT_RECORD * lpExitRecords,
+    _Out_writes_bytes_all_opt_ (32 * ulCount) PVOID lpTemporaryBuffer,
+    _In_ _In_range_ (1, ULONG_MAX) ULONG ulCount,
+    _Out_opt_ ULONG * ulNumEntriesProcessed,
+    _In_ const UnlimitedWaitDeadline * deadline,
+    _In_ BOOL bAlertable
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    // without batch callback application's buffer is all that's needed
+    //  - if the callback gets set right now, DispatchCompletions falls back to per-object dispatch
+
+    if (lpTemporaryBuffer && !instance->pfnBatchCallback) {
+        return WaitUnlimitedWaitExImplementation (instance, lpSignalledObjectContexts, lpExitRecords, ulCount, ulNumEntriesProcessed,
+                                                  (OVERLAPPED_ENTRY *) lpTemporaryBuffer, deadline, bAlertable, NULL, NULL);
+    }
+
+    UnlimitedWaitScratch * scratch = AcquireScratch (instance, ulCount);
+    if (!scratch) {
+        SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+        return FALSE;
+    }
+
+    UnlimitedWaitBatch batch;
+    GetBatch (scratch, &batch);
+
+    BOOL bResult = WaitUnlimitedWaitExImplementation (instance, lpSignalledObjectContexts, lpExitRecords, ulCount, ulNumEntriesProcessed,
+                                                      lpTemporaryBuffer ? (OVERLAPPED_ENTRY *) lpTemporaryBuffer : scratch->entries,
+                                                      deadline, bAlertable, &batch, scratch);
+
+    // when abandoned, the scratch was already returned, or the instance is gone
+
+    DWORD error = GetLastError ();
+    if (bResult || (error != ERROR_ABANDONED_WAIT_0)) {
+        ReleaseScratch (instance, scratch);
+        SetLastError (error);
+    }
+    return bResult;
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI WaitUnlimitedWaitEx (
+    _In_ UnlimitedWait * instance,
+    _Out_writes_to_opt_ (ulCount, *ulNumEntriesProcessed) PVOID * lpSignalledObjectContexts,
+    _Out_writes_bytes_all_opt_ (32 * ulCount) PVOID lpTemporaryBuffer,
+    _In_ _In_range_ (1, ULONG_MAX) ULONG ulCount,
+    _Out_opt_ ULONG * ulNumEntriesProcessed,
+    _In_ DWORD dwMilliseconds,
+    _In_ BOOL bAlertable
+) {
+    UnlimitedWaitDeadline deadline;
+    SetDeadline (&deadline, dwMilliseconds);
+
+    return WaitUnlimitedWaitExBuffered (instance, lpSignalledObjectContexts, NULL, lpTemporaryBuffer, ulCount, ulNumEntriesProcessed, &deadline, bAlertable);
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI WaitUnlimitedWaitEx2 (
+    _In_ UnlimitedWait * instance,
+    _Out_writes_to_opt_ (ulCount, *ulNumEntriesProcessed) PVOID * lpSignalledObjectContexts,
+    _Out_writes_bytes_all_opt_ (32 * ulCount) PVOID lpTemporaryBuffer,
+    _In_ _In_range_ (1, ULONG_MAX) ULONG ulCount,
+    _Out_opt_ ULONG * ulNumEntriesProcessed,
+    _In_opt_ const LARGE_INTEGER * lpTimeout,
+    _In_ BOOL bAlertable
+) {
+    UnlimitedWaitDeadline deadline;
+    SetDeadline (&deadline, lpTimeout);
+
+    return WaitUnlimitedWaitExBuffered (instance, lpSignalledObjectContexts, NULL, lpTemporaryBuffer, ulCount, ulNumEntriesProcessed, &deadline, bAlertable);
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI WaitUnlimitedWaitForExits (
+    _In_ UnlimitedWait * instance,
+    _Out_writes_to_ (ulCount, *ulNumEntriesProcessed) UNLIMITED_WAIT_EXIT_RECORD * lpExitRecords,
+    _Out_writes_bytes_all_opt_ (32 * ulCount) PVOID lpTemporaryBuffer,
+    _In_ _In_range_ (1, ULONG_MAX) ULONG ulCount,
+    _Out_opt_ ULONG * ulNumEntriesProcessed,
+    _In_ DWORD dwMilliseconds,
+    _In_ BOOL bAlertable
+) {
+    if (!lpExitRecords) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+    UnlimitedWaitDeadline deadline;
+    SetDeadline (&deadline, dwMilliseconds);
+
+    return WaitUnlimitedWaitExBuffered (instance, NULL, lpExitRecords, lpTemporaryBuffer, ulCount, ulNumEntriesProcessed, &deadline, bAlertable);
+}
+
+_Success_ (return != NULL)
+HANDLE WINAPI GetUnlimitedWaitReadinessHandle (
+    _In_ UnlimitedWait * instance
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return NULL;
+    }
+    if (instance->dwFlags & UNLIMITED_WAIT_FOREIGN_PORT) {
+        SetLastError (ERROR_NOT_SUPPORTED);
+        return NULL;
+    }
+    return instance->hIOCP;
+}
+
+namespace {
+
+    // ReturnCarried
+    //  - posts entries carried over by the time budget back to the port, where readiness handle sees them
+    //
+    void ReturnCarried (UnlimitedWait * instance) {
+        OVERLAPPED_ENTRY entries [UNLIMITED_WAIT_CHILD_BATCH];
+        ULONG n;
+
+        LockShared (instance);
+        while ((n = TakeCarried (instance, entries, UNLIMITED_WAIT_CHILD_BATCH)) != 0) {
+            for (ULONG i = 0; i != n; ++i) {
+                PostQueuedCompletionStatus (instance->hIOCP, entries [i].dwNumberOfBytesTransferred,
+                                            entries [i].lpCompletionKey, entries [i].lpOverlapped);
+            }
+        }
+        UnlockShared (instance);
+    }
+
+    // DrainChild
+    //  - callback of child UnlimitedWait added by AddUnlimitedWaitChild, retrieves and dispatches one batch
+    //    of child's signals without blocking, the child stays in parent
+    //
+    BOOL WINAPI DrainChild (PVOID lpObjectContext, HANDLE) {
+        UnlimitedWait * child = (UnlimitedWait *) lpObjectContext;
+
+        UnlimitedWaitDeadline deadline;
+        SetDeadline (&deadline, (DWORD) 0);
+
+        DWORD error = GetLastError ();
+        WaitUnlimitedWaitExBuffered (child, NULL, NULL, NULL, UNLIMITED_WAIT_CHILD_BATCH, NULL, &deadline, FALSE);
+
+        if (child->batching.nCarried) {
+            ReturnCarried (child);
+        }
+        SetLastError (error);
+        return TRUE;
+    }
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI AddUnlimitedWaitChild (
+    _In_ UnlimitedWait * instance,
+    _In_ UnlimitedWait * child
+) {
+    if (!instance || !child) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    if (instance == child) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    HANDLE hReadiness = GetUnlimitedWaitReadinessHandle (child);
+    if (!hReadiness)
+        return FALSE;
+
+    return AddUnlimitedWaitObjectImplementation (instance, hReadiness, UnlimitedWaitCallback { DrainChild }, child, 0);
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI DispatchUnlimitedWaitCompletions (
+    _In_ UnlimitedWait * instance,
+    _In_reads_ (ulCount) const OVERLAPPED_ENTRY * lpCompletionPortEntries,
+    _In_ ULONG ulCount,
+    _Out_writes_to_opt_ (ulCount, *ulNumEntriesProcessed) PVOID * lpSignalledObjectContexts,
+    _Out_opt_ ULONG * ulNumEntriesProcessed
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    if (!lpCompletionPortEntries && ulCount) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    UnlimitedWaitScratch * scratch = NULL;
+    UnlimitedWaitBatch batch;
+
+    if (instance->pfnBatchCallback && ulCount) {
+        scratch = AcquireScratch (instance, ulCount);
+        if (!scratch) {
+            SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+            return FALSE;
+        }
+        GetBatch (scratch, &batch);
+    }
+
+    LockShared (instance);
+    BOOL result = DispatchCompletions (instance, lpCompletionPortEntries, ulCount, lpSignalledObjectContexts, NULL, ulNumEntriesProcessed,
+                                       0, FALSE, scratch ? &batch : NULL, 0, NULL);
+    UnlockShared (instance);
+
+    if (scratch) {
+        DWORD error = GetLastError ();
+        ReleaseScratch (instance, scratch);
+        SetLastError (error);
+    }
+    return result;
+}
 
-    if (instance) {
-        instance->hIOCP = CreateIoCompletionPort (INVALID_HANDLE_VALUE, NULL, 0, 0);
-        if (instance->hIOCP) {
-            instance->srwLock = SRWLOCK_INIT;
-            instance->lpWaitContext = lpWaitContext;
-            instance->pfnTimeoutCallback = pfnTimeoutCallback;
-            instance->pfnApcWakeCallback = pfnApcWakeCallback;
+_Success_ (return != FALSE)
+BOOL WINAPI SetUnlimitedWaitBatchCallback (
+    _In_ UnlimitedWait * instance,
+    _In_opt_ PUNLIMITED_WAIT_BATCH_CALLBACK ptrBatchCallbackFunction
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
 
-            instance->slots = (UnlimitedWaitSlot *) HeapAlloc (hHeap, 0, nPreAllocatedSlots ? nPreAllocatedSlots * sizeof (UnlimitedWaitSlot) : 1);
-            if (instance->slots) {
+    LockExclusive (instance);
+    instance->pfnBatchCallback = ptrBatchCallbackFunction;
+    UnlockExclusive (instance);
+    return TRUE;
+}
 
-                if (nPreAllocatedSlots == 0) {
-                    return instance;
-                }
+namespace {
 
-                NTSTATUS status = 0;
-                DWORD nCreatedPackets = 0;
-                while (SUCCEEDED (status = NtCreateWaitCompletionPacket (&instance->slots [nCreatedPackets].hWaitPacket, GENERIC_ALL, NULL))) {
-                    instance->slots [nCreatedPackets].hObject = NULL;
+    // UnlimitedWaitWorker
+    //  - worker thread, dispatches retrieved signals handed over by waiting threads
+    //  - exits when stopped and the ring is empty
+    //
+    DWORD WINAPI UnlimitedWaitWorker (LPVOID parameter) {
+        UnlimitedWaitWorkers * workers = (UnlimitedWaitWorkers *) parameter;
+        UnlimitedWait * instance = workers->instance;
 
-                    if (++nCreatedPackets == nPreAllocatedSlots) {
-                        return instance;
-                    }
-                }
+        OVERLAPPED_ENTRY entries [UNLIMITED_WAIT_WORKER_BATCH];
+        ULONG n = 0;
 
-                while (nCreatedPackets--) {
-                    CloseHandle (instance->slots [nCreatedPackets].hWaitPacket);
-                }
-                HeapFree (hHeap, 0, instance->slots);
-                SetLastError (RtlNtStatusToDosError (status));
+        while (true) {
+            SIZE_T index;
+            while ((n != UNLIMITED_WAIT_WORKER_BATCH) && PopWork (workers, &index)) {
+                entries [n].lpCompletionKey = (ULONG_PTR) instance;
+                entries [n].lpOverlapped = NULL;
+                entries [n].Internal = 0;
+                entries [n].dwNumberOfBytesTransferred = (DWORD) index;
+                ++n;
             }
 
-            CloseHandle (instance->hIOCP);
+            // no inline deliveries here, every signal must be reported by waiting thread
+
+            if (n) {
+                LockShared (instance);
+                DispatchCompletions (instance, entries, n, NULL, NULL, NULL, 0, TRUE, NULL, 0, NULL);
+                UnlockShared (instance);
+                n = 0;
+            } else {
+                if (workers->bStop)
+                    break;
+
+                LONG nEmpty = 0;
+                WaitOnAddress (&workers->nPending, &nEmpty, sizeof nEmpty, INFINITE);
+            }
         }
-        HeapFree (hHeap, 0, instance);
+        return 0;
     }
-    return NULL;
 }
 
 _Success_ (return != FALSE)
-BOOL WINAPI DeleteUnlimitedWait (
-    _In_ UnlimitedWait * instance
+BOOL WINAPI StartUnlimitedWaitWorkers (
+    _In_ UnlimitedWait * instance,
+    _In_ DWORD nWorkers,
+    _In_ DWORD nQueueDepth
 ) {
     if (!instance) {
         SetLastError (ERROR_INVALID_HANDLE);
         return FALSE;
     }
+    if (!nWorkers || (nQueueDepth > 0x40000000)) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+    if (IsSingleOwner (instance)) {
+        SetLastError (ERROR_NOT_SUPPORTED);
+        return FALSE;
+    }
 
-    BOOL result = TRUE;
-    HANDLE hHeap = GetProcessHeap ();
+    LONGLONG nItems = 16;
+    while (nItems < nQueueDepth) {
+        nItems *= 2;
+    }
 
-    AcquireSRWLockExclusive (&instance->srwLock);
+    auto workers = (UnlimitedWaitWorkers *) Allocate (instance, sizeof (UnlimitedWaitWorkers) + (SIZE_T) (nItems - 1) * sizeof (UnlimitedWaitWorkItem));
+    if (!workers) {
+        SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+        return FALSE;
+    }
 
-    if (instance->slots) {
-        SIZE_T nSlots = HeapSize (hHeap, 0, instance->slots) / sizeof (UnlimitedWaitSlot);
-        while (nSlots--) {
-            CloseHandle (instance->slots [nSlots].hWaitPacket);
+    workers->instance = instance;
+    workers->nThreads = 0;
+    workers->bStop = FALSE;
+    workers->nPending = 0;
+    workers->head = 0;
+    workers->tail = 0;
+    workers->mask = nItems - 1;
 
-            if (instance->slots [nSlots].dwFlags & UNLIMITED_WAIT_OBJECT_CLOSE_HANDLE) {
-                CloseHandle (instance->slots [nSlots].hObject);
-            }
+    for (LONGLONG i = 0; i != nItems; ++i) {
+        workers->ring [i].sequence = i;
+    }
+
+    workers->hThreads = (HANDLE *) Allocate (instance, nWorkers * sizeof (HANDLE));
+    if (workers->hThreads) {
+        while (workers->nThreads != nWorkers) {
+            HANDLE hThread = CreateThread (NULL, 0, UnlimitedWaitWorker, workers, 0, NULL);
+            if (!hThread)
+                break;
+
+            workers->hThreads [workers->nThreads++] = hThread;
         }
+    } else {
+        SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+    }
 
-        if (!HeapFree (hHeap, 0, instance->slots)) {
-            result = FALSE;
+    if (workers->nThreads == nWorkers) {
+        LockExclusive (instance);
+        if (!instance->workers) {
+            instance->workers = workers;
+            workers = NULL;
         }
+        UnlockExclusive (instance);
+
+        if (!workers)
+            return TRUE;
+
+        SetLastError (ERROR_ALREADY_INITIALIZED);
     }
 
-    ReleaseSRWLockExclusive (&instance->srwLock);
+    // failed, nothing could have been queued to these workers yet
 
-    if (!CloseHandle (instance->hIOCP)) {
-        result = FALSE;
+    DWORD error = GetLastError ();
+
+    StopWorkers (workers);
+
+    for (DWORD i = 0; i != workers->nThreads; ++i) {
+        WaitForSingleObject (workers->hThreads [i], INFINITE);
+        CloseHandle (workers->hThreads [i]);
     }
-    if (!HeapFree (hHeap, 0, instance)) {
-        result = FALSE;
+    if (workers->hThreads) {
+        Free (instance, workers->hThreads);
     }
-    return result;
+    Free (instance, workers);
+
+    SetLastError (error);
+    return FALSE;
 }
 
-namespace {
-    BOOL SetAssociation (UnlimitedWait * instance, SIZE_T i, HANDLE hObjectHandle, PVOID ptrCallbackFunction, PVOID lpObjectContext) {
-        
-        HRESULT status = NtAssociateWaitCompletionPacket (instance->slots [i].hWaitPacket, instance->hIOCP, hObjectHandle,
-                                                          ptrCallbackFunction, lpObjectContext, 0, i, NULL);
-        if (SUCCEEDED (status)) {
-            instance->slots [i].hObject = hObjectHandle;
-            return TRUE;
+_Success_ (return != FALSE)
+BOOL WINAPI StopUnlimitedWaitWorkers (
+    _In_ UnlimitedWait * instance
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    if (!DetachWorkers (instance)) {
+        SetLastError (ERROR_FILE_NOT_FOUND);
+        return FALSE;
+    }
+    return TRUE;
+}
 
-        } else {
-            if (status == STATUS_INVALID_PARAMETER_3) {
-                SetLastError (ERROR_INVALID_HANDLE);
-            } else {
-                RtlNtStatusToDosError (status);
-            }
-            return FALSE;
-        }
+_Success_ (return != FALSE)
+BOOL WINAPI SetUnlimitedWaitOwner (
+    _In_ UnlimitedWait * instance
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
     }
+    if (!IsSingleOwner (instance)) {
+        SetLastError (ERROR_INVALID_FUNCTION);
+        return FALSE;
+    }
+
+    instance->dwOwnerThreadId = GetCurrentThreadId ();
+    return TRUE;
 }
 
 _Success_ (return != FALSE)
-BOOL WINAPI AddUnlimitedWaitObject (
+BOOL WINAPI SetUnlimitedWaitBatchPolicy (
     _In_ UnlimitedWait * instance,
-    _In_ HANDLE hObjectHandle,
-    _In_opt_ PUNLIMITED_WAIT_OBJECT_CALLBACK ptrCallbackFunction,
-    _In_opt_ PVOID lpObjectContext,
-    _In_     DWORD dwFlags
+    _In_ DWORD dwTimeBudgetMicroseconds
 ) {
     if (!instance) {
         SetLastError (ERROR_INVALID_HANDLE);
         return FALSE;
     }
-    if (!hObjectHandle) {
-        SetLastError (ERROR_INVALID_PARAMETER);
+
+    LockExclusive (instance);
+    instance->batching.tBudget = dwTimeBudgetMicroseconds * 10LL;
+    UnlockExclusive (instance);
+    return TRUE;
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI SetUnlimitedWaitSpin (
+    _In_ UnlimitedWait * instance,
+    _In_ DWORD dwMaximumSpinMicroseconds
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
         return FALSE;
     }
 
-    AcquireSRWLockExclusive (&instance->srwLock);
+    // starts with the average at quarter of the maximum, i.e. spinning for half of it, until real gaps
+    //  are observed; seeding it higher would disable spinning before the first measurement, as the window
+    //  (twice the average) would exceed the maximum, and the misses only move the average further up
+    //  - on single processor the spinning thread would only keep the signalling one from running
 
-    HANDLE hHeap = GetProcessHeap ();
-    SIZE_T nSlots = HeapSize (hHeap, 0, instance->slots) / sizeof (UnlimitedWaitSlot);
+    LONGLONG maximum = dwMaximumSpinMicroseconds * 10LL;
+    if (GetActiveProcessorCount (ALL_PROCESSOR_GROUPS) < 2) {
+        maximum = 0;
+    }
 
-    for (SIZE_T i = 0; i != nSlots; ++i) {
-        if ((instance->slots [i].hWaitPacket != NULL) && (instance->slots [i].hObject == NULL)) {
-            BOOL result = SetAssociation (instance, i, hObjectHandle, (PVOID) ptrCallbackFunction, (PVOID) lpObjectContext);
+    LockExclusive (instance);
+    instance->spin.tAverageGap = maximum / 4;
+    instance->spin.tLastArrival = CounterNow ();
+    instance->spin.nMaximum = maximum;
+    UnlockExclusive (instance);
+    return TRUE;
+}
 
-            ReleaseSRWLockExclusive (&instance->srwLock);
-            return result;
+_Success_ (return != FALSE)
+BOOL WINAPI SetUnlimitedWaitHeavyHitterTracking (
+    _In_ UnlimitedWait * instance,
+    _In_ ULONG nTrackedSlots,
+    _In_ DWORD dwWindowMilliseconds
+) {
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    if ((nTrackedSlots > UNLIMITED_WAIT_HEAVY_HITTERS_MAXIMUM) || (nTrackedSlots && !dwWindowMilliseconds)) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    UnlimitedWaitHeavyHitters * hitters = NULL;
+    if (nTrackedSlots) {
+        hitters = (UnlimitedWaitHeavyHitters *) Allocate (instance, sizeof (UnlimitedWaitHeavyHitters)
+                                                                    + 2 * nTrackedSlots * sizeof (UnlimitedWaitHotSlot));
+        if (!hitters) {
+            SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+            return FALSE;
         }
+        hitters->lock = SRWLOCK_INIT;
+        hitters->nCapacity = nTrackedSlots;
+        hitters->nCurrent = 0;
+        hitters->nPrevious = 0;
+        hitters->tWindow = dwWindowMilliseconds * 10'000LL;
+        hitters->tEpoch = CounterNow ();
+        hitters->current = (UnlimitedWaitHotSlot *) (hitters + 1);
+        hitters->previous = hitters->current + nTrackedSlots;
     }
 
-    if (auto newSlots = HeapReAlloc (hHeap, 0, instance->slots, (nSlots + 1) * sizeof (UnlimitedWaitSlot))) {
-        instance->slots = (UnlimitedWaitSlot *) newSlots;
-        instance->slots [nSlots].hWaitPacket = NULL;
-        instance->slots [nSlots].hObject = NULL;
-        instance->slots [nSlots].dwFlags = dwFlags;
+    LockExclusive (instance);
+    UnlimitedWaitHeavyHitters * previous = instance->hitters;
+    instance->hitters = hitters;
+    UnlockExclusive (instance);
 
-        HRESULT hr = NtCreateWaitCompletionPacket (&instance->slots [nSlots].hWaitPacket, GENERIC_ALL, NULL);
-        if (SUCCEEDED (hr)) {
+    Free (instance, previous);
+    return TRUE;
+}
 
-            if (SetAssociation (instance, nSlots, hObjectHandle, (PVOID) ptrCallbackFunction, (PVOID) lpObjectContext)) {
-                ReleaseSRWLockExclusive (&instance->srwLock);
-                return TRUE;
-            }
+namespace {
 
-            NtCancelWaitCompletionPacket (instance->slots [nSlots].hWaitPacket, TRUE);
+    // PreviousHits
+    //  - finds slot 'index' in the previous window summary, NULL if it wasn't there
+    //
+    const UnlimitedWaitHotSlot * PreviousHits (const UnlimitedWaitHeavyHitters * hitters, SIZE_T index) {
+        for (ULONG i = 0; i != hitters->nPrevious; ++i) {
+            if (hitters->previous [i].index == index)
+                return &hitters->previous [i];
+        }
+        return NULL;
+    }
 
+    // InsertHitter
+    //  - inserts the slot into 'lpHitters' kept sorted by descending 'nSignals', dropping the last one when full
+    //
+    void InsertHitter (UNLIMITED_WAIT_HEAVY_HITTER * lpHitters, ULONG nCount, ULONG * n, const UNLIMITED_WAIT_HEAVY_HITTER & hitter) {
+        ULONG i = *n;
+        if (i == nCount) {
+            if (!i || (lpHitters [i - 1].nSignals >= hitter.nSignals))
+                return;
+            --i;
         } else {
-            if (auto revertedSlots = HeapReAlloc (hHeap, 0, instance->slots, nSlots ? nSlots * sizeof (UnlimitedWaitSlot) : 1)) {
-                instance->slots = (UnlimitedWaitSlot *) revertedSlots;
-            }
+            ++*n;
+        }
+        while (i && (lpHitters [i - 1].nSignals < hitter.nSignals)) {
+            lpHitters [i] = lpHitters [i - 1];
+            --i;
         }
+        lpHitters [i] = hitter;
     }
-
-    ReleaseSRWLockExclusive (&instance->srwLock);
-    return FALSE;
 }
 
 _Success_ (return != FALSE)
-BOOL WINAPI RemoveUnlimitedWaitObject (
+BOOL WINAPI QueryUnlimitedWaitHeavyHitters (
     _In_ UnlimitedWait * instance,
-    _In_ HANDLE hObjectHandle,
-    _In_ BOOL bKeepSignalsEnqueued
+    _Out_writes_to_ (nCount, *nReturned) UNLIMITED_WAIT_HEAVY_HITTER * lpHitters,
+    _In_ ULONG nCount,
+    _Out_ ULONG * nReturned
 ) {
     if (!instance) {
         SetLastError (ERROR_INVALID_HANDLE);
         return FALSE;
     }
-    if (!hObjectHandle) {
+    if (!nReturned || (nCount && !lpHitters)) {
         SetLastError (ERROR_INVALID_PARAMETER);
         return FALSE;
     }
 
-    AcquireSRWLockExclusive (&instance->srwLock);
+    LockShared (instance);
 
-    SIZE_T nSlots = HeapSize (GetProcessHeap (), 0, instance->slots) / sizeof (UnlimitedWaitSlot);
-    for (SIZE_T i = 0; i != nSlots; ++i) {
+    UnlimitedWaitHeavyHitters * hitters = instance->hitters;
+    if (!hitters) {
+        UnlockShared (instance);
+        SetLastError (ERROR_INVALID_FUNCTION);
+        return FALSE;
+    }
 
-        if (instance->slots [i].hObject == hObjectHandle) {
-            HRESULT status = NtCancelWaitCompletionPacket (instance->slots [i].hWaitPacket, !bKeepSignalsEnqueued);
-            BOOL result = SUCCEEDED (status);
+    LockHitters (instance);
 
-            if (result) {
-                instance->slots [i].hObject = NULL;
-            }
+    LONGLONG now = CounterNow ();
+    RotateHitters (hitters, now);
 
-            ReleaseSRWLockExclusive (&instance->srwLock);
+    // sliding window: the previous window is weighted by how much of it still overlaps the last 'tWindow'
 
-            if (!result) {
-                SetLastError (RtlNtStatusToDosError (status));
+    LONGLONG tOverlap = hitters->tWindow - (now - hitters->tEpoch);
+    ULONG n = 0;
+
+    for (ULONG pass = 0; pass != 2; ++pass) {
+        const UnlimitedWaitHotSlot * summary = pass ? hitters->previous : hitters->current;
+        ULONG nSummary = pass ? hitters->nPrevious : hitters->nCurrent;
+
+        for (ULONG i = 0; i != nSummary; ++i) {
+            SIZE_T index = summary [i].index;
+            if ((index >= instance->nSlots) || !instance->slots [index].hObject)
+                continue;
+
+            UNLIMITED_WAIT_HEAVY_HITTER hitter;
+            hitter.nSignals = 0;
+            hitter.nError = 0;
+
+            const UnlimitedWaitHotSlot * previous;
+            if (pass == 0) {
+                hitter.nSignals = summary [i].nCount;
+                hitter.nError = summary [i].nError;
+                previous = PreviousHits (hitters, index);
+            } else {
+
+                // already reported with the current window
+
+                BOOL bCurrent = FALSE;
+                for (ULONG j = 0; j != hitters->nCurrent; ++j) {
+                    if (hitters->current [j].index == index) {
+                        bCurrent = TRUE;
+                        break;
+                    }
+                }
+                if (bCurrent)
+                    continue;
+
+                previous = &summary [i];
             }
-            return result;
+            if (previous) {
+                hitter.nSignals += previous->nCount * tOverlap / hitters->tWindow;
+                hitter.nError += previous->nError * tOverlap / hitters->tWindow;
+            }
+
+            hitter.lpObjectContext = instance->slots [index].lpContext;
+            hitter.hObject = instance->slots [index].hObject;
+            hitter.nSignalsPerSecond = hitter.nSignals * 10'000'000LL / hitters->tWindow;
+
+            InsertHitter (lpHitters, nCount, &n, hitter);
         }
     }
 
-    ReleaseSRWLockExclusive (&instance->srwLock);
-    SetLastError (ERROR_FILE_NOT_FOUND);
-    return FALSE;
+    UnlockHitters (instance);
+    UnlockShared (instance);
+
+    *nReturned = n;
+    return TRUE;
 }
 
-static
-BOOL WINAPI WaitUnlimitedWaitExImplementation (
-    _In_ UnlimitedWait * instance,
-    _Out_writes_to_opt_ (ulCount, *ulNumEntriesProcessed) PVOID * lpSignalledObjectContexts,
-    _In_ ULONG ulCount,
-    _Out_opt_ ULONG * ulNumEntriesProcessed,
-    _Out_writes_all_ (ulCount) OVERLAPPED_ENTRY * oResults,
-    _In_ DWORD dwMilliseconds,
-    _In_ BOOL bAlertable
+_Success_ (return != FALSE)
+BOOL WINAPI GetUnlimitedWaitStatistics (
+    _In_  UnlimitedWait * instance,
+    _Out_ UNLIMITED_WAIT_STATISTICS * lpStatistics
 ) {
     if (!instance) {
         SetLastError (ERROR_INVALID_HANDLE);
         return FALSE;
     }
+    if (!lpStatistics) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
 
-    AcquireSRWLockShared (&instance->srwLock);
+    LockShared (instance);
 
-    DWORD nCompletions;
-    if (GetQueuedCompletionStatusEx (instance->hIOCP, oResults, ulCount, &nCompletions, dwMilliseconds, bAlertable)) {
-        
-        if (ulNumEntriesProcessed) {
-            *ulNumEntriesProcessed = nCompletions;
+    lpStatistics->nSlots = instance->nSlots;
+    lpStatistics->nCapacity = instance->nCapacity;
+    lpStatistics->nObjects = 0;
+    for (SIZE_T i = 0; i != instance->nSlots; ++i) {
+        if (instance->slots [i].hObject) {
+            ++lpStatistics->nObjects;
         }
+    }
+    lpStatistics->nHeapOperations = (ULONGLONG) instance->nHeapOperations;
+    lpStatistics->nInlineDeliveries = (ULONGLONG) instance->nInlineDeliveries;
+    lpStatistics->nSpinHits = (ULONGLONG) instance->spin.nHits;
+    lpStatistics->nSpinMisses = (ULONGLONG) instance->spin.nMisses;
+    lpStatistics->nCarriedOver = (ULONGLONG) instance->batching.nCarriedOver;
+    lpStatistics->nBatchSize = (ULONG) instance->batching.nSize;
 
-        BOOL result = TRUE;
-        for (ULONG i = 0; i != nCompletions; ++i) {
-
-            BOOL bReRegister;
-            if (oResults [i].lpCompletionKey) {
+    UnlockShared (instance);
+    return TRUE;
+}
 
-                // TODO: user may want to call add/remove inside the callback
+namespace {
 
-                bReRegister = ((PUNLIMITED_WAIT_OBJECT_CALLBACK) oResults [i].lpCompletionKey) (oResults [i].lpOverlapped,
-                                                                                                instance->slots [oResults [i].dwNumberOfBytesTransferred].hObject);
-            } else {
-                bReRegister = TRUE;
-            }
+    // QueryObjectState
+    //  - queries signalled state of kernel object without changing it, unlike zero timeout wait does
+    //    for auto-reset events and semaphores; the type is tried in order given by the slot flags
+    //  - 'bConsumable' receives whether satisfied wait takes the signal away, i.e. whether armed object
+    //    that reads as not signalled might have its signal already queued in the port
+    //  - returns FALSE for types without such query (mutexes, timers, ...), these are reported unknown
+    //
+    BOOL QueryObjectState (const UnlimitedWaitSlot * slot, BOOL * bSignalled, BOOL * bConsumable) {
+        *bConsumable = FALSE;
 
-            if (bReRegister) {
-                if (!SetAssociation (instance, oResults [i].dwNumberOfBytesTransferred,
-                                     instance->slots [oResults [i].dwNumberOfBytesTransferred].hObject,
-                                     (PVOID) oResults [i].lpCompletionKey, (PVOID) oResults [i].lpOverlapped)) {
+        if (slot->callback.pfnObject == DrainChild) {
+            IO_COMPLETION_BASIC_INFORMATION port;
+            if (!SUCCEEDED (NtQueryIoCompletion (slot->hObject, 0, &port, sizeof port, NULL)))
+                return FALSE;
 
-                    result = FALSE;
-                }
-            } else {
-                instance->slots [oResults [i].dwNumberOfBytesTransferred].hObject = NULL;
-            }
+            *bSignalled = (port.Depth != 0);
+            return TRUE;
+        }
+        if (!(slot->dwFlags & (UNLIMITED_WAIT_SLOT_DRAIN_SEMAPHORE | UNLIMITED_WAIT_OBJECT_HARVEST_EXIT))) {
+            EVENT_BASIC_INFORMATION event;
+            NTSTATUS status = NtQueryEvent (slot->hObject, 0, &event, sizeof event, NULL);
+            if (status != STATUS_OBJECT_TYPE_MISMATCH) {
+                if (!SUCCEEDED (status))
+                    return FALSE;
 
-            if (lpSignalledObjectContexts) {
-                lpSignalledObjectContexts [i] = (PVOID) oResults [i].lpOverlapped;
+                *bSignalled = (event.EventState != 0);
+                *bConsumable = (event.EventType != 0); // SynchronizationEvent
+                return TRUE;
             }
         }
+        if (!(slot->dwFlags & UNLIMITED_WAIT_OBJECT_HARVEST_EXIT)) {
+            SEMAPHORE_BASIC_INFORMATION semaphore;
+            NTSTATUS status = NtQuerySemaphore (slot->hObject, 0, &semaphore, sizeof semaphore, NULL);
+            if (status != STATUS_OBJECT_TYPE_MISMATCH) {
+                if (!SUCCEEDED (status))
+                    return FALSE;
 
-        ReleaseSRWLockShared (&instance->srwLock);
-        return result;
-
-    } else {
-        if (ulNumEntriesProcessed) {
-            *ulNumEntriesProcessed = 0;
+                *bSignalled = (semaphore.CurrentCount != 0);
+                *bConsumable = TRUE;
+                return TRUE;
+            }
         }
 
-        DWORD error = GetLastError ();
-        switch (error) {
-            case WAIT_TIMEOUT:
-                if (instance->pfnTimeoutCallback) {
-                    instance->pfnTimeoutCallback (instance->lpWaitContext);
-                }
-                break;
-            case WAIT_IO_COMPLETION:
-                if (instance->pfnApcWakeCallback) {
-                    instance->pfnApcWakeCallback (instance->lpWaitContext);
-                }
-                break;
+        // processes and threads are signalled once they have exit time
 
-            case ERROR_ABANDONED_WAIT_0:
-                // object deleted, srwLock is no longer valid, cannot unlock
-                return FALSE;
+        FILETIME ftCreationTime, ftExitTime, ftKernelTime, ftUserTime;
+        if (GetProcessTimes (slot->hObject, &ftCreationTime, &ftExitTime, &ftKernelTime, &ftUserTime)
+                || GetThreadTimes (slot->hObject, &ftCreationTime, &ftExitTime, &ftKernelTime, &ftUserTime)) {
 
-            default:
-                ReleaseSRWLockShared (&instance->srwLock);
-                return FALSE;
+            *bSignalled = (ftExitTime.dwLowDateTime | ftExitTime.dwHighDateTime) != 0;
+            return TRUE;
         }
-        ReleaseSRWLockShared (&instance->srwLock);
-        SetLastError (error);
         return FALSE;
     }
-}
 
-_Success_ (return != FALSE)
-BOOL WINAPI WaitUnlimitedWait (
-    _In_ UnlimitedWait * instance,
-    _Out_opt_ PVOID * lpSignalledObjectContext,
-    _In_ DWORD dwMilliseconds,
-    _In_ BOOL bAlertable
-) {
-    OVERLAPPED_ENTRY oResult = {};
-    return WaitUnlimitedWaitExImplementation (instance, lpSignalledObjectContext, 1, NULL, &oResult, dwMilliseconds, bAlertable);
+    // GetPortBacklog
+    //  - number of completions waiting in the instance's port, or -1 if it can't be determined
+    //
+    LONG GetPortBacklog (UnlimitedWait * instance) {
+        IO_COMPLETION_BASIC_INFORMATION port;
+        if (SUCCEEDED (NtQueryIoCompletion (instance->hIOCP, 0, &port, sizeof port, NULL)))
+            return port.Depth;
+        else
+            return -1;
+    }
 }
 
 _Success_ (return != FALSE)
-BOOL WINAPI WaitUnlimitedWaitEx (
+BOOL WINAPI QueryUnlimitedWaitReadiness (
     _In_ UnlimitedWait * instance,
-    _Out_writes_to_opt_ (ulCount, *ulNumEntriesProcessed) PVOID * lpSignalledObjectContexts,
-    _Out_writes_bytes_all_opt_ (32 * ulCount) PVOID lpTemporaryBuffer,
-    _In_ _In_range_ (1, ULONG_MAX) ULONG ulCount,
-    _Out_opt_ ULONG * ulNumEntriesProcessed,
-    _In_ DWORD dwMilliseconds,
-    _In_ BOOL bAlertable
+    _Out_writes_opt_ ((nBits + 31) / 32) ULONG * lpBitmap,
+    _Out_writes_opt_ ((nBits + 31) / 32) ULONG * lpUnknownBitmap,
+    _In_ SIZE_T nBits,
+    _Out_ SIZE_T * nSlots,
+    _Out_writes_opt_ (nBits) PVOID * lpObjectContexts,
+    _Out_opt_ SIZE_T * nSignalled
 ) {
-    HANDLE hHeap = NULL;
-    OVERLAPPED_ENTRY * oResults;
-    
-    if (lpTemporaryBuffer) {
-        oResults = (OVERLAPPED_ENTRY *) lpTemporaryBuffer;
-    } else {
-        hHeap = GetProcessHeap ();
-        oResults = (OVERLAPPED_ENTRY *) HeapAlloc (hHeap, 0, ulCount * sizeof (OVERLAPPED_ENTRY));
-        if (!oResults) {
-            return FALSE;
+    if (!instance) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    if (!nSlots || (nBits && !lpBitmap)) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    LockShared (instance);
+
+    *nSlots = instance->nSlots;
+    if (nBits < instance->nSlots) {
+        UnlockShared (instance);
+        SetLastError (ERROR_INSUFFICIENT_BUFFER);
+        return FALSE;
+    }
+
+    SIZE_T n = 0;
+    for (SIZE_T i = 0; i != (instance->nSlots + 31) / 32; ++i) {
+        lpBitmap [i] = 0;
+        if (lpUnknownBitmap) {
+            lpUnknownBitmap [i] = 0;
+        }
+    }
+
+    // queried only once some armed object needs it, the port is then asked just once for all of them
+
+    LONG nBacklog = 0;
+    BOOL bBacklogKnown = FALSE;
+
+    for (SIZE_T i = 0; i != instance->nSlots; ++i) {
+        const UnlimitedWaitSlot * slot = &instance->slots [i];
+
+        if (lpObjectContexts) {
+            lpObjectContexts [i] = slot->hObject ? slot->lpContext : NULL;
+        }
+        if (!slot->hObject)
+            continue;
+
+        // retrieved and not yet delivered, re-posted, found signalled when armed, or virtual,
+        // the state is known without asking the kernel
+
+        BOOL bSignalled = FALSE;
+        BOOL bUnknown = FALSE;
+
+        if (slot->dwFlags & (UNLIMITED_WAIT_SLOT_OFFLOADED | UNLIMITED_WAIT_SLOT_CARRIED | UNLIMITED_WAIT_SLOT_REPOSTED)) {
+            bSignalled = TRUE;
+        } else
+        if (slot->dwFlags & UNLIMITED_WAIT_SLOT_VIRTUAL) {
+            bSignalled = GetVirtualObject (slot->hObject)->state & UNLIMITED_WAIT_VIRTUAL_SIGNALLED;
+        } else
+        if (slot->dwFlags & UNLIMITED_WAIT_SLOT_DEFERRED) {
+
+            // not armed, the object holds its own signal
+
+            BOOL bConsumable;
+            bUnknown = !QueryObjectState (slot, &bSignalled, &bConsumable);
+        } else
+        if (slot->bEnqueued) {
+            bSignalled = TRUE;
+        } else {
+
+            // armed: signal of the object is either still in it, or already consumed into the port,
+            // with empty port the object is not signalled and the kernel doesn't need to be asked at all
+
+            if (!bBacklogKnown) {
+                nBacklog = GetPortBacklog (instance);
+                bBacklogKnown = TRUE;
+            }
+            if (nBacklog != 0) {
+                BOOL bConsumable;
+                if (QueryObjectState (slot, &bSignalled, &bConsumable)) {
+                    bUnknown = !bSignalled && bConsumable;
+                } else {
+                    bUnknown = TRUE;
+                }
+            }
+        }
+
+        if (bSignalled) {
+            lpBitmap [i / 32] |= 1uL << (i % 32);
+            ++n;
+        }
+        if (bUnknown && lpUnknownBitmap) {
+            lpUnknownBitmap [i / 32] |= 1uL << (i % 32);
         }
     }
 
-    BOOL bResult = WaitUnlimitedWaitExImplementation (instance, lpSignalledObjectContexts, ulCount, ulNumEntriesProcessed, oResults, dwMilliseconds, bAlertable);
+    UnlockShared (instance);
 
-    if (!lpTemporaryBuffer) {
-        HeapFree (hHeap, 0, oResults);
+    if (nSignalled) {
+        *nSignalled = n;
     }
-    return bResult;
+    return TRUE;
 }
@@ -5,6 +5,34 @@
 
 typedef VOID (WINAPI * PUNLIMITED_WAIT_CALLBACK) (PVOID lpWaitContext);
 typedef BOOL (WINAPI * PUNLIMITED_WAIT_OBJECT_CALLBACK) (PVOID lpObjectContext, HANDLE hObject);
+typedef BOOL (WINAPI * PUNLIMITED_WAIT_SEMAPHORE_CALLBACK) (PVOID lpObjectContext, HANDLE hObject, LONG nDrained);
+
+// UNLIMITED_WAIT_ACTION
+//  - returned by PUNLIMITED_WAIT_OBJECT_CALLBACK_EX, applied in place, on the same slot and wait packet
+//
+typedef enum _UNLIMITED_WAIT_ACTION {
+    UnlimitedWaitActionReArm = 0,       // keep waiting on the object (same as returning TRUE from simple callback)
+    UnlimitedWaitActionRemove,          // stop waiting on the object (same as returning FALSE)
+    UnlimitedWaitActionRemoveAndClose,  // stop waiting on the object and close its handle
+    UnlimitedWaitActionReArmWith,       // start waiting on new handle and/or with new context, as set by the callback,
+                                        // the previous handle is NOT closed
+    UnlimitedWaitActionDefer,           // keep the object, but don't wait until ReArmUnlimitedWaitObject is called
+} UNLIMITED_WAIT_ACTION;
+
+typedef UNLIMITED_WAIT_ACTION (WINAPI * PUNLIMITED_WAIT_OBJECT_CALLBACK_EX) (PVOID * lpObjectContext, HANDLE * phObject);
+
+// PUNLIMITED_WAIT_BATCH_CALLBACK
+//  - called once per retrieved batch with all objects of the batch that have no callback of their own
+//  - 'bReArm' items are all TRUE on entry, set to FALSE to remove corresponding object, the handle is not closed
+//
+typedef VOID (WINAPI * PUNLIMITED_WAIT_BATCH_CALLBACK) (PVOID lpWaitContext, ULONG nCount,
+                                                        PVOID * lpObjectContexts, HANDLE * hObjects, BOOL * bReArm);
+
+// PUNLIMITED_WAIT_REMOVE_PREDICATE
+//  - called by RemoveUnlimitedWaitObjectsIf for each object, returns TRUE to remove it
+//  - called with the UnlimitedWait locked, must not call any of the functions below on the same object
+//
+typedef BOOL (WINAPI * PUNLIMITED_WAIT_REMOVE_PREDICATE) (PVOID lpParameter, PVOID lpObjectContext, HANDLE hObject);
 
 struct UnlimitedWait;
 
@@ -27,9 +55,134 @@ UnlimitedWait * WINAPI CreateUnlimitedWait (
     _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnApcWakeCallback
 );
 
+// CreateUnlimitedWaitEx
+//  - same as CreateUnlimitedWait, with creation flags:
+//     - UNLIMITED_WAIT_CREATE_SINGLE_THREADED - the object will be used by a single thread only, the creating one,
+//                                              all locking and interlocked operations are left out
+//                                            - virtual objects can still be set from any thread
+//                                            - workers cannot be started on such object
+//                                            - debug builds assert the owner thread, see SetUnlimitedWaitOwner
+//     - UNLIMITED_WAIT_CREATE_PRECISE_TIMEOUTS - timed waits end at the deadline instead of up to a timer tick late,
+//                                               the last tick is polled, i.e. the waiting thread spins for up to
+//                                               the timer resolution before each timeout, see WaitUnlimitedWait2
+//
+#define UNLIMITED_WAIT_CREATE_SINGLE_THREADED  0x00000001
+#define UNLIMITED_WAIT_CREATE_PRECISE_TIMEOUTS 0x00000002
+
+_Success_ (return != NULL)
+UnlimitedWait * WINAPI CreateUnlimitedWaitEx (
+    _In_opt_ PVOID lpWaitContext,
+    _In_     DWORD nPreAllocatedSlots,
+    _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnTimeoutCallback,
+    _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnApcWakeCallback,
+    _In_     DWORD dwFlags
+);
+
+// SetUnlimitedWaitOwner
+//  - hands object created with UNLIMITED_WAIT_CREATE_SINGLE_THREADED over to the calling thread
+//  - the previous owner must no longer use it, the hand over itself must be synchronized by the application
+//  - returns FALSE with ERROR_INVALID_FUNCTION for objects not created as single-threaded
+//
+_Success_ (return != FALSE)
+BOOL WINAPI SetUnlimitedWaitOwner (
+    _In_ UnlimitedWait * hUnlimitedWait
+);
+
+// CreateUnlimitedWaitOnPort
+//  - creates new 'UnlimitedWait' object that posts signals into existing, application-owned, I/O completion port
+//  - parameters:
+//     - hExistingIOCP - I/O completion port the application already uses, e.g. for socket or file I/O
+//                     - the port is NOT closed by DeleteUnlimitedWait
+//     - lpWaitContext - user-defined value
+//     - nPreAllocatedSlots - number of slots for object handles to prepare in advance
+//  - the application retrieves completions itself (GetQueuedCompletionStatus(Ex)) and passes those with
+//    'lpCompletionKey' equal to the returned UnlimitedWait pointer to 'DispatchUnlimitedWaitCompletions'
+//     - the application must not use that value as completion key for its own I/O
+//  - WaitUnlimitedWait(Ex) fails with ERROR_INVALID_FUNCTION on such object
+//  - returns:
+//     - 'handle' to the UnlimitedWait object to be used in the remaining functions
+//     - NULL on error - call 'GetLastError()' to get the underlying reason which can also be HRESULT
+//
+_Success_ (return != NULL)
+UnlimitedWait * WINAPI CreateUnlimitedWaitOnPort (
+    _In_     HANDLE hExistingIOCP,
+    _In_opt_ PVOID lpWaitContext,
+    _In_     DWORD nPreAllocatedSlots
+);
+
+// UNLIMITED_WAIT_ALLOCATOR
+//  - where the UnlimitedWait takes its memory from, see CreateUnlimitedWaitEx2 and InitializeUnlimitedWait
+//  - hHeap - heap to allocate from, e.g. private HeapCreate heap of NUMA node's threads; NULL for process heap
+//          - ignored when 'pfnAllocate' is set
+//  - pfnAllocate/pfnFree - allocator callbacks, e.g. arena, both must be set, or both NULL
+//                        - called with 'lpAllocatorContext', concurrently unless single-threaded
+//  - pfnReallocate - optional, when NULL resizing allocates new block, copies and frees the old one
+//
+typedef PVOID (WINAPI * PUNLIMITED_WAIT_ALLOCATE) (PVOID lpAllocatorContext, SIZE_T cbSize);
+typedef PVOID (WINAPI * PUNLIMITED_WAIT_REALLOCATE) (PVOID lpAllocatorContext, PVOID lpMemory, SIZE_T cbSize);
+typedef BOOL (WINAPI * PUNLIMITED_WAIT_FREE) (PVOID lpAllocatorContext, PVOID lpMemory);
+
+typedef struct _UNLIMITED_WAIT_ALLOCATOR {
+    HANDLE                     hHeap;
+    PUNLIMITED_WAIT_ALLOCATE   pfnAllocate;
+    PUNLIMITED_WAIT_REALLOCATE pfnReallocate;
+    PUNLIMITED_WAIT_FREE       pfnFree;
+    PVOID                      lpAllocatorContext;
+} UNLIMITED_WAIT_ALLOCATOR;
+
+// CreateUnlimitedWaitEx2
+//  - same as CreateUnlimitedWaitEx, but the object itself, its slot array, buffers and virtual objects
+//    are all allocated by 'lpAllocator' instead of the process heap
+//  - lpAllocator - NULL for the process heap, the structure is copied
+//
+_Success_ (return != NULL)
+UnlimitedWait * WINAPI CreateUnlimitedWaitEx2 (
+    _In_opt_ PVOID lpWaitContext,
+    _In_     DWORD nPreAllocatedSlots,
+    _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnTimeoutCallback,
+    _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnApcWakeCallback,
+    _In_     DWORD dwFlags,
+    _In_opt_ const UNLIMITED_WAIT_ALLOCATOR * lpAllocator
+);
+
+// GetUnlimitedWaitMemorySize
+//  - returns number of bytes InitializeUnlimitedWait needs for object with 'nSlots' slots
+//
+SIZE_T WINAPI GetUnlimitedWaitMemorySize (
+    _In_ DWORD nSlots
+);
+
+// InitializeUnlimitedWait
+//  - same as CreateUnlimitedWaitEx2, but constructs the object in caller-provided memory, with fixed slot array
+//  - parameters:
+//     - lpMemory - MEMORY_ALLOCATION_ALIGNMENT aligned memory of 'cbMemory' bytes, at least GetUnlimitedWaitMemorySize ('nSlots')
+//                - must stay valid until DeleteUnlimitedWait returns, it's not freed by it
+//     - nSlots - fixed capacity, at most this many objects can be added, further additions fail
+//                with ERROR_NOT_ENOUGH_MEMORY; CompactUnlimitedWait doesn't shrink the array
+//     - lpAllocator - used for everything else: virtual objects, wait buffers, opt-in features; may be NULL
+//  - the returned pointer is 'lpMemory', the object is used and deleted as usual
+//  - there's no allocation after this call, except for adding virtual objects, opt-in features (workers, batch
+//    policy, heavy hitter tracking), and waits without 'lpTemporaryBuffer' growing the scratch buffer (once)
+//  - returns NULL on error, ERROR_INSUFFICIENT_BUFFER when 'cbMemory' is too small
+//
+_Success_ (return != NULL)
+UnlimitedWait * WINAPI InitializeUnlimitedWait (
+    _Out_writes_bytes_ (cbMemory) PVOID lpMemory,
+    _In_     SIZE_T cbMemory,
+    _In_opt_ PVOID lpWaitContext,
+    _In_     DWORD nSlots,
+    _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnTimeoutCallback,
+    _In_opt_ PUNLIMITED_WAIT_CALLBACK pfnApcWakeCallback,
+    _In_     DWORD dwFlags,
+    _In_opt_ const UNLIMITED_WAIT_ALLOCATOR * lpAllocator
+);
+
 // DeleteUnlimitedWait
 //  - destroys the object and releases all resources
 //  - there is no need to remove individual waited-on object handles
+//  - threads waiting in WaitUnlimitedWait(Ex) on the object are woken and fail with ERROR_ABANDONED_WAIT_0,
+//    the function returns after they've left; no new waits or other calls may be started meanwhile
+//  - wait packets and handles of large objects are released and closed in parallel, by thread pool
 //  - returns: TRUE - on successful cleanup
 //             FALSE - when any subcomponent failed to cleanup and memory/handles could've leaked
 //                   - note that object that failed to be fully deleted can no longer be used
@@ -40,8 +193,12 @@ BOOL WINAPI DeleteUnlimitedWait (
 );
 
 // UNLIMITED_WAIT flags
+//  - bits 16 to 31 are reserved for ShardedUnlimitedWait
 
 #define UNLIMITED_WAIT_OBJECT_CLOSE_HANDLE  0x00000001
+#define UNLIMITED_WAIT_OBJECT_MANUAL_RESET  0x00000002 // virtual objects only
+#define UNLIMITED_WAIT_OBJECT_INITIAL_STATE 0x00000004 // virtual objects only
+#define UNLIMITED_WAIT_OBJECT_HARVEST_EXIT  0x00000008 // process and thread objects only
 
 // AddUnlimitedWaitObject
 //  - adds object handle to 'UnlimitedWait' and starts consuming signalled state changes
@@ -54,6 +211,11 @@ BOOL WINAPI DeleteUnlimitedWait (
 //     - 'dwFlags' - additional behavior options, can be one or more of:
 //                 - UNLIMITED_WAIT_OBJECT_CLOSE_HANDLE - calls CloseHandle on 'hObjectHandle'
 //                                                        in DeleteUnlimitedWait
+//                 - UNLIMITED_WAIT_OBJECT_HARVEST_EXIT - for process or thread handle, the object is removed when
+//                                                        it terminates and its exit information is collected,
+//                                                        see WaitUnlimitedWaitForExits; return value of the callback
+//                                                        is ignored; with UNLIMITED_WAIT_OBJECT_CLOSE_HANDLE the
+//                                                        handle is closed right after that
 //  - returns: TRUE - on success
 //             FALSE - on failure, call GetLastError () to get more information:
 //                   - allocation errors provide ERROR_NOT_ENOUGH_MEMORY
@@ -68,10 +230,141 @@ BOOL WINAPI AddUnlimitedWaitObject (
     _In_     DWORD           dwFlags
 );
 
+// AddUnlimitedWaitObjectEx
+//  - same as AddUnlimitedWaitObject, but with extended callback
+//  - the callback receives pointers to object's context and handle, and returns UNLIMITED_WAIT_ACTION,
+//    for UnlimitedWaitActionReArmWith it updates them to the new handle and context to wait on
+//     - e.g. restarted process or thread can be waited on without removing and re-adding the object
+//
+_Success_ (return != FALSE)
+BOOL WINAPI AddUnlimitedWaitObjectEx (
+    _In_     UnlimitedWait * hUnlimitedWait,
+    _In_     HANDLE          hObjectHandle,
+    _In_opt_ PUNLIMITED_WAIT_OBJECT_CALLBACK_EX ptrCallbackFunction,
+    _In_opt_ PVOID           lpObjectContext,
+    _In_     DWORD           dwFlags
+);
+
+// ReArmUnlimitedWaitObject
+//  - resumes waiting on object, for which the extended callback returned UnlimitedWaitActionDefer
+//  - returns: TRUE - on success
+//             FALSE - on failure, call GetLastError () to get more information:
+//                   - ERROR_FILE_NOT_FOUND - the 'hObjectHandle' is not deferred object of this UnlimitedWait
+//
+_Success_ (return != FALSE)
+BOOL WINAPI ReArmUnlimitedWaitObject (
+    _In_ UnlimitedWait * hUnlimitedWait,
+    _In_ HANDLE          hObjectHandle
+);
+
+// AddUnlimitedWaitSemaphore
+//  - adds semaphore handle to 'UnlimitedWait', every delivery drains all units available at that moment
+//  - semaphore released by N units is then retrieved as single notification (one callback, one re-association)
+//    instead of N separate ones
+//  - the draining still acquires the units one by one, with zero timeout waits, as there's no call taking more;
+//    it saves the completions, callbacks and re-associations, not the per-unit system calls
+//  - parameters are same as for AddUnlimitedWaitObject, except:
+//     - 'ptrCallbackFunction' - optional function that receives number of units acquired, at least 1
+//  - returns: TRUE - on success
+//             FALSE - on failure, call GetLastError () to get more information
+//
+_Success_ (return != FALSE)
+BOOL WINAPI AddUnlimitedWaitSemaphore (
+    _In_     UnlimitedWait * hUnlimitedWait,
+    _In_     HANDLE          hSemaphoreHandle,
+    _In_opt_ PUNLIMITED_WAIT_SEMAPHORE_CALLBACK ptrCallbackFunction,
+    _In_opt_ PVOID           lpObjectContext,
+    _In_     DWORD           dwFlags
+);
+
+// AddUnlimitedWaitVirtualObject
+//  - creates user-mode signal object in 'UnlimitedWait', signalled by the functions below, without any kernel object
+//  - signalling posts directly to the UnlimitedWait's I/O completion port, one post instead of kernel event set,
+//    wait packet completion and re-association; while a signal is pending, further signals are coalesced
+//  - parameters:
+//     - 'ptrCallbackFunction' - optional function called by WaitUnlimitedWait(Ex) when the signal is retrieved
+//                             - returning FALSE removes the virtual object, the handle is no longer valid then
+//     - 'lpObjectContext' - pointer, that is passed to 'ptrCallbackFunction' (if provided) and
+//                           returned by WaitUnlimitedWait(Ex) to identify signalled objects
+//     - 'dwFlags' - additional behavior options, can be one or more of:
+//                 - UNLIMITED_WAIT_OBJECT_MANUAL_RESET - object stays signalled (and keeps being reported)
+//                                                        until reset, otherwise the retrieval resets it
+//                 - UNLIMITED_WAIT_OBJECT_INITIAL_STATE - object is created signalled
+//  - returns: handle to the virtual object, to be used with functions below and with RemoveUnlimitedWaitObject
+//             - it is NOT a kernel handle, do not close it, it's released by RemoveUnlimitedWaitObject or DeleteUnlimitedWait
+//             - it must not be signalled during or after its removal
+//           : NULL on failure, call GetLastError () to get more information
+//
+_Success_ (return != NULL)
+HANDLE WINAPI AddUnlimitedWaitVirtualObject (
+    _In_     UnlimitedWait * hUnlimitedWait,
+    _In_opt_ PUNLIMITED_WAIT_OBJECT_CALLBACK ptrCallbackFunction,
+    _In_opt_ PVOID           lpObjectContext,
+    _In_     DWORD           dwFlags
+);
+
+// SetUnlimitedWaitVirtualObject
+//  - sets the virtual object to signalled state, posts the signal unless one is already pending
+//  - can be called from any thread without locking the UnlimitedWait
+//
+_Success_ (return != FALSE)
+BOOL WINAPI SetUnlimitedWaitVirtualObject (
+    _In_ HANDLE hVirtualObject
+);
+
+// ResetUnlimitedWaitVirtualObject
+//  - sets the virtual object to non-signalled state, stops manual-reset object from being reported again
+//  - already posted signal is still retrieved (same as with kernel objects)
+//
+_Success_ (return != FALSE)
+BOOL WINAPI ResetUnlimitedWaitVirtualObject (
+    _In_ HANDLE hVirtualObject
+);
+
+// PulseUnlimitedWaitVirtualObject
+//  - posts single signal, unless one is already pending, and leaves the virtual object non-signalled
+//
+_Success_ (return != FALSE)
+BOOL WINAPI PulseUnlimitedWaitVirtualObject (
+    _In_ HANDLE hVirtualObject
+);
+
+// GetUnlimitedWaitReadinessHandle
+//  - returns waitable handle that is signalled while the UnlimitedWait has signals queued for retrieval,
+//    i.e. its I/O completion port, it can be passed to WaitForSingleObject, WaitForMultipleObjects or
+//    to other UnlimitedWait, see AddUnlimitedWaitChild
+//  - waiting on the handle doesn't retrieve anything, it stays signalled until the signals are retrieved
+//  - entries carried over by SetUnlimitedWaitBatchPolicy time budget are not reflected
+//  - the handle is owned by the UnlimitedWait, do not close it
+//  - returns NULL with ERROR_NOT_SUPPORTED for objects created by CreateUnlimitedWaitOnPort
+//
+_Success_ (return != NULL)
+HANDLE WINAPI GetUnlimitedWaitReadinessHandle (
+    _In_ UnlimitedWait * hUnlimitedWait
+);
+
+// AddUnlimitedWaitChild
+//  - adds 'hChildUnlimitedWait' to 'hUnlimitedWait' as an object, so that one thread can wait on many
+//    independent UnlimitedWait sets
+//  - when the child has signals queued, WaitUnlimitedWait(Ex) on the parent drains a batch of them inline,
+//    calling the child's callbacks, and then reports the child pointer as the signalled object context
+//     - contexts of the child's objects are not reported, they need callbacks (or batch callback) of their own
+//     - child's timeout callback is called if another thread drained it first
+//     - child's entries carried over by its time budget are posted back, to keep the child signalled
+//  - the child must not be the parent itself or any of its ancestors, and must be removed before it's deleted:
+//    RemoveUnlimitedWaitObject (parent, GetUnlimitedWaitReadinessHandle (child), FALSE)
+//  - child created with UNLIMITED_WAIT_CREATE_SINGLE_THREADED must be owned by the thread waiting on the parent
+//
+_Success_ (return != FALSE)
+BOOL WINAPI AddUnlimitedWaitChild (
+    _In_ UnlimitedWait * hUnlimitedWait,
+    _In_ UnlimitedWait * hChildUnlimitedWait
+);
+
 // RemoveUnlimitedWaitObject
 //  - removes object from 'UnlimitedWait' and stops consuming signalled state changes
 //  - parameters:
-//     - 'hObjectHandle' - handle to kernel object already added
+//     - 'hObjectHandle' - handle to kernel object (or virtual object) already added
 //     - 'bKeepSignalsEnqueued' - TRUE - WaitUnlimitedWait(Ex) will still retrieve remaining signals that
 //                                       occured before call to 'RemoveUnlimitedWaitObject'
 //                              - FALSE - all unretrieved signals that occured before this call are deleted
@@ -88,6 +381,82 @@ BOOL WINAPI RemoveUnlimitedWaitObject (
     _In_ BOOL            bKeepSignalsEnqueued
 );
 
+// RemoveUnlimitedWaitObjects
+//  - removes multiple objects, as RemoveUnlimitedWaitObject, under single lock acquisition and single pass over the slots
+//  - parameters:
+//     - 'nCount' - number of handles in 'hObjectHandles' array
+//     - 'dwErrors' - optional array of 'nCount' items, receives ERROR_SUCCESS or error code for each handle,
+//                    ERROR_FILE_NOT_FOUND for handles not associated (and for repeated handles)
+//  - returns: number of objects removed
+//             - when not all were removed, GetLastError () returns error of the last failure
+//
+_Success_ (return != 0)
+ULONG WINAPI RemoveUnlimitedWaitObjects (
+    _In_ UnlimitedWait * hUnlimitedWait,
+    _In_ ULONG           nCount,
+    _In_reads_ (nCount) const HANDLE * hObjectHandles,
+    _In_ BOOL            bKeepSignalsEnqueued,
+    _Out_writes_opt_ (nCount) DWORD * dwErrors
+);
+
+// RemoveUnlimitedWaitObjectsIf
+//  - removes all objects for which 'pfnPredicate' returns TRUE, see PUNLIMITED_WAIT_REMOVE_PREDICATE
+//  - returns: number of objects removed
+//             - GetLastError () returns ERROR_SUCCESS, or error of the last removal that failed
+//
+ULONG WINAPI RemoveUnlimitedWaitObjectsIf (
+    _In_     UnlimitedWait * hUnlimitedWait,
+    _In_     PUNLIMITED_WAIT_REMOVE_PREDICATE pfnPredicate,
+    _In_opt_ PVOID           lpParameter,
+    _In_     BOOL            bKeepSignalsEnqueued
+);
+
+// CompactUnlimitedWait
+//  - returns memory and wait packets after mass removal of objects
+//  - moves objects to the beginning of the slot array, releases wait packets of surplus free slots,
+//    and shrinks the array to fit
+//     - signals already enqueued for moved objects are redelivered with their new position
+//     - objects with signal enqueued that cannot be recalled (signalled virtual objects and removed objects
+//       with signals kept enqueued) are not moved
+//  - parameters:
+//     - nKeepFree - number of free slots (with their wait packets) to keep for future additions
+//  - with CreateUnlimitedWaitOnPort, the application must not hold any retrieved, and not yet dispatched,
+//    completions of this UnlimitedWait while calling this function
+//  - returns: TRUE - on success
+//             FALSE - if any object failed to be re-armed at its new position, call GetLastError () to get more information
+//
+_Success_ (return != FALSE)
+BOOL WINAPI CompactUnlimitedWait (
+    _In_ UnlimitedWait * hUnlimitedWait,
+    _In_ DWORD           nKeepFree
+);
+
+// MoveUnlimitedWaitObject
+//  - moves object from 'hUnlimitedWait' to 'hDestinationUnlimitedWait', e.g. to rebalance load between threads
+//  - the object keeps its callback, context, flags and wait packet, no packet is created or released
+//  - signal already enqueued for the object is recalled and delivered by the destination, exactly once
+//     - until the destination retrieves it, the object can be removed (the signal is then reported or discarded
+//       as with any removal), but not moved or compacted again
+//  - parameters:
+//     - 'hObjectHandle' - handle to kernel object (or virtual object) added to 'hUnlimitedWait'
+//  - with CreateUnlimitedWaitOnPort source, the application must not hold any retrieved, and not yet dispatched,
+//    completions of the source while calling this function
+//  - returns: TRUE - on success
+//             FALSE - on failure, call GetLastError () to get more information:
+//                   - ERROR_FILE_NOT_FOUND - the 'hObjectHandle' is not associated with the source UnlimitedWait
+//                   - ERROR_BUSY - signal of the object is already being dispatched (by worker, or carried over
+//                                  by time budget), or signalled virtual object is enqueued, or the signal enqueued
+//                                  by previous move wasn't retrieved yet, try again later
+//                   - ERROR_NOT_ENOUGH_MEMORY - the destination couldn't grow to accept the object
+//                   - ERROR_NOT_SUPPORTED - virtual object between objects with different allocators
+//
+_Success_ (return != FALSE)
+BOOL WINAPI MoveUnlimitedWaitObject (
+    _In_ UnlimitedWait * hUnlimitedWait,
+    _In_ UnlimitedWait * hDestinationUnlimitedWait,
+    _In_ HANDLE          hObjectHandle
+);
+
 // WaitUnlimitedWait
 //  - retrieves one (the oldest) object signalled status notifications
 //  - calls 'ptrCallbackFunction' for that signalled object, if set
@@ -121,9 +490,12 @@ BOOL WINAPI WaitUnlimitedWait (
 //     - lpSignalledObjectContexts - array that receives contexts of all retrieved objects
 //     - lpTemporaryBuffer - to improve efficiency and reduce allocations, application may provide this scratch buffer
 //                         - the buffer size must be 32 bytes  'ulCount'
+//                         - if NULL, buffer kept by the UnlimitedWait is reused, and grown when 'ulCount' increases
 //     - ulCount - maxmimum number of notifications to retrieve
 //     - ulNumEntriesProcessed - actual number of signal notifications retrieved
 //                             - only this number of 'lpSignalledObjectContexts' array items is set
+//                             - object found signalled again when re-armed after its callback is delivered
+//                               once more right away, while there is room in the batch, so it may appear repeatedly
 //     - dwMilliseconds - when should the function fail (with WAIT_TIMEOUT error) if there's no notification
 //                      - the 'pfnTimeoutCallback' function is called when that happens
 //     - bAlertable - whether the function should process User APCs (and then fail with WAIT_IO_COMPLETION error)
@@ -148,5 +520,279 @@ BOOL WINAPI WaitUnlimitedWaitEx (
     _In_ BOOL bAlertable
 );
 
+// WaitUnlimitedWait2/WaitUnlimitedWaitEx2
+//  - same as WaitUnlimitedWait/WaitUnlimitedWaitEx, but the timeout has 100 ns resolution, as in NT APIs:
+//     - lpTimeout - NULL to wait indefinitely
+//                 - negative value is relative timeout, in 100 ns units
+//                 - positive value is absolute deadline, in system time (UTC FILETIME), doesn't drift when
+//                   the application waits repeatedly after timeouts or APC wakes
+//                 - zero only checks for notifications already enqueued
+//  - the kernel rounds the timeout up to the timer resolution (see timeBeginPeriod), the timeout can be up to a tick late
+//     - for instances created with UNLIMITED_WAIT_CREATE_PRECISE_TIMEOUTS the kernel wait ends one timer tick before
+//       the deadline and the rest is polled, so that WAIT_TIMEOUT, and 'pfnTimeoutCallback', happens at the deadline,
+//       this applies to the millisecond variants too
+//     - i.e. expect the calling thread spinning for up to the timer resolution before each timeout then
+//  - for both these and millisecond variants, internal retries only wait for the remaining time
+//
+_Success_ (return != FALSE)
+BOOL WINAPI WaitUnlimitedWait2 (
+    _In_      UnlimitedWait *       hUnlimitedWait,
+    _Out_opt_ PVOID *               lpSignalledObjectContext,
+    _In_opt_  const LARGE_INTEGER * lpTimeout,
+    _In_      BOOL                  bAlertable
+);
+
+_Success_ (return != FALSE)
+BOOL WINAPI WaitUnlimitedWaitEx2 (
+    _In_ UnlimitedWait * hUnlimitedWait,
+    _Out_writes_to_opt_ (ulCount,*ulNumEntriesProcessed) PVOID * lpSignalledObjectContexts, // array of 'ulCount'
+    _Out_writes_bytes_all_opt_ (32 * ulCount)            PVOID lpTemporaryBuffer, // 32 * ulCount buffer
+    _In_ _In_range_ (1, ULONG_MAX)                       ULONG ulCount,
+    _Out_opt_                                            ULONG * ulNumEntriesProcessed,
+    _In_opt_ const LARGE_INTEGER * lpTimeout,
+    _In_ BOOL bAlertable
+);
+
+// DispatchUnlimitedWaitCompletions
+//  - processes completions retrieved by the application from port passed to 'CreateUnlimitedWaitOnPort'
+//  - calls 'ptrCallbackFunction' for each signalled object and re-arms the object the same way WaitUnlimitedWait(Ex) does
+//  - entries with 'lpCompletionKey' other than 'hUnlimitedWait' are ignored, so the whole array,
+//    including the application's own I/O completions, can be passed as is
+//  - parameters:
+//     - lpCompletionPortEntries - completions as retrieved by GetQueuedCompletionStatusEx
+//     - ulCount - number of items in 'lpCompletionPortEntries'
+//     - lpSignalledObjectContexts - array of 'ulCount' items that receives contexts of dispatched objects
+//     - ulNumEntriesProcessed - number of entries that belonged to this UnlimitedWait (and contexts set)
+//  - returns: TRUE - on success
+//             FALSE - when re-arming any of the objects failed, call GetLastError () to get more information
+//
+_Success_ (return != FALSE)
+BOOL WINAPI DispatchUnlimitedWaitCompletions (
+    _In_ UnlimitedWait * hUnlimitedWait,
+    _In_reads_ (ulCount)                        const OVERLAPPED_ENTRY * lpCompletionPortEntries,
+    _In_                                        ULONG ulCount,
+    _Out_writes_to_opt_ (ulCount,*ulNumEntriesProcessed) PVOID * lpSignalledObjectContexts,
+    _Out_opt_                                   ULONG * ulNumEntriesProcessed
+);
+
+// UNLIMITED_WAIT_EXIT_RECORD
+//  - filled by WaitUnlimitedWaitForExits for every retrieved notification
+//  - for objects added with UNLIMITED_WAIT_OBJECT_HARVEST_EXIT, 'bHarvested' is TRUE and the remaining
+//    members describe the terminated process or thread ('ioCounters' are zero for threads)
+//  - for other objects only 'lpObjectContext' and 'hObject' are valid
+//
+typedef struct _UNLIMITED_WAIT_EXIT_RECORD {
+    PVOID       lpObjectContext;
+    HANDLE      hObject; // NULL if already closed due to UNLIMITED_WAIT_OBJECT_CLOSE_HANDLE
+    BOOL        bHarvested;
+    DWORD       dwExitCode;
+    FILETIME    ftCreationTime;
+    FILETIME    ftExitTime;
+    FILETIME    ftKernelTime;
+    FILETIME    ftUserTime;
+    IO_COUNTERS ioCounters;
+} UNLIMITED_WAIT_EXIT_RECORD;
+
+// WaitUnlimitedWaitForExits
+//  - same as WaitUnlimitedWaitEx, but returns exit records instead of plain contexts
+//  - reaping of many short-lived processes becomes single batched call, instead of a callback,
+//    GetExitCodeProcess and CloseHandle call for each
+//  - parameters:
+//     - lpExitRecords - array of 'ulCount' records that receives information on all retrieved objects
+//     - remaining parameters and return value are same as for WaitUnlimitedWaitEx
+//
+_Success_ (return != FALSE)
+BOOL WINAPI WaitUnlimitedWaitForExits (
+    _In_ UnlimitedWait * hUnlimitedWait,
+    _Out_writes_to_ (ulCount,*ulNumEntriesProcessed)     UNLIMITED_WAIT_EXIT_RECORD * lpExitRecords, // array of 'ulCount'
+    _Out_writes_bytes_all_opt_ (32 * ulCount)            PVOID lpTemporaryBuffer, // 32 * ulCount buffer
+    _In_ _In_range_ (1, ULONG_MAX)                       ULONG ulCount,
+    _Out_opt_                                            ULONG * ulNumEntriesProcessed,
+    _In_ DWORD dwMilliseconds,
+    _In_ BOOL bAlertable
+);
+
+// SetUnlimitedWaitBatchCallback
+//  - sets, or with NULL clears, callback that processes whole retrieved batch at once, see PUNLIMITED_WAIT_BATCH_CALLBACK
+//  - applies to objects added by AddUnlimitedWaitObject(Ex) without callback, not to virtual objects, semaphores
+//    added by AddUnlimitedWaitSemaphore, or objects with UNLIMITED_WAIT_OBJECT_HARVEST_EXIT
+//  - the batch callback runs in the waiting thread, after per-object callbacks of the batch, even with workers started
+//  - objects left for re-arming by the batch callback are re-armed together right after it returns
+//
+_Success_ (return != FALSE)
+BOOL WINAPI SetUnlimitedWaitBatchCallback (
+    _In_     UnlimitedWait * hUnlimitedWait,
+    _In_opt_ PUNLIMITED_WAIT_BATCH_CALLBACK ptrBatchCallbackFunction
+);
+
+// StartUnlimitedWaitWorkers
+//  - switches UnlimitedWait to offloaded execution, where waiting threads only retrieve signals, and callbacks,
+//    together with re-arming of the objects, run on pool of worker threads
+//     - waiting threads (WaitUnlimitedWait(Ex), DispatchUnlimitedWaitCompletions) report retrieved objects immediately
+//       and continue retrieving, a slow callback doesn't hold up the others
+//     - the object is re-armed only after its callback returns, so signals of one object are never processed concurrently
+//       or out of order, but these of different objects are
+//     - objects with UNLIMITED_WAIT_OBJECT_HARVEST_EXIT are still processed by the waiting thread
+//     - workers don't deliver re-signalled objects inline, each signal goes through the waiting thread
+//  - parameters:
+//     - nWorkers - number of worker threads to start
+//     - nQueueDepth - capacity of lock-free queue from waiting threads to workers, rounded up to power of 2, minimum 16
+//                   - when the queue is full, waiting thread dispatches the signal itself
+//  - callbacks MUST NOT call StopUnlimitedWaitWorkers
+//  - returns FALSE on failure, ERROR_ALREADY_INITIALIZED if workers are already running
+//
+_Success_ (return != FALSE)
+BOOL WINAPI StartUnlimitedWaitWorkers (
+    _In_ UnlimitedWait * hUnlimitedWait,
+    _In_ DWORD nWorkers,
+    _In_ DWORD nQueueDepth
+);
+
+// StopUnlimitedWaitWorkers
+//  - returns UnlimitedWait to dispatching callbacks in waiting threads
+//  - waits for workers to finish the signals already queued to them
+//  - DeleteUnlimitedWait stops workers automatically
+//  - returns FALSE on failure, ERROR_FILE_NOT_FOUND if workers weren't started
+//
+_Success_ (return != FALSE)
+BOOL WINAPI StopUnlimitedWaitWorkers (
+    _In_ UnlimitedWait * hUnlimitedWait
+);
+
+// SetUnlimitedWaitBatchPolicy
+//  - enables adaptive batch sizing with time budget in WaitUnlimitedWait(Ex), 0 disables it (default)
+//     - 'ulCount' of WaitUnlimitedWaitEx then becomes the maximum, the number of signals retrieved at once grows
+//       while the queue is deep, and shrinks when callbacks don't fit in the budget
+//     - after 'dwTimeBudgetMicroseconds' spent invoking callbacks, the call returns what it processed so far,
+//       remaining retrieved signals are carried over and returned first by the next call, in order
+//  - keeps time between calls, and thus reaction to APCs, timeouts or control requests, bounded even with slow callbacks
+//  - at least one signal is processed by each call, regardless of the budget
+//
+_Success_ (return != FALSE)
+BOOL WINAPI SetUnlimitedWaitBatchPolicy (
+    _In_ UnlimitedWait * hUnlimitedWait,
+    _In_ DWORD dwTimeBudgetMicroseconds
+);
+
+// SetUnlimitedWaitSpin
+//  - enables adaptive polling in WaitUnlimitedWait(Ex): before blocking, the port is polled for a while,
+//    avoiding the cost of parking and waking the thread when signals arrive microseconds apart
+//  - the spin window follows recent gaps between retrieved signals, and is zero (no spinning) when the gaps
+//    are longer than 'dwMaximumSpinMicroseconds'; it starts at half of the maximum, until the first gaps are measured
+//  - 0 disables spinning (default), spinning is also never enabled on single processor systems
+//  - GetUnlimitedWaitStatistics reports how many spins retrieved a signal (hits) and how many ended blocking (misses)
+//
+_Success_ (return != FALSE)
+BOOL WINAPI SetUnlimitedWaitSpin (
+    _In_ UnlimitedWait * hUnlimitedWait,
+    _In_ DWORD dwMaximumSpinMicroseconds
+);
+
+// SetUnlimitedWaitHeavyHitterTracking
+//  - enables counting of signals per object, for finding the few objects responsible for signal storms
+//  - memory used is fixed, set by 'nTrackedSlots' (up to 1024), regardless of number of objects, the counts are
+//    approximate (space-saving summary): objects beyond that many share the lowest counters, see 'nError' below
+//  - 'dwWindowMilliseconds' is length of the sliding window the counts and rates are reported over
+//  - 0 'nTrackedSlots' disables the tracking (default), enabling it again starts from zero
+//  - the counting costs one short lock per retrieved batch, only while enabled
+//
+_Success_ (return != FALSE)
+BOOL WINAPI SetUnlimitedWaitHeavyHitterTracking (
+    _In_ UnlimitedWait * hUnlimitedWait,
+    _In_ ULONG nTrackedSlots,
+    _In_ DWORD dwWindowMilliseconds
+);
+
+// UNLIMITED_WAIT_HEAVY_HITTER
+//  - nSignals - estimated number of signals of the object within the last window, never underestimated
+//  - nError - how much of 'nSignals' can be overestimate, the object had at least 'nSignals' - 'nError' signals
+//  - nSignalsPerSecond - the same as 'nSignals', scaled to a second
+//
+typedef struct _UNLIMITED_WAIT_HEAVY_HITTER {
+    PVOID     lpObjectContext;
+    HANDLE    hObject;
+    ULONGLONG nSignals;
+    ULONGLONG nError;
+    ULONGLONG nSignalsPerSecond;
+} UNLIMITED_WAIT_HEAVY_HITTER;
+
+// QueryUnlimitedWaitHeavyHitters
+//  - retrieves up to 'nCount' most frequently signalled objects, sorted from the hottest
+//  - counts are kept per slot, objects removed (or moved by CompactUnlimitedWait) lose their history
+//  - returns FALSE with ERROR_INVALID_FUNCTION when tracking is not enabled
+//
+_Success_ (return != FALSE)
+BOOL WINAPI QueryUnlimitedWaitHeavyHitters (
+    _In_ UnlimitedWait * hUnlimitedWait,
+    _Out_writes_to_ (nCount, *nReturned) UNLIMITED_WAIT_HEAVY_HITTER * lpHitters,
+    _In_ ULONG nCount,
+    _Out_ ULONG * nReturned
+);
+
+// UNLIMITED_WAIT_STATISTICS
+//  - nSlots - number of slots (each with its wait packet) initialized, free or used
+//  - nCapacity - number of slots allocated, the slot array grows geometrically
+//  - nObjects - number of objects currently waited on
+//  - nHeapOperations - total number of heap allocations, reallocations and frees done by the instance,
+//                      in steady state (no adds beyond capacity, same or smaller wait batches) this doesn't change
+//  - nInlineDeliveries - total number of signals delivered without going through the completion port,
+//                        because the object was found signalled again when it was being re-armed
+//  - nSpinHits, nSpinMisses - number of adaptive spins that retrieved signals, and that ended in blocking wait
+//  - nCarriedOver - total number of signals carried over to next call by exhausted time budget
+//  - nBatchSize - current adaptive batch size, see SetUnlimitedWaitBatchPolicy
+//
+typedef struct _UNLIMITED_WAIT_STATISTICS {
+    SIZE_T    nSlots;
+    SIZE_T    nCapacity;
+    SIZE_T    nObjects;
+    ULONGLONG nHeapOperations;
+    ULONGLONG nInlineDeliveries;
+    ULONGLONG nSpinHits;
+    ULONGLONG nSpinMisses;
+    ULONGLONG nCarriedOver;
+    ULONG     nBatchSize;
+} UNLIMITED_WAIT_STATISTICS;
+
+// GetUnlimitedWaitStatistics
+//  - retrieves current slot usage and counters of the UnlimitedWait
+//
+_Success_ (return != FALSE)
+BOOL WINAPI GetUnlimitedWaitStatistics (
+    _In_  UnlimitedWait * hUnlimitedWait,
+    _Out_ UNLIMITED_WAIT_STATISTICS * lpStatistics
+);
+
+// QueryUnlimitedWaitReadiness
+//  - reports which of the waited-on objects are signalled right now, without consuming the signals,
+//    i.e. auto-reset events stay set and semaphores keep their count, mutexes are not acquired
+//  - bit 'i' of 'lpBitmap' (lpBitmap [i / 32] & (1 << (i % 32))) corresponds to slot 'i', free slots are reported as 0
+//     - 'lpObjectContexts' (optional) receives context of the object in each slot, NULL for free slots,
+//       slots of objects don't change until they are removed, or CompactUnlimitedWait is called
+//     - objects with signal retrieved but not yet delivered (carried over, queued to workers, moved) are reported signalled
+//     - so are objects found signalled when they were (re-)armed, their completion is queued in the port
+//     - while the completion port is empty, no armed object is signalled, and the kernel is not asked at all
+//  - otherwise the objects are queried by calls that don't change their state; the state is UNKNOWN when:
+//     - the object is of type that can't be queried so (mutexes, waitable timers, ...), or
+//     - armed auto-reset event or semaphore reads as not signalled while the port holds completions,
+//       its signal may have been consumed by the wait and be among them
+//     - such slots have bit set in 'lpUnknownBitmap' (optional, same layout) and clear in 'lpBitmap'
+//  - signals just being delivered by concurrent wait, or retrieved by the application from its own port
+//    (CreateUnlimitedWaitOnPort) and not yet passed to DispatchUnlimitedWaitCompletions, are not seen
+//  - parameters:
+//     - 'nBits' - capacity of 'lpBitmap', 'lpUnknownBitmap' and 'lpObjectContexts', can be 0 to only query 'nSlots'
+//     - 'nSlots' - receives number of slots, the number of bits needed
+//     - 'nSignalled' - optionally receives number of bits set in 'lpBitmap'
+//  - returns FALSE with ERROR_INSUFFICIENT_BUFFER when 'nBits' is less than 'nSlots'
+//
+_Success_ (return != FALSE)
+BOOL WINAPI QueryUnlimitedWaitReadiness (
+    _In_ UnlimitedWait * hUnlimitedWait,
+    _Out_writes_opt_ ((nBits + 31) / 32) ULONG * lpBitmap,
+    _Out_writes_opt_ ((nBits + 31) / 32) ULONG * lpUnknownBitmap,
+    _In_ SIZE_T nBits,
+    _Out_ SIZE_T * nSlots,
+    _Out_writes_opt_ (nBits) PVOID * lpObjectContexts,
+    _Out_opt_ SIZE_T * nSignalled
+);
 
 #endif
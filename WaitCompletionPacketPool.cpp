@@ -0,0 +1,136 @@
+#include "WaitCompletionPacketPool.h"
+#include <Winternl.h>
+
+extern "C" {
+    WINBASEAPI NTSTATUS WINAPI NtCreateWaitCompletionPacket (
+        _Out_ PHANDLE WaitCompletionPacketHandle,
+        _In_ ACCESS_MASK DesiredAccess,
+        _In_opt_ POBJECT_ATTRIBUTES ObjectAttributes
+    );
+}
+
+namespace {
+    struct PooledPacket {
+        SLIST_ENTRY entry;
+        HANDLE      hPacket;
+    };
+
+    SLIST_HEADER  pool;   // PooledPacket entries holding packets
+    SLIST_HEADER  spares; // PooledPacket entries without packets, never freed, reused
+    volatile LONG nPooled = 0;
+    volatile LONG nLimit = 4096;
+
+    // Spill
+    //  - moves packet to the process-wide list, or closes it if the list is full
+    //
+    void Spill (HANDLE hPacket) {
+        if (InterlockedIncrement (&nPooled) <= nLimit) {
+            PooledPacket * node = (PooledPacket *) InterlockedPopEntrySList (&spares);
+            if (!node) {
+                node = (PooledPacket *) HeapAlloc (GetProcessHeap (), 0, sizeof (PooledPacket));
+            }
+            if (node) {
+                node->hPacket = hPacket;
+                InterlockedPushEntrySList (&pool, &node->entry);
+                return;
+            }
+        }
+        InterlockedDecrement (&nPooled);
+        CloseHandle (hPacket);
+    }
+
+    // Unspill
+    //  - takes packet from the process-wide list, returns NULL if empty
+    //
+    HANDLE Unspill () {
+        if (PooledPacket * node = (PooledPacket *) InterlockedPopEntrySList (&pool)) {
+            InterlockedDecrement (&nPooled);
+
+            HANDLE hPacket = node->hPacket;
+            InterlockedPushEntrySList (&spares, &node->entry);
+            return hPacket;
+        }
+        return NULL;
+    }
+
+    struct ThreadCache {
+        static constexpr DWORD capacity = 32;
+
+        DWORD  n = 0;
+        HANDLE packets [capacity];
+
+        ~ThreadCache () {
+            while (this->n) {
+                Spill (this->packets [--this->n]);
+            }
+        }
+    };
+
+    thread_local ThreadCache cache;
+}
+
+_Ret_maybenull_
+HANDLE WINAPI AcquireWaitCompletionPacket () {
+    if (cache.n) {
+        return cache.packets [--cache.n];
+    }
+
+    // refill half of the cache from the process-wide list
+
+    while (cache.n != ThreadCache::capacity / 2) {
+        if (HANDLE hPacket = Unspill ()) {
+            cache.packets [cache.n++] = hPacket;
+        } else
+            break;
+    }
+    if (cache.n) {
+        return cache.packets [--cache.n];
+    }
+
+    HANDLE hPacket = NULL;
+    NTSTATUS status = NtCreateWaitCompletionPacket (&hPacket, GENERIC_ALL, NULL);
+    if (SUCCEEDED (status)) {
+        return hPacket;
+    } else {
+        SetLastError (RtlNtStatusToDosError (status));
+        return NULL;
+    }
+}
+
+VOID WINAPI ReleaseWaitCompletionPacket (_In_ HANDLE hPacket) {
+    if (hPacket) {
+        if (cache.n == ThreadCache::capacity) {
+
+            // spill half of the cache to the process-wide list
+
+            while (cache.n != ThreadCache::capacity / 2) {
+                Spill (cache.packets [--cache.n]);
+            }
+        }
+        cache.packets [cache.n++] = hPacket;
+    }
+}
+
+DWORD WINAPI SetWaitCompletionPacketPoolLimit (_In_ DWORD nMaximumPooledPackets) {
+    if (nMaximumPooledPackets > MAXLONG) {
+        nMaximumPooledPackets = MAXLONG;
+    }
+    return (DWORD) InterlockedExchange (&nLimit, (LONG) nMaximumPooledPackets);
+}
+
+DWORD WINAPI TrimWaitCompletionPacketPool (_In_ DWORD nKeep) {
+    DWORD nClosed = 0;
+
+    while (cache.n && (cache.n + (DWORD) nPooled > nKeep)) {
+        CloseHandle (cache.packets [--cache.n]);
+        ++nClosed;
+    }
+    while ((DWORD) nPooled > nKeep) {
+        if (HANDLE hPacket = Unspill ()) {
+            CloseHandle (hPacket);
+            ++nClosed;
+        } else
+            break;
+    }
+    return nClosed;
+}
@@ -0,0 +1,46 @@
+#ifndef WINDOWS_WAITCOMPLETIONPACKETPOOL_H
+#define WINDOWS_WAITCOMPLETIONPACKETPOOL_H
+
+#include <Windows.h>
+
+// Process-wide pool of wait completion packets
+//  - creating and closing a packet are kernel round-trips each, the pool recycles them instead
+//  - every thread keeps small cache of packets, acquiring and releasing from it is just pointer pop/push,
+//    overflowing cache spills half to lock-free process-wide list (and refills from it)
+//  - the process-wide list holds up to limit set by 'SetWaitCompletionPacketPoolLimit',
+//    packets released beyond it are closed
+//  - thread's cache is spilled to the process-wide list when the thread exits
+//  - reusing a packet still costs the cancel before release, so a wait costs associate + cancel
+//    instead of create + associate + close, e.g. WaitForUnlimitedObjectsEx on 64 objects that times out
+//    makes 131 instead of 195 kernel calls
+
+// AcquireWaitCompletionPacket
+//  - returns unassociated wait completion packet, from the pool, or newly created
+//  - returns NULL on failure, call GetLastError () for details
+//
+_Ret_maybenull_
+HANDLE WINAPI AcquireWaitCompletionPacket ();
+
+// ReleaseWaitCompletionPacket
+//  - returns the wait completion packet to the pool
+//  - the packet MUST NOT be associated or queued, cancel it first with NtCancelWaitCompletionPacket (.., TRUE)
+//    unless its completion was already retrieved
+//
+VOID WINAPI ReleaseWaitCompletionPacket (_In_ HANDLE hPacket);
+
+// SetWaitCompletionPacketPoolLimit
+//  - sets maximum number of packets kept in the process-wide list (default is 4096)
+//  - does not trim immediately, use 'TrimWaitCompletionPacketPool'
+//  - returns previous limit
+//
+DWORD WINAPI SetWaitCompletionPacketPoolLimit (_In_ DWORD nMaximumPooledPackets);
+
+// TrimWaitCompletionPacketPool
+//  - closes pooled packets, in the process-wide list and calling thread's cache, until at most 'nKeep' remain
+//  - caches of other running threads are not reachable, each can still hold up to 32 packets,
+//    these are spilled to the process-wide list when their thread exits, and trimmed by the next call
+//  - returns number of packets closed
+//
+DWORD WINAPI TrimWaitCompletionPacketPool (_In_ DWORD nKeep);
+
+#endif
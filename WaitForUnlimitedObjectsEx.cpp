@@ -1,14 +1,23 @@
 #include "WaitForUnlimitedObjectsEx.h"
+#include "WaitCompletionPacketPool.h"
 #include <Winternl.h>
 
 #pragma warning (disable:28159) // GetTickCount
 
+#ifndef STATUS_SUCCESS
+#define STATUS_SUCCESS                   ((NTSTATUS)0x00000000L)
+#endif
+#ifndef STATUS_TIMEOUT
+#define STATUS_TIMEOUT                   ((NTSTATUS)0x00000102L)
+#endif
+#ifndef STATUS_USER_APC
+#define STATUS_USER_APC                  ((NTSTATUS)0x000000C0L)
+#endif
+#ifndef STATUS_CANCELLED
+#define STATUS_CANCELLED                 ((NTSTATUS)0xC0000120L)
+#endif
+
 extern "C" {
-    WINBASEAPI NTSTATUS WINAPI NtCreateWaitCompletionPacket (
-        _Out_ PHANDLE WaitCompletionPacketHandle,
-        _In_ ACCESS_MASK DesiredAccess,
-        _In_opt_ POBJECT_ATTRIBUTES ObjectAttributes
-    );
     WINBASEAPI NTSTATUS WINAPI NtAssociateWaitCompletionPacket (
         _In_ HANDLE WaitCompletionPacketHandle,
         _In_ HANDLE IoCompletionHandle,
@@ -19,17 +28,29 @@ extern "C" {
         _In_ ULONG_PTR IoStatusInformation,
         _Out_opt_ PBOOLEAN AlreadySignaled
     );
+    WINBASEAPI NTSTATUS WINAPI NtCancelWaitCompletionPacket (
+        _In_ HANDLE WaitCompletionPacketHandle,
+        _In_ BOOLEAN RemoveSignaledPacket
+    );
+    WINBASEAPI NTSTATUS WINAPI NtRemoveIoCompletionEx (
+        _In_ HANDLE IoCompletionHandle,
+        _Out_writes_to_ (Count, *NumEntriesRemoved) PVOID IoCompletionInformation, // layout of OVERLAPPED_ENTRY
+        _In_ ULONG Count,
+        _Out_ PULONG NumEntriesRemoved,
+        _In_opt_ PLARGE_INTEGER Timeout,
+        _In_ BOOLEAN Alertable
+    );
 }
 
-_Success_ (return != FALSE)
-BOOL WINAPI WaitForUnlimitedObjectsEx (
+static
+BOOL WINAPI WaitForUnlimitedObjectsExImplementation (
     _Out_opt_ DWORD * dwIndexOfSignalledObject,
     _In_ DWORD nCount,
     _In_reads_ (nCount) CONST HANDLE * lpHandles,
-    _In_ DWORD dwMilliseconds,
+    _In_opt_ PLARGE_INTEGER lpTimeout,
     _In_ BOOL bAlertable
 ) {
-    
+
     if ((nCount == 0) || (lpHandles == NULL)) {
         SetLastError (ERROR_INVALID_PARAMETER);
         return FALSE;
@@ -46,10 +67,14 @@ BOOL WINAPI WaitForUnlimitedObjectsEx (
         HANDLE hIOCP = CreateIoCompletionPort (INVALID_HANDLE_VALUE, NULL, 0, 0);
         if (hIOCP) {
 
-            // create completion packets, one for each object
+            // acquire completion packets, one for each object
 
             DWORD nCreatedPackets = 0;
-            while (SUCCEEDED (NtCreateWaitCompletionPacket (&hPackets [nCreatedPackets], GENERIC_ALL, NULL))) {
+            DWORD nAssociatedPackets = 0; // in order from 'dwRandomShift', including the already signalled one
+            DWORD dwRandomShift = 0;
+            DWORD dwRetrievedPacket = nCount;
+
+            while ((hPackets [nCreatedPackets] = AcquireWaitCompletionPacket ()) != NULL) {
                 if (++nCreatedPackets == nCount)
                     break;
             }
@@ -58,9 +83,7 @@ BOOL WINAPI WaitForUnlimitedObjectsEx (
                 // associate all packets with out IOCP
 
                 static DWORD dwShiftNonce = 0;
-
-                DWORD dwRandomShift = GetTickCount () + dwShiftNonce++;
-                DWORD nAssociatedPackets = 0;
+                dwRandomShift = GetTickCount () + dwShiftNonce++;
 
                 for (; nAssociatedPackets != nCreatedPackets; ++nAssociatedPackets) {
                     
@@ -75,8 +98,9 @@ BOOL WINAPI WaitForUnlimitedObjectsEx (
                         
                         if (bAlreadySignalled) {
                             if (dwIndexOfSignalledObject) {
-                                *dwIndexOfSignalledObject = nAssociatedPackets;
+                                *dwIndexOfSignalledObject = index;
                             }
+                            ++nAssociatedPackets;
                             bResult = TRUE;
                             break;
                         }
@@ -89,25 +113,47 @@ BOOL WINAPI WaitForUnlimitedObjectsEx (
 
                 if ((nAssociatedPackets == nCreatedPackets) && !bResult) {
 
-                    DWORD nCompletions;
+                    ULONG nCompletions;
                     OVERLAPPED_ENTRY oResult;
 
-                    if (GetQueuedCompletionStatusEx (hIOCP, &oResult, 1, &nCompletions, dwMilliseconds, bAlertable)) {
-                        if (dwIndexOfSignalledObject) {
-                            *dwIndexOfSignalledObject = oResult.dwNumberOfBytesTransferred;
-                        }
-                        bResult = TRUE;
+                    switch (NTSTATUS status = NtRemoveIoCompletionEx (hIOCP, &oResult, 1, &nCompletions, lpTimeout, (BOOLEAN) bAlertable)) {
+                        case STATUS_SUCCESS:
+                            dwRetrievedPacket = (DWORD) oResult.dwNumberOfBytesTransferred;
+                            if (dwIndexOfSignalledObject) {
+                                *dwIndexOfSignalledObject = dwRetrievedPacket;
+                            }
+                            bResult = TRUE;
+                            break;
+                        case STATUS_TIMEOUT:
+                            dwError = WAIT_TIMEOUT;
+                            break;
+                        case STATUS_USER_APC:
+                            dwError = WAIT_IO_COMPLETION;
+                            break;
+                        default:
+                            dwError = RtlNtStatusToDosError (status);
                     }
                 }
             } else {
                 SetLastError (ERROR_OUTOFMEMORY); // handle pool exhausted?
             }
 
-            // destroy all objects create to wait
-            //  - no need to call 'NtCancelWaitCompletionPacket' as both associated parties are going away
+            // return all packets to the pool
+            //  - associated packets need to be cancelled first, so that they can be reused,
+            //    those never associated, and the one whose completion was retrieved, are idle already
+            //  - packet that fails to cancel is closed instead
+
+            for (DWORD i = 0; i != nCreatedPackets; ++i) {
+                DWORD index = (i + dwRandomShift) % nCreatedPackets;
 
-            while (nCreatedPackets--) {
-                CloseHandle (hPackets [nCreatedPackets]);
+                if ((i < nAssociatedPackets) && (index != dwRetrievedPacket)) {
+                    NTSTATUS status = NtCancelWaitCompletionPacket (hPackets [index], TRUE);
+                    if ((status != STATUS_SUCCESS) && (status != STATUS_CANCELLED)) {
+                        CloseHandle (hPackets [index]);
+                        continue;
+                    }
+                }
+                ReleaseWaitCompletionPacket (hPackets [index]);
             }
             CloseHandle (hIOCP);
         }
@@ -119,4 +165,37 @@ BOOL WINAPI WaitForUnlimitedObjectsEx (
         SetLastError (dwError);
     }
     return bResult;
-}
\ No newline at end of file
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI WaitForUnlimitedObjectsEx (
+    _Out_opt_ DWORD * dwIndexOfSignalledObject,
+    _In_ DWORD nCount,
+    _In_reads_ (nCount) CONST HANDLE * lpHandles,
+    _In_ DWORD dwMilliseconds,
+    _In_ BOOL bAlertable
+) {
+    if (dwMilliseconds == INFINITE) {
+        return WaitForUnlimitedObjectsExImplementation (dwIndexOfSignalledObject, nCount, lpHandles, NULL, bAlertable);
+    } else {
+        LARGE_INTEGER timeout;
+        timeout.QuadPart = -10'000LL * dwMilliseconds;
+        return WaitForUnlimitedObjectsExImplementation (dwIndexOfSignalledObject, nCount, lpHandles, &timeout, bAlertable);
+    }
+}
+
+_Success_ (return != FALSE)
+BOOL WINAPI WaitForUnlimitedObjectsEx2 (
+    _Out_opt_ DWORD * dwIndexOfSignalledObject,
+    _In_ DWORD nCount,
+    _In_reads_ (nCount) CONST HANDLE * lpHandles,
+    _In_opt_ const LARGE_INTEGER * lpTimeout,
+    _In_ BOOL bAlertable
+) {
+    if (lpTimeout) {
+        LARGE_INTEGER timeout = *lpTimeout;
+        return WaitForUnlimitedObjectsExImplementation (dwIndexOfSignalledObject, nCount, lpHandles, &timeout, bAlertable);
+    } else {
+        return WaitForUnlimitedObjectsExImplementation (dwIndexOfSignalledObject, nCount, lpHandles, NULL, bAlertable);
+    }
+}
@@ -29,4 +29,20 @@ BOOL WINAPI WaitForUnlimitedObjectsEx (
     _In_ BOOL bAlertable
 );
 
+// WaitForUnlimitedObjectsEx2
+//  - WaitForUnlimitedObjectsEx with timeout in 100 ns units, as in NT APIs:
+//     - lpTimeout - NULL to wait indefinitely
+//                 - negative value is relative timeout
+//                 - positive value is absolute deadline, in system time (UTC FILETIME)
+//  - the kernel still rounds the timeout up to the timer resolution (see timeBeginPeriod)
+//
+_Success_ (return != FALSE)
+BOOL WINAPI WaitForUnlimitedObjectsEx2 (
+    _Out_opt_ DWORD * dwIndexOfSignalledObject,
+    _In_ DWORD nCount,
+    _In_reads_ (nCount) CONST HANDLE * lpHandles,
+    _In_opt_ const LARGE_INTEGER * lpTimeout,
+    _In_ BOOL bAlertable
+);
+
 #endif
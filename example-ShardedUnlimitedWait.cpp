@@ -0,0 +1,125 @@
+#include <Windows.h>
+#include <csignal>
+#include <cstdlib>
+#include <cstdio>
+#include <vector>
+
+#include "ShardedUnlimitedWait.h"
+
+HANDLE hQuit = CreateEvent (NULL, TRUE, FALSE, NULL);
+
+std::vector <HANDLE> events;
+ShardedUnlimitedWait * wait = NULL;
+
+void signal_handler (int) {
+    std::printf ("Stopping...\n");
+    SetEvent (hQuit);
+}
+
+auto N = 2048u;
+auto T = 4u;
+
+DWORD WINAPI producer (LPVOID) {
+    std::srand (GetTickCount ());
+
+    Sleep (100);
+    while (WaitForSingleObject (hQuit, 0) == WAIT_TIMEOUT) {
+        auto i = std::rand () % N;
+        SetEvent (events [i]);
+        Sleep (0);
+    }
+    return 0;
+}
+
+BOOL WINAPI OnObjectSignalled (PVOID lpObjectContext, HANDLE hObject) {
+    std::printf ("Thread %u processed signal from %d.\n", GetCurrentThreadId (), (int) (std::ptrdiff_t) lpObjectContext);
+    return TRUE;
+}
+
+DWORD WINAPI consumer (LPVOID) {
+    constexpr auto WAIT_N = 16;
+
+    ULONG nresults;
+    void * results [WAIT_N];
+    char tmp_buffer [32 * WAIT_N];
+
+    while (WaitForSingleObject (hQuit, 0) == WAIT_TIMEOUT) {
+        if (!WaitShardedUnlimitedWaitEx (wait, results, tmp_buffer, WAIT_N, &nresults, 25, FALSE)) {
+            switch (GetLastError ()) {
+                case WAIT_TIMEOUT:
+                    break;
+                default:
+                    std::printf ("Wait error %lu\n", GetLastError ());
+            }
+        }
+    }
+    return 0;
+}
+
+int main (int argc, char ** argv) {
+
+    if (argc > 1) {
+        N = std::strtoul (argv [1], nullptr, 0);
+    }
+    if (argc > 2) {
+        T = std::strtoul (argv [2], nullptr, 0);
+    }
+
+    std::printf ("TESTING %u objects in %u shards\n", N, T);
+
+    std::signal (SIGINT, signal_handler);
+    std::signal (SIGTERM, signal_handler);
+    std::signal (SIGBREAK, signal_handler);
+
+    SetLastError (0);
+    wait = CreateShardedUnlimitedWait (NULL, N, T, NULL, NULL, 0);
+    if (wait) {
+
+        events.reserve (N);
+
+        for (auto i = 0u; i != N; ++i) {
+            HANDLE hEvent = CreateEvent (NULL, FALSE, FALSE, NULL);
+            if (hEvent) {
+
+                if (AddShardedUnlimitedWaitObject (wait, hEvent, OnObjectSignalled, (PVOID) (std::uintptr_t) i, 0)) {
+                    events.push_back (hEvent);
+                } else {
+                    std::printf ("Object %u failed to AddShardedUnlimitedWaitObject, error %lu\n", i, GetLastError ());
+                    CloseHandle (hEvent);
+                    break;
+                }
+            } else {
+                std::printf ("Object %u creation failed, error %lu\n", i, GetLastError ());
+                break;
+            }
+        }
+
+        if (events.size () == N) {
+
+            // one consumer thread per shard, and one producer
+
+            std::vector <HANDLE> threads;
+            for (auto i = 0u; i != T; ++i) {
+                if (auto hThread = CreateThread (NULL, 0, consumer, NULL, 0, NULL)) {
+                    threads.push_back (hThread);
+                }
+            }
+            if (auto hThread = CreateThread (NULL, 0, producer, NULL, 0, NULL)) {
+                threads.push_back (hThread);
+            }
+
+            for (auto & hThread : threads) {
+                WaitForSingleObject (hThread, INFINITE);
+                CloseHandle (hThread);
+            }
+        }
+        DeleteShardedUnlimitedWait (wait);
+    } else {
+        std::printf ("ShardedUnlimitedWait creation failed, error %lu\n", GetLastError ());
+    }
+
+    for (auto & event : events) {
+        CloseHandle (event);
+    }
+    return (int) GetLastError ();
+}
@@ -6,6 +6,7 @@
 #include <set>
 
 #include "win32-iocp-events.h"
+#include "WaitCompletionPacketPool.h"
 
 HANDLE hQuit = NULL;
 std::vector <HANDLE> events;
@@ -116,14 +117,15 @@ int main (int argc, char ** argv) {
 
             // register to get those events through IOCP
 
-            auto i = 0u;
-            for (auto & event : events) {
-                auto h = ReportEventAsCompletion (hIOCP, event, 0, EVENT_KEY_BASE + i++, NULL);
-                if (h) {
-                    waits.push_back (h);
-                } else {
-                    std::printf ("ReportEventAsCompletion %u failed, error %lu\n", i, GetLastError ());
-                }
+            std::vector <OVERLAPPED_ENTRY> registrations (events.size ());
+            for (auto i = 0u; i != events.size (); ++i) {
+                registrations [i].lpCompletionKey = EVENT_KEY_BASE + i;
+            }
+
+            waits.resize (events.size ());
+            auto nRegistered = ReportEventsAsCompletion (hIOCP, (ULONG) events.size (), events.data (), registrations.data (), waits.data (), NULL);
+            if (nRegistered != events.size ()) {
+                std::printf ("ReportEventsAsCompletion registered %lu of %u, error %lu\n", nRegistered, (unsigned) events.size (), GetLastError ());
             }
             if (!ReportEventAsCompletion (hIOCP, hQuit, 0, 0, NULL)) {
                 std::printf ("ReportEventAsCompletion for hQuit failed, error %lu\n", GetLastError ());
@@ -133,40 +135,64 @@ int main (int argc, char ** argv) {
 
             auto hThread = CreateThread (NULL, 0, producer, NULL, 0, NULL);
 
-            // process IOCP events
+            // process IOCP events in batches
             //  - key 0 means hQuit
+            //  - all dequeued events are re-armed with single RestartEventCompletions call
+
+            constexpr auto BATCH = 64u;
+
+            OVERLAPPED_ENTRY completions [BATCH];
+            OVERLAPPED_ENTRY restarts [BATCH];
+            HANDLE hPackets [BATCH];
+            HANDLE hEvents [BATCH];
 
-            OVERLAPPED_ENTRY completion;
+            bool quit = false;
             ULONG n;
             do {
-                BOOL success = GetQueuedCompletionStatusEx (hIOCP, &completion, 1, &n, INFINITE, FALSE);
-
-                verification.insert ((DWORD) completion.lpCompletionKey);
-
-                std::printf ("Signal (%u): %llx %x %p /*%llu*/ distinct objects: %llu/%llu\n",
-                             success,
-                             (unsigned long long) completion.lpCompletionKey, completion.dwNumberOfBytesTransferred, completion.lpOverlapped,
-                             (unsigned long long) completion.Internal,
-                             (unsigned long long) verification.size (),
-                             (unsigned long long) N);
-
-                if (completion.lpCompletionKey >= EVENT_KEY_BASE) {
-                    HANDLE & hPacket = waits [completion.lpCompletionKey - EVENT_KEY_BASE];
-                    HANDLE & hEvent = events [completion.lpCompletionKey - EVENT_KEY_BASE];
-
-                    switch (test_type) {
-                        case TestThreads:
-                            CloseHandle (hEvent);
-                            hEvent = CreateThread (NULL, 65536, blank_thread, NULL, CREATE_SUSPENDED, NULL);
-                            break;
+                BOOL success = GetQueuedCompletionStatusEx (hIOCP, completions, BATCH, &n, INFINITE, FALSE);
+                if (!success) {
+                    n = 0;
+                }
+
+                ULONG nRestarts = 0;
+                for (ULONG i = 0; i != n; ++i) {
+                    const auto & completion = completions [i];
+
+                    verification.insert ((DWORD) completion.lpCompletionKey);
+
+                    std::printf ("Signal (%u): %llx %x %p /*%llu*/ distinct objects: %llu/%llu\n",
+                                 success,
+                                 (unsigned long long) completion.lpCompletionKey, completion.dwNumberOfBytesTransferred, completion.lpOverlapped,
+                                 (unsigned long long) completion.Internal,
+                                 (unsigned long long) verification.size (),
+                                 (unsigned long long) N);
+
+                    if (completion.lpCompletionKey >= EVENT_KEY_BASE) {
+                        HANDLE & hEvent = events [completion.lpCompletionKey - EVENT_KEY_BASE];
+
+                        switch (test_type) {
+                            case TestThreads:
+                                CloseHandle (hEvent);
+                                hEvent = CreateThread (NULL, 65536, blank_thread, NULL, CREATE_SUSPENDED, NULL);
+                                break;
+                        }
+
+                        hPackets [nRestarts] = waits [completion.lpCompletionKey - EVENT_KEY_BASE];
+                        hEvents [nRestarts] = hEvent;
+                        restarts [nRestarts] = completion;
+                        ++nRestarts;
+                    } else {
+                        quit = true;
                     }
+                }
 
-                    if (!RestartEventCompletion (hPacket, hIOCP, hEvent, &completion)) {
-                        std::printf ("RestartWait failed, error %lu\n", GetLastError ());
+                if (nRestarts) {
+                    if (RestartEventCompletions (nRestarts, hPackets, hIOCP, hEvents, restarts, NULL) != nRestarts) {
+                        std::printf ("RestartEventCompletions failed, error %lu\n", GetLastError ());
                     }
                 }
 
-            } while (completion.lpCompletionKey);
+            } while (!quit);
 
             // wait for producer to finish
 
@@ -178,10 +204,13 @@ int main (int argc, char ** argv) {
         // cleanup waits
 
         for (auto & wait : waits) {
+            if (!wait)
+                continue;
+
             if (!CancelEventCompletion (wait, true)) {
                 std::printf ("RestartWait failed, error %lu\n", GetLastError ());
             }
-            CloseHandle (wait);
+            ReleaseWaitCompletionPacket (wait);
         }
 
         // cleanup events
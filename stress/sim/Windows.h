@@ -0,0 +1,370 @@
+#ifndef STRESS_SIM_WINDOWS_H
+#define STRESS_SIM_WINDOWS_H
+
+// Simulated subset of the Win32 API
+//  - just enough of <Windows.h> to compile and run the library sources on Linux
+//  - kernel objects (events, semaphores, threads, I/O completion ports, wait completion packets)
+//    are emulated in user mode by sim.cpp, behind a single dispatcher lock, like the old NT kernel
+//  - SRW locks are instrumented to measure time spent waiting for and holding them
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+
+// SAL
+
+#define _In_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _Inout_opt_
+#define _In_reads_(x)
+#define _In_reads_opt_(x)
+#define _In_reads_bytes_(x)
+#define _In_range_(a,b)
+#define _Out_writes_(x)
+#define _Out_writes_opt_(x)
+#define _Out_writes_all_(x)
+#define _Out_writes_all_opt_(x)
+#define _Out_writes_to_(a,b)
+#define _Out_writes_to_opt_(a,b)
+#define _Out_writes_bytes_(x)
+#define _Out_writes_bytes_opt_(x)
+#define _Out_writes_bytes_all_opt_(x)
+#define _Out_writes_bytes_to_opt_(a,b)
+#define _Inout_updates_(x)
+#define _Inout_updates_bytes_(x)
+#define _Success_(x)
+#define _Ret_maybenull_
+#define _Check_return_
+#define _When_(a,b)
+
+#define WINAPI
+#define CALLBACK
+#define WINBASEAPI
+#define NTAPI
+#define VOID void
+#define CONST const
+
+#define TRUE  1
+#define FALSE 0
+
+typedef int             BOOL;
+typedef unsigned char   BOOLEAN;
+typedef unsigned char   BYTE;
+typedef unsigned short  WORD;
+typedef unsigned int    DWORD;
+typedef int             LONG;
+typedef unsigned int    ULONG;
+typedef unsigned int    UINT;
+typedef long long       LONGLONG;
+typedef unsigned long long ULONGLONG;
+typedef unsigned long long DWORD64;
+typedef std::intptr_t   LONG_PTR;
+typedef std::uintptr_t  ULONG_PTR;
+typedef std::uintptr_t  DWORD_PTR;
+typedef std::uintptr_t  SIZE_T;
+typedef std::intptr_t   SSIZE_T;
+typedef std::uintptr_t  KAFFINITY;
+typedef void *          PVOID;
+typedef void *          LPVOID;
+typedef const void *    LPCVOID;
+typedef void *          HANDLE;
+typedef HANDLE *        PHANDLE;
+typedef HANDLE *        LPHANDLE;
+typedef LONG *          LPLONG;
+typedef BYTE *          PBYTE;
+typedef BOOL *          PBOOL;
+typedef BOOLEAN *       PBOOLEAN;
+typedef DWORD *         LPDWORD;
+typedef DWORD *         PDWORD;
+typedef LONG *          PLONG;
+typedef ULONG *         PULONG;
+typedef ULONG_PTR *     PULONG_PTR;
+typedef ULONGLONG *     PULONGLONG;
+typedef SIZE_T *        PSIZE_T;
+typedef LONG            HRESULT;
+typedef char            CHAR;
+typedef wchar_t         WCHAR;
+typedef const char *    LPCSTR;
+typedef const wchar_t * LPCWSTR;
+typedef LONG            NTSTATUS;
+typedef DWORD           ACCESS_MASK;
+
+#define MAXDWORD     0xFFFFFFFFu
+#define INFINITE     0xFFFFFFFFu
+#define MAXLONG      0x7FFFFFFF
+#define MAXULONG_PTR (~(ULONG_PTR) 0)
+
+#define SUCCEEDED(hr) (((HRESULT) (hr)) >= 0)
+#define FAILED(hr)    (((HRESULT) (hr)) < 0)
+
+#define INVALID_HANDLE_VALUE ((HANDLE) (LONG_PTR) -1)
+
+#define GENERIC_ALL 0x10000000u
+#define DUPLICATE_SAME_ACCESS 2u
+
+#define ERROR_SUCCESS               0u
+#define ERROR_INVALID_FUNCTION      1u
+#define ERROR_FILE_NOT_FOUND        2u
+#define ERROR_INVALID_HANDLE        6u
+#define ERROR_NOT_ENOUGH_MEMORY     8u
+#define ERROR_OUTOFMEMORY           14u
+#define ERROR_NOT_SUPPORTED         50u
+#define ERROR_INVALID_PARAMETER     87u
+#define ERROR_INSUFFICIENT_BUFFER   122u
+#define ERROR_BUSY                  170u
+#define ERROR_ALREADY_EXISTS        183u
+#define ERROR_MORE_DATA             234u
+#define ERROR_NO_MORE_ITEMS         259u
+#define ERROR_ABANDONED_WAIT_0      735u
+#define ERROR_IO_PENDING            997u
+#define ERROR_ALREADY_INITIALIZED   1247u
+#define ERROR_INVALID_OWNER         1307u
+#define ERROR_TIMEOUT               1460u
+#define WAIT_OBJECT_0               0u
+#define WAIT_ABANDONED_0            0x80u
+#define WAIT_IO_COMPLETION          0xC0u
+#define WAIT_TIMEOUT                258u
+#define WAIT_FAILED                 0xFFFFFFFFu
+#define STILL_ACTIVE                259u
+
+#define MEMORY_ALLOCATION_ALIGNMENT 16
+#define DECLSPEC_ALIGN(x) alignas (x)
+
+#define HEAP_ZERO_MEMORY          0x00000008u
+#define HEAP_REALLOC_IN_PLACE_ONLY 0x00000010u
+
+#define WT_EXECUTEDEFAULT       0x00000000u
+#define WT_EXECUTEINWAITTHREAD  0x00000004u
+#define WT_EXECUTEONLYONCE      0x00000008u
+#define WT_EXECUTELONGFUNCTION  0x00000010u
+
+typedef union _LARGE_INTEGER {
+    struct { DWORD LowPart; LONG HighPart; } u;
+    LONGLONG QuadPart;
+} LARGE_INTEGER, * PLARGE_INTEGER;
+
+typedef struct _FILETIME {
+    DWORD dwLowDateTime;
+    DWORD dwHighDateTime;
+} FILETIME, * PFILETIME, * LPFILETIME;
+
+typedef struct _OVERLAPPED {
+    ULONG_PTR Internal;
+    ULONG_PTR InternalHigh;
+    union {
+        struct { DWORD Offset; DWORD OffsetHigh; } s;
+        PVOID Pointer;
+    } u;
+    HANDLE hEvent;
+} OVERLAPPED, * LPOVERLAPPED;
+
+typedef struct _OVERLAPPED_ENTRY {
+    ULONG_PTR    lpCompletionKey;
+    LPOVERLAPPED lpOverlapped;
+    ULONG_PTR    Internal;
+    DWORD        dwNumberOfBytesTransferred;
+} OVERLAPPED_ENTRY, * LPOVERLAPPED_ENTRY;
+
+typedef struct _SECURITY_ATTRIBUTES {
+    DWORD  nLength;
+    LPVOID lpSecurityDescriptor;
+    BOOL   bInheritHandle;
+} SECURITY_ATTRIBUTES, * LPSECURITY_ATTRIBUTES;
+
+typedef struct _IO_COUNTERS {
+    ULONGLONG ReadOperationCount;
+    ULONGLONG WriteOperationCount;
+    ULONGLONG OtherOperationCount;
+    ULONGLONG ReadTransferCount;
+    ULONGLONG WriteTransferCount;
+    ULONGLONG OtherTransferCount;
+} IO_COUNTERS, * PIO_COUNTERS;
+
+typedef struct _PROCESSOR_NUMBER {
+    WORD Group;
+    BYTE Number;
+    BYTE Reserved;
+} PROCESSOR_NUMBER, * PPROCESSOR_NUMBER;
+
+typedef struct _GROUP_AFFINITY {
+    KAFFINITY Mask;
+    WORD      Group;
+    WORD      Reserved [3];
+} GROUP_AFFINITY, * PGROUP_AFFINITY;
+
+// synchronization
+
+typedef struct _RTL_SRWLOCK { PVOID Ptr; } SRWLOCK, * PSRWLOCK;
+#define SRWLOCK_INIT { 0 }
+
+void WINAPI InitializeSRWLock (PSRWLOCK);
+void WINAPI AcquireSRWLockExclusive (PSRWLOCK);
+void WINAPI AcquireSRWLockShared (PSRWLOCK);
+void WINAPI ReleaseSRWLockExclusive (PSRWLOCK);
+void WINAPI ReleaseSRWLockShared (PSRWLOCK);
+BOOLEAN WINAPI TryAcquireSRWLockExclusive (PSRWLOCK);
+BOOLEAN WINAPI TryAcquireSRWLockShared (PSRWLOCK);
+
+typedef struct DECLSPEC_ALIGN (16) _SLIST_ENTRY {
+    struct _SLIST_ENTRY * Next;
+} SLIST_ENTRY, * PSLIST_ENTRY;
+
+typedef union DECLSPEC_ALIGN (16) _SLIST_HEADER {
+    struct { ULONGLONG Alignment; ULONGLONG Region; } s;
+} SLIST_HEADER, * PSLIST_HEADER;
+
+void WINAPI InitializeSListHead (PSLIST_HEADER);
+PSLIST_ENTRY WINAPI InterlockedPushEntrySList (PSLIST_HEADER, PSLIST_ENTRY);
+PSLIST_ENTRY WINAPI InterlockedPopEntrySList (PSLIST_HEADER);
+PSLIST_ENTRY WINAPI InterlockedFlushSList (PSLIST_HEADER);
+WORD WINAPI QueryDepthSList (PSLIST_HEADER);
+
+inline LONG InterlockedIncrement (LONG volatile * p) { return __atomic_add_fetch (p, 1, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedDecrement (LONG volatile * p) { return __atomic_sub_fetch (p, 1, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedExchange (LONG volatile * p, LONG v) { return __atomic_exchange_n (p, v, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedExchangeAdd (LONG volatile * p, LONG v) { return __atomic_fetch_add (p, v, __ATOMIC_SEQ_CST); }
+#define ZeroMemory(p,n) std::memset ((p), 0, (n))
+#define CopyMemory(d,s,n) std::memcpy ((d), (s), (n))
+#define MoveMemory(d,s,n) std::memmove ((d), (s), (n))
+inline LONG InterlockedOr (LONG volatile * p, LONG v) { return __atomic_fetch_or (p, v, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedAnd (LONG volatile * p, LONG v) { return __atomic_fetch_and (p, v, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedCompareExchange (LONG volatile * p, LONG v, LONG c) {
+    __atomic_compare_exchange_n (p, &c, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return c;
+}
+inline LONGLONG InterlockedIncrement64 (LONGLONG volatile * p) { return __atomic_add_fetch (p, 1, __ATOMIC_SEQ_CST); }
+inline LONGLONG InterlockedDecrement64 (LONGLONG volatile * p) { return __atomic_sub_fetch (p, 1, __ATOMIC_SEQ_CST); }
+inline LONGLONG InterlockedExchange64 (LONGLONG volatile * p, LONGLONG v) { return __atomic_exchange_n (p, v, __ATOMIC_SEQ_CST); }
+inline LONGLONG InterlockedExchangeAdd64 (LONGLONG volatile * p, LONGLONG v) { return __atomic_fetch_add (p, v, __ATOMIC_SEQ_CST); }
+inline LONGLONG InterlockedCompareExchange64 (LONGLONG volatile * p, LONGLONG v, LONGLONG c) {
+    __atomic_compare_exchange_n (p, &c, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return c;
+}
+inline PVOID InterlockedExchangePointer (PVOID volatile * p, PVOID v) { return __atomic_exchange_n (p, v, __ATOMIC_SEQ_CST); }
+inline PVOID InterlockedCompareExchangePointer (PVOID volatile * p, PVOID v, PVOID c) {
+    __atomic_compare_exchange_n (p, &c, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return c;
+}
+inline void MemoryBarrier () { __atomic_thread_fence (__ATOMIC_SEQ_CST); }
+inline void YieldProcessor () {
+#if defined (__x86_64__) || defined (__i386__)
+    __builtin_ia32_pause ();
+#endif
+}
+#define ReadAcquire(p) __atomic_load_n ((p), __ATOMIC_ACQUIRE)
+#define WriteRelease(p,v) __atomic_store_n ((p), (v), __ATOMIC_RELEASE)
+#define ReadAcquire64(p) __atomic_load_n ((p), __ATOMIC_ACQUIRE)
+#define WriteRelease64(p,v) __atomic_store_n ((p), (v), __ATOMIC_RELEASE)
+
+BOOL WINAPI WaitOnAddress (volatile VOID * Address, PVOID CompareAddress, SIZE_T AddressSize, DWORD dwMilliseconds);
+void WINAPI WakeByAddressSingle (PVOID Address);
+void WINAPI WakeByAddressAll (PVOID Address);
+
+// errors
+
+DWORD WINAPI GetLastError ();
+void WINAPI SetLastError (DWORD);
+
+// heap
+
+HANDLE WINAPI GetProcessHeap ();
+HANDLE WINAPI HeapCreate (DWORD flOptions, SIZE_T dwInitialSize, SIZE_T dwMaximumSize);
+BOOL WINAPI HeapDestroy (HANDLE hHeap);
+LPVOID WINAPI HeapAlloc (HANDLE hHeap, DWORD dwFlags, SIZE_T dwBytes);
+LPVOID WINAPI HeapReAlloc (HANDLE hHeap, DWORD dwFlags, LPVOID lpMem, SIZE_T dwBytes);
+BOOL WINAPI HeapFree (HANDLE hHeap, DWORD dwFlags, LPVOID lpMem);
+SIZE_T WINAPI HeapSize (HANDLE hHeap, DWORD dwFlags, LPCVOID lpMem);
+
+// handles and kernel objects
+
+BOOL WINAPI CloseHandle (HANDLE hObject);
+BOOL WINAPI DuplicateHandle (HANDLE hSourceProcessHandle, HANDLE hSourceHandle, HANDLE hTargetProcessHandle,
+                             LPHANDLE lpTargetHandle, DWORD dwDesiredAccess, BOOL bInheritHandle, DWORD dwOptions);
+
+HANDLE WINAPI CreateEventW (LPSECURITY_ATTRIBUTES, BOOL bManualReset, BOOL bInitialState, LPCWSTR lpName);
+#define CreateEvent(a,b,c,d) CreateEventW ((a), (b), (c), NULL)
+BOOL WINAPI SetEvent (HANDLE hEvent);
+BOOL WINAPI ResetEvent (HANDLE hEvent);
+BOOL WINAPI PulseEvent (HANDLE hEvent);
+
+HANDLE WINAPI CreateSemaphoreW (LPSECURITY_ATTRIBUTES, LONG lInitialCount, LONG lMaximumCount, LPCWSTR lpName);
+#define CreateSemaphore(a,b,c,d) CreateSemaphoreW ((a), (b), (c), NULL)
+BOOL WINAPI ReleaseSemaphore (HANDLE hSemaphore, LONG lReleaseCount, LPLONG lpPreviousCount);
+
+DWORD WINAPI WaitForSingleObject (HANDLE hHandle, DWORD dwMilliseconds);
+DWORD WINAPI WaitForSingleObjectEx (HANDLE hHandle, DWORD dwMilliseconds, BOOL bAlertable);
+DWORD WINAPI SleepEx (DWORD dwMilliseconds, BOOL bAlertable);
+void WINAPI Sleep (DWORD dwMilliseconds);
+BOOL WINAPI SwitchToThread ();
+
+// threads and processes
+
+typedef DWORD (WINAPI * LPTHREAD_START_ROUTINE) (LPVOID lpThreadParameter);
+typedef VOID (WINAPI * PAPCFUNC) (ULONG_PTR Parameter);
+
+#define CREATE_SUSPENDED 0x00000004u
+
+HANDLE WINAPI CreateThread (LPSECURITY_ATTRIBUTES, SIZE_T dwStackSize, LPTHREAD_START_ROUTINE lpStartAddress,
+                            LPVOID lpParameter, DWORD dwCreationFlags, LPDWORD lpThreadId);
+DWORD WINAPI ResumeThread (HANDLE hThread);
+HANDLE WINAPI GetCurrentThread ();
+HANDLE WINAPI GetCurrentProcess ();
+DWORD WINAPI GetCurrentThreadId ();
+DWORD WINAPI GetCurrentProcessorNumber ();
+void WINAPI GetCurrentProcessorNumberEx (PPROCESSOR_NUMBER ProcNumber);
+DWORD_PTR WINAPI SetThreadAffinityMask (HANDLE hThread, DWORD_PTR dwThreadAffinityMask);
+DWORD WINAPI SetThreadIdealProcessor (HANDLE hThread, DWORD dwIdealProcessor);
+BOOL WINAPI SetThreadIdealProcessorEx (HANDLE hThread, PPROCESSOR_NUMBER lpIdealProcessor, PPROCESSOR_NUMBER lpPreviousIdealProcessor);
+BOOL WINAPI SetThreadGroupAffinity (HANDLE hThread, const GROUP_AFFINITY * GroupAffinity, PGROUP_AFFINITY PreviousGroupAffinity);
+DWORD WINAPI QueueUserAPC (PAPCFUNC pfnAPC, HANDLE hThread, ULONG_PTR dwData);
+BOOL WINAPI GetExitCodeThread (HANDLE hThread, LPDWORD lpExitCode);
+BOOL WINAPI GetExitCodeProcess (HANDLE hProcess, LPDWORD lpExitCode);
+BOOL WINAPI GetThreadTimes (HANDLE hThread, LPFILETIME lpCreationTime, LPFILETIME lpExitTime, LPFILETIME lpKernelTime, LPFILETIME lpUserTime);
+BOOL WINAPI GetProcessTimes (HANDLE hProcess, LPFILETIME lpCreationTime, LPFILETIME lpExitTime, LPFILETIME lpKernelTime, LPFILETIME lpUserTime);
+BOOL WINAPI GetProcessIoCounters (HANDLE hProcess, PIO_COUNTERS lpIoCounters);
+DWORD WINAPI GetActiveProcessorCount (WORD GroupNumber);
+WORD WINAPI GetActiveProcessorGroupCount ();
+#define ALL_PROCESSOR_GROUPS 0xFFFF
+
+#define TLS_OUT_OF_INDEXES 0xFFFFFFFFu
+DWORD WINAPI TlsAlloc ();
+BOOL WINAPI TlsFree (DWORD dwTlsIndex);
+LPVOID WINAPI TlsGetValue (DWORD dwTlsIndex);
+BOOL WINAPI TlsSetValue (DWORD dwTlsIndex, LPVOID lpTlsValue);
+
+// time
+
+DWORD WINAPI GetTickCount ();
+ULONGLONG WINAPI GetTickCount64 ();
+BOOL WINAPI QueryPerformanceCounter (LARGE_INTEGER * lpPerformanceCount);
+BOOL WINAPI QueryPerformanceFrequency (LARGE_INTEGER * lpFrequency);
+void WINAPI GetSystemTimeAsFileTime (LPFILETIME lpSystemTimeAsFileTime);
+void WINAPI GetSystemTimePreciseAsFileTime (LPFILETIME lpSystemTimeAsFileTime);
+BOOL WINAPI QueryInterruptTimePrecise (PULONGLONG lpInterruptTimePrecise);
+
+// thread pool
+
+typedef struct _TP_CALLBACK_INSTANCE TP_CALLBACK_INSTANCE, * PTP_CALLBACK_INSTANCE;
+typedef struct _TP_CALLBACK_ENVIRON_V3 TP_CALLBACK_ENVIRON, * PTP_CALLBACK_ENVIRON;
+typedef VOID (NTAPI * PTP_SIMPLE_CALLBACK) (PTP_CALLBACK_INSTANCE Instance, PVOID Context);
+BOOL WINAPI TrySubmitThreadpoolCallback (PTP_SIMPLE_CALLBACK pfns, PVOID pv, PTP_CALLBACK_ENVIRON pcbe);
+BOOL WINAPI CallbackMayRunLong (PTP_CALLBACK_INSTANCE pci);
+
+// I/O completion ports
+
+HANDLE WINAPI CreateIoCompletionPort (HANDLE FileHandle, HANDLE ExistingCompletionPort, ULONG_PTR CompletionKey, DWORD NumberOfConcurrentThreads);
+BOOL WINAPI PostQueuedCompletionStatus (HANDLE CompletionPort, DWORD dwNumberOfBytesTransferred, ULONG_PTR dwCompletionKey, LPOVERLAPPED lpOverlapped);
+BOOL WINAPI GetQueuedCompletionStatus (HANDLE CompletionPort, LPDWORD lpNumberOfBytesTransferred, PULONG_PTR lpCompletionKey,
+                                       LPOVERLAPPED * lpOverlapped, DWORD dwMilliseconds);
+BOOL WINAPI GetQueuedCompletionStatusEx (HANDLE CompletionPort, LPOVERLAPPED_ENTRY lpCompletionPortEntries, ULONG ulCount,
+                                         PULONG ulNumEntriesRemoved, DWORD dwMilliseconds, BOOL fAlertable);
+
+// wait callbacks (RegisterWaitForSingleObject)
+
+typedef VOID (NTAPI * WAITORTIMERCALLBACK) (PVOID, BOOLEAN);
+
+#endif
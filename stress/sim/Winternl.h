@@ -0,0 +1,38 @@
+#ifndef STRESS_SIM_WINTERNL_H
+#define STRESS_SIM_WINTERNL_H
+
+// Simulated subset of <Winternl.h>
+
+#include "Windows.h"
+
+typedef struct _UNICODE_STRING {
+    WORD   Length;
+    WORD   MaximumLength;
+    WCHAR * Buffer;
+} UNICODE_STRING, * PUNICODE_STRING;
+
+typedef struct _OBJECT_ATTRIBUTES {
+    ULONG  Length;
+    HANDLE RootDirectory;
+    PUNICODE_STRING ObjectName;
+    ULONG  Attributes;
+    PVOID  SecurityDescriptor;
+    PVOID  SecurityQualityOfService;
+} OBJECT_ATTRIBUTES, * POBJECT_ATTRIBUTES;
+
+typedef struct _IO_STATUS_BLOCK {
+    union {
+        NTSTATUS Status;
+        PVOID    Pointer;
+    };
+    ULONG_PTR Information;
+} IO_STATUS_BLOCK, * PIO_STATUS_BLOCK;
+
+#define NT_SUCCESS(Status) (((NTSTATUS) (Status)) >= 0)
+
+extern "C" {
+    ULONG WINAPI RtlNtStatusToDosError (NTSTATUS Status);
+    NTSTATUS WINAPI NtClose (HANDLE Handle);
+}
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef STRESS_SIM_NTSTATUS_H
+#define STRESS_SIM_NTSTATUS_H
+
+// Simulated subset of <ntstatus.h>
+
+#define STATUS_SUCCESS                   ((NTSTATUS) 0x00000000L)
+#define STATUS_WAIT_0                    ((NTSTATUS) 0x00000000L)
+#define STATUS_TIMEOUT                   ((NTSTATUS) 0x00000102L)
+#define STATUS_PENDING                   ((NTSTATUS) 0x00000103L)
+#define STATUS_USER_APC                  ((NTSTATUS) 0x000000C0L)
+#define STATUS_ABANDONED_WAIT_0          ((NTSTATUS) 0x00000080L)
+#define STATUS_INVALID_HANDLE            ((NTSTATUS) 0xC0000008L)
+#define STATUS_INVALID_PARAMETER         ((NTSTATUS) 0xC000000DL)
+#define STATUS_NO_MEMORY                 ((NTSTATUS) 0xC0000017L)
+#define STATUS_OBJECT_TYPE_MISMATCH      ((NTSTATUS) 0xC0000024L)
+#define STATUS_INVALID_PARAMETER_1       ((NTSTATUS) 0xC00000EFL)
+#define STATUS_INVALID_PARAMETER_2       ((NTSTATUS) 0xC00000F0L)
+#define STATUS_INVALID_PARAMETER_3       ((NTSTATUS) 0xC00000F1L)
+#define STATUS_CANCELLED                 ((NTSTATUS) 0xC0000120L)
+
+#endif
@@ -0,0 +1,1462 @@
+// Simulated kernel object layer
+//  - emulates the subset of Win32 and NT API the library uses, so it can run on Linux
+//  - all kernel object state is protected by a single dispatcher lock
+//  - semantics follow the documented (and observed) Windows behavior closely enough for
+//    the library logic to be exercised: auto-reset events and semaphores are consumed by
+//    the wait packet that is satisfied, process/thread objects stay signalled, etc.
+
+#include "Windows.h"
+#include "Winternl.h"
+#include "ntstatus.h"
+#include "sim.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sched.h>
+#include <time.h>
+
+namespace {
+    std::atomic <ULONGLONG> nHeapOperations;
+    std::atomic <ULONGLONG> nWaitPacketsCreated;
+    std::atomic <ULONGLONG> nWaitPacketsClosed;
+    std::atomic <ULONGLONG> nAssociations;
+    std::atomic <ULONGLONG> nCancellations;
+    std::atomic <ULONGLONG> nCompletionsQueued;
+    std::atomic <ULONGLONG> nCompletionsPosted;
+    std::atomic <ULONGLONG> nCompletionsRemoved;
+    std::atomic <ULONGLONG> nSystemCalls;
+    std::atomic <ULONGLONG> nHeapBlocks;
+
+    std::atomic <ULONGLONG> nExclusiveAcquisitions;
+    std::atomic <ULONGLONG> nSharedAcquisitions;
+    std::atomic <ULONGLONG> nContendedAcquisitions;
+    std::atomic <ULONGLONG> nsExclusiveWait;
+    std::atomic <ULONGLONG> nsSharedWait;
+    std::atomic <ULONGLONG> nsExclusiveHold;
+    std::atomic <ULONGLONG> nsSharedHold;
+    std::atomic <ULONGLONG> nsMaxExclusiveWait;
+    std::atomic <ULONGLONG> nsMaxSharedWait;
+
+    ULONGLONG Now () {
+        return (ULONGLONG) std::chrono::duration_cast <std::chrono::nanoseconds> (
+            std::chrono::steady_clock::now ().time_since_epoch ()).count ();
+    }
+    void Syscall () {
+        nSystemCalls.fetch_add (1, std::memory_order_relaxed);
+    }
+    void UpdateMax (std::atomic <ULONGLONG> & max, ULONGLONG value) {
+        auto current = max.load (std::memory_order_relaxed);
+        while (value > current && !max.compare_exchange_weak (current, value, std::memory_order_relaxed))
+            ;
+    }
+
+    thread_local DWORD dwLastError = 0;
+
+    // kernel objects
+
+    enum class Type {
+        Event,
+        Semaphore,
+        Thread,
+        Process,
+        IoCompletion,
+        WaitPacket,
+    };
+
+    struct Object : std::enable_shared_from_this <Object> {
+        Type type;
+        LONG nHandles = 0;
+
+        explicit Object (Type type) : type (type) {}
+        virtual ~Object () = default;
+        virtual void LastHandleClosed () {}
+    };
+
+    struct WaitPacket;
+
+    struct Waitable : Object {
+        LONG state = 0;
+        LONG maximum = 1;
+        bool manual = false;
+        std::list <std::shared_ptr <WaitPacket>> packets;
+
+        using Object::Object;
+    };
+
+    struct Entry {
+        OVERLAPPED_ENTRY data;
+        std::shared_ptr <WaitPacket> packet;
+    };
+
+    struct IoCompletion : Waitable {
+        std::deque <Entry> queue;
+        std::condition_variable cv;
+        bool closed = false;
+
+        IoCompletion () : Waitable (Type::IoCompletion) { this->manual = true; }
+        void LastHandleClosed () override;
+    };
+
+    struct WaitPacket : Object {
+        enum class State { Idle, Waiting, Queued } state = State::Idle;
+        std::shared_ptr <Waitable> target;
+        std::shared_ptr <IoCompletion> port;
+        OVERLAPPED_ENTRY data {};
+
+        WaitPacket () : Object (Type::WaitPacket) {}
+        void LastHandleClosed () override;
+    };
+
+    struct ThreadState;
+
+    struct ThreadObject : Waitable {
+        LPTHREAD_START_ROUTINE routine = nullptr;
+        LPVOID parameter = nullptr;
+        DWORD id = 0;
+        DWORD exitCode = STILL_ACTIVE;
+        LONG suspended = 0;
+        ULONGLONG created = 0;
+        ULONGLONG exited = 0;
+        ThreadState * thread = nullptr;
+
+        ThreadObject () : Waitable (Type::Thread) { this->manual = true; }
+    };
+
+    struct ProcessObject : Waitable {
+        DWORD exitCode = STILL_ACTIVE;
+        ULONGLONG created = 0;
+        ULONGLONG exited = 0;
+
+        ProcessObject () : Waitable (Type::Process) { this->manual = true; }
+    };
+
+    struct ThreadState {
+        std::deque <std::pair <PAPCFUNC, ULONG_PTR>> apcs;
+        std::condition_variable * waiting = nullptr;
+        std::shared_ptr <ThreadObject> object;
+    };
+
+    std::mutex dispatcher;
+    std::condition_variable changed; // any object changed state, for WaitForSingleObject
+    std::vector <std::shared_ptr <Object>> handles;
+    std::vector <std::size_t> freeHandles;
+    std::atomic <DWORD> nextThreadId { 1000 };
+
+    thread_local ThreadState * currentThread = nullptr;
+
+    ThreadState * CurrentThread () {
+        if (!currentThread) {
+            auto object = std::make_shared <ThreadObject> ();
+            object->id = nextThreadId++;
+            object->created = Now ();
+
+            currentThread = new ThreadState;
+            currentThread->object = object;
+            object->thread = currentThread;
+        }
+        return currentThread;
+    }
+
+    HANDLE Insert (std::shared_ptr <Object> object) {
+        std::size_t index;
+        object->nHandles++;
+        if (!freeHandles.empty ()) {
+            index = freeHandles.back ();
+            freeHandles.pop_back ();
+            handles [index] = std::move (object);
+        } else {
+            index = handles.size ();
+            handles.push_back (std::move (object));
+        }
+        return (HANDLE) (ULONG_PTR) ((index + 1) * 4);
+    }
+
+    std::shared_ptr <Object> Lookup (HANDLE h) {
+        if (h == (HANDLE) (LONG_PTR) -2) {
+            return CurrentThread ()->object;
+        }
+        auto value = (ULONG_PTR) h;
+        if (value == 0 || (value & 3))
+            return nullptr;
+
+        auto index = value / 4 - 1;
+        if (index >= handles.size ())
+            return nullptr;
+
+        return handles [index];
+    }
+
+    template <typename T>
+    std::shared_ptr <T> Lookup (HANDLE h, Type type) {
+        auto object = Lookup (h);
+        if (object && object->type == type)
+            return std::static_pointer_cast <T> (object);
+        else
+            return nullptr;
+    }
+
+    std::shared_ptr <Waitable> LookupWaitable (HANDLE h) {
+        auto object = Lookup (h);
+        if (object && object->type != Type::WaitPacket)
+            return std::static_pointer_cast <Waitable> (object);
+        else
+            return nullptr;
+    }
+
+    bool IsSignalled (Waitable * object) {
+        switch (object->type) {
+            case Type::IoCompletion:
+                return !static_cast <IoCompletion *> (object)->queue.empty ();
+            default:
+                return object->state > 0;
+        }
+    }
+    void Consume (Waitable * object) {
+        switch (object->type) {
+            case Type::Event:
+                if (!object->manual) {
+                    object->state = 0;
+                }
+                break;
+            case Type::Semaphore:
+                object->state--;
+                break;
+            default:
+                break;
+        }
+    }
+
+    void Satisfy (Waitable * object);
+
+    void Enqueue (IoCompletion * port, Entry entry) {
+        if (!port->closed) {
+            port->queue.push_back (std::move (entry));
+            port->cv.notify_one ();
+            Satisfy (port);
+        }
+    }
+
+    void Queue (const std::shared_ptr <WaitPacket> & packet) {
+        packet->state = WaitPacket::State::Queued;
+        packet->target.reset ();
+        nCompletionsQueued++;
+        Enqueue (packet->port.get (), Entry { packet->data, packet });
+    }
+
+    // Satisfy
+    //  - completes wait packets waiting for the object, in FIFO order, as long as the object stays signalled
+    //
+    void Satisfy (Waitable * object) {
+        while (!object->packets.empty () && IsSignalled (object)) {
+            auto packet = object->packets.front ();
+            object->packets.pop_front ();
+
+            Consume (object);
+            Queue (packet);
+        }
+        changed.notify_all ();
+    }
+
+    void Detach (WaitPacket * packet) {
+        if (packet->state == WaitPacket::State::Waiting) {
+            auto & list = packet->target->packets;
+            for (auto i = list.begin (); i != list.end (); ++i) {
+                if (i->get () == packet) {
+                    list.erase (i);
+                    break;
+                }
+            }
+            packet->target.reset ();
+            packet->state = WaitPacket::State::Idle;
+        }
+    }
+
+    void IoCompletion::LastHandleClosed () {
+        this->closed = true;
+        this->queue.clear ();
+        this->cv.notify_all ();
+    }
+    void WaitPacket::LastHandleClosed () {
+        Detach (this);
+        nWaitPacketsClosed++;
+    }
+
+    // Block
+    //  - waits on 'cv' until 'ready' returns true, timeout elapses or APC arrives (if alertable)
+    //  - returns STATUS_WAIT_0, STATUS_TIMEOUT or STATUS_USER_APC
+    //
+    template <typename Predicate>
+    NTSTATUS Block (std::unique_lock <std::mutex> & lock, std::condition_variable & cv,
+                    ULONGLONG deadline, BOOL bAlertable, Predicate ready) {
+        auto thread = CurrentThread ();
+        while (!ready ()) {
+            if (bAlertable && !thread->apcs.empty ())
+                return STATUS_USER_APC;
+
+            auto now = Now ();
+            if (now >= deadline)
+                return STATUS_TIMEOUT;
+
+            thread->waiting = &cv;
+            if (deadline == ~0ull) {
+                cv.wait (lock);
+            } else {
+                cv.wait_for (lock, std::chrono::nanoseconds (deadline - now));
+            }
+            thread->waiting = nullptr;
+        }
+        return STATUS_WAIT_0;
+    }
+
+    void DeliverApcs (std::unique_lock <std::mutex> & lock) {
+        auto thread = CurrentThread ();
+        while (!thread->apcs.empty ()) {
+            auto apc = thread->apcs.front ();
+            thread->apcs.pop_front ();
+
+            lock.unlock ();
+            apc.first (apc.second);
+            lock.lock ();
+        }
+    }
+
+    ULONGLONG Deadline (DWORD dwMilliseconds) {
+        if (dwMilliseconds == INFINITE)
+            return ~0ull;
+        else
+            return Now () + dwMilliseconds * 1000000ull;
+    }
+
+    ULONGLONG Deadline (const LARGE_INTEGER * timeout) {
+        if (timeout == nullptr)
+            return ~0ull;
+        if (timeout->QuadPart < 0)
+            return Now () + (ULONGLONG) (-timeout->QuadPart) * 100;
+
+        FILETIME ft;
+        GetSystemTimePreciseAsFileTime (&ft);
+        auto system = ((ULONGLONG) ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+        if ((ULONGLONG) timeout->QuadPart <= system)
+            return Now ();
+        else
+            return Now () + ((ULONGLONG) timeout->QuadPart - system) * 100;
+    }
+
+    // RemoveCompletions
+    //  - common implementation of GetQueuedCompletionStatusEx and NtRemoveIoCompletionEx
+    //
+    NTSTATUS RemoveCompletions (HANDLE hPort, OVERLAPPED_ENTRY * entries, ULONG ulCount, ULONG * ulRemoved,
+                                ULONGLONG deadline, BOOL bAlertable) {
+        Syscall ();
+        std::unique_lock <std::mutex> lock (dispatcher);
+
+        auto port = Lookup <IoCompletion> (hPort, Type::IoCompletion);
+        if (!port)
+            return STATUS_INVALID_HANDLE;
+
+        auto status = Block (lock, port->cv, deadline, bAlertable, [&port] { return !port->queue.empty () || port->closed; });
+        switch (status) {
+            case STATUS_USER_APC:
+                DeliverApcs (lock);
+                return STATUS_USER_APC;
+            case STATUS_TIMEOUT:
+                return STATUS_TIMEOUT;
+        }
+        if (port->closed)
+            return STATUS_ABANDONED_WAIT_0;
+
+        ULONG n = 0;
+        while (n != ulCount && !port->queue.empty ()) {
+            auto & entry = port->queue.front ();
+            if (entry.packet) {
+                entry.packet->state = WaitPacket::State::Idle;
+            }
+            entries [n++] = entry.data;
+            port->queue.pop_front ();
+        }
+        nCompletionsRemoved += n;
+        *ulRemoved = n;
+
+        if (!port->queue.empty ()) {
+            port->cv.notify_one ();
+        }
+        return STATUS_SUCCESS;
+    }
+
+    DWORD WaitResult (NTSTATUS status) {
+        switch (status) {
+            case STATUS_TIMEOUT: return WAIT_TIMEOUT;
+            case STATUS_USER_APC: return WAIT_IO_COMPLETION;
+            case STATUS_ABANDONED_WAIT_0: return ERROR_ABANDONED_WAIT_0;
+            default: return RtlNtStatusToDosError (status);
+        }
+    }
+}
+
+// errors
+
+DWORD WINAPI GetLastError () { return dwLastError; }
+void WINAPI SetLastError (DWORD error) { dwLastError = error; }
+
+extern "C" ULONG WINAPI RtlNtStatusToDosError (NTSTATUS status) {
+    switch (status) {
+        case STATUS_SUCCESS: return ERROR_SUCCESS;
+        case STATUS_TIMEOUT: return WAIT_TIMEOUT;
+        case STATUS_PENDING: return ERROR_IO_PENDING;
+        case STATUS_INVALID_HANDLE: return ERROR_INVALID_HANDLE;
+        case STATUS_OBJECT_TYPE_MISMATCH: return ERROR_INVALID_HANDLE;
+        case STATUS_NO_MEMORY: return ERROR_NOT_ENOUGH_MEMORY;
+        case STATUS_CANCELLED: return 1223; // ERROR_CANCELLED
+        case STATUS_INVALID_PARAMETER:
+        case STATUS_INVALID_PARAMETER_1:
+        case STATUS_INVALID_PARAMETER_2:
+        case STATUS_INVALID_PARAMETER_3:
+            return ERROR_INVALID_PARAMETER;
+        default:
+            return 317; // ERROR_MR_MID_NOT_FOUND
+    }
+}
+
+// SRW locks
+//  - reader/writer spin lock with backoff, writers preferred like the real thing tends to
+//  - bit 0 = owned exclusively, bit 1 = writer pending, remaining bits = number of shared owners
+
+namespace {
+    constexpr ULONG_PTR SRW_EXCLUSIVE = 1;
+    constexpr ULONG_PTR SRW_PENDING = 2;
+    constexpr ULONG_PTR SRW_SHARED = 4;
+
+    struct Ownership {
+        PSRWLOCK lock;
+        ULONGLONG since;
+    };
+    thread_local Ownership owned [64];
+    thread_local unsigned nOwned = 0;
+
+    void Backoff (unsigned & spins) {
+        if (++spins < 64) {
+            YieldProcessor ();
+        } else if (spins < 256) {
+            sched_yield ();
+        } else {
+            timespec ts { 0, 20000 };
+            nanosleep (&ts, nullptr);
+        }
+    }
+
+    void Owned (PSRWLOCK lock, ULONGLONG t) {
+        if (nOwned < 64) {
+            owned [nOwned++] = { lock, t };
+        }
+    }
+    ULONGLONG Released (PSRWLOCK lock) {
+        for (auto i = nOwned; i--; ) {
+            if (owned [i].lock == lock) {
+                auto since = owned [i].since;
+                owned [i] = owned [--nOwned];
+                return Now () - since;
+            }
+        }
+        return 0;
+    }
+
+    ULONG_PTR volatile * Word (PSRWLOCK lock) {
+        return (ULONG_PTR volatile *) &lock->Ptr;
+    }
+
+    bool TryExclusive (PSRWLOCK lock) {
+        ULONG_PTR value = __atomic_load_n (Word (lock), __ATOMIC_RELAXED);
+        while ((value & ~SRW_PENDING) == 0) {
+            if (__atomic_compare_exchange_n (Word (lock), &value, SRW_EXCLUSIVE, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                return true;
+        }
+        return false;
+    }
+    bool TryShared (PSRWLOCK lock, bool respectPending) {
+        ULONG_PTR value = __atomic_load_n (Word (lock), __ATOMIC_RELAXED);
+        while (!(value & SRW_EXCLUSIVE) && !(respectPending && (value & SRW_PENDING))) {
+            if (__atomic_compare_exchange_n (Word (lock), &value, value + SRW_SHARED, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                return true;
+        }
+        return false;
+    }
+}
+
+void WINAPI InitializeSRWLock (PSRWLOCK lock) {
+    lock->Ptr = nullptr;
+}
+
+void WINAPI AcquireSRWLockExclusive (PSRWLOCK lock) {
+    nExclusiveAcquisitions.fetch_add (1, std::memory_order_relaxed);
+    if (!TryExclusive (lock)) {
+        nContendedAcquisitions.fetch_add (1, std::memory_order_relaxed);
+
+        auto t0 = Now ();
+        unsigned spins = 0;
+        do {
+            __atomic_fetch_or (Word (lock), SRW_PENDING, __ATOMIC_RELAXED);
+            Backoff (spins);
+        } while (!TryExclusive (lock));
+
+        auto t = Now ();
+        nsExclusiveWait.fetch_add (t - t0, std::memory_order_relaxed);
+        UpdateMax (nsMaxExclusiveWait, t - t0);
+        Owned (lock, t);
+    } else {
+        Owned (lock, Now ());
+    }
+}
+
+void WINAPI AcquireSRWLockShared (PSRWLOCK lock) {
+    nSharedAcquisitions.fetch_add (1, std::memory_order_relaxed);
+    if (!TryShared (lock, true)) {
+        nContendedAcquisitions.fetch_add (1, std::memory_order_relaxed);
+
+        auto t0 = Now ();
+        unsigned spins = 0;
+        do {
+            Backoff (spins);
+        } while (!TryShared (lock, spins < 4096)); // don't let pending writer starve readers forever
+
+        auto t = Now ();
+        nsSharedWait.fetch_add (t - t0, std::memory_order_relaxed);
+        UpdateMax (nsMaxSharedWait, t - t0);
+        Owned (lock, t);
+    } else {
+        Owned (lock, Now ());
+    }
+}
+
+BOOLEAN WINAPI TryAcquireSRWLockExclusive (PSRWLOCK lock) {
+    if (TryExclusive (lock)) {
+        nExclusiveAcquisitions.fetch_add (1, std::memory_order_relaxed);
+        Owned (lock, Now ());
+        return TRUE;
+    }
+    return FALSE;
+}
+
+BOOLEAN WINAPI TryAcquireSRWLockShared (PSRWLOCK lock) {
+    if (TryShared (lock, true)) {
+        nSharedAcquisitions.fetch_add (1, std::memory_order_relaxed);
+        Owned (lock, Now ());
+        return TRUE;
+    }
+    return FALSE;
+}
+
+void WINAPI ReleaseSRWLockExclusive (PSRWLOCK lock) {
+    nsExclusiveHold.fetch_add (Released (lock), std::memory_order_relaxed);
+    __atomic_fetch_and (Word (lock), ~(SRW_EXCLUSIVE | SRW_PENDING), __ATOMIC_RELEASE);
+}
+
+void WINAPI ReleaseSRWLockShared (PSRWLOCK lock) {
+    nsSharedHold.fetch_add (Released (lock), std::memory_order_relaxed);
+    __atomic_fetch_sub (Word (lock), SRW_SHARED, __ATOMIC_RELEASE);
+}
+
+// SList
+
+namespace {
+    std::mutex slists;
+}
+
+void WINAPI InitializeSListHead (PSLIST_HEADER head) {
+    head->s.Alignment = 0;
+    head->s.Region = 0;
+}
+PSLIST_ENTRY WINAPI InterlockedPushEntrySList (PSLIST_HEADER head, PSLIST_ENTRY entry) {
+    std::lock_guard <std::mutex> guard (slists);
+    auto first = (PSLIST_ENTRY) head->s.Alignment;
+    entry->Next = first;
+    head->s.Alignment = (ULONGLONG) entry;
+    head->s.Region++;
+    return first;
+}
+PSLIST_ENTRY WINAPI InterlockedPopEntrySList (PSLIST_HEADER head) {
+    std::lock_guard <std::mutex> guard (slists);
+    auto first = (PSLIST_ENTRY) head->s.Alignment;
+    if (first) {
+        head->s.Alignment = (ULONGLONG) first->Next;
+        head->s.Region--;
+    }
+    return first;
+}
+PSLIST_ENTRY WINAPI InterlockedFlushSList (PSLIST_HEADER head) {
+    std::lock_guard <std::mutex> guard (slists);
+    auto first = (PSLIST_ENTRY) head->s.Alignment;
+    head->s.Alignment = 0;
+    head->s.Region = 0;
+    return first;
+}
+WORD WINAPI QueryDepthSList (PSLIST_HEADER head) {
+    std::lock_guard <std::mutex> guard (slists);
+    return (WORD) head->s.Region;
+}
+
+// WaitOnAddress
+
+namespace {
+    std::mutex addresses;
+    std::condition_variable addressed;
+}
+
+BOOL WINAPI WaitOnAddress (volatile VOID * address, PVOID compare, SIZE_T size, DWORD dwMilliseconds) {
+    std::unique_lock <std::mutex> lock (addresses);
+    if (std::memcmp ((const void *) address, compare, size) != 0)
+        return TRUE;
+
+    if (dwMilliseconds == INFINITE) {
+        addressed.wait (lock);
+    } else if (addressed.wait_for (lock, std::chrono::milliseconds (dwMilliseconds)) == std::cv_status::timeout) {
+        SetLastError (ERROR_TIMEOUT);
+        return FALSE;
+    }
+    return TRUE;
+}
+void WINAPI WakeByAddressSingle (PVOID) {
+    std::lock_guard <std::mutex> guard (addresses);
+    addressed.notify_all ();
+}
+void WINAPI WakeByAddressAll (PVOID) {
+    std::lock_guard <std::mutex> guard (addresses);
+    addressed.notify_all ();
+}
+
+// heap
+//  - 16 byte header keeps the allocation size for HeapSize
+
+namespace {
+    struct HeapHeader {
+        SIZE_T size;
+        SIZE_T reserved;
+    };
+    HANDLE const hProcessHeap = (HANDLE) (ULONG_PTR) 0x7FFF0000;
+}
+
+HANDLE WINAPI GetProcessHeap () {
+    return hProcessHeap;
+}
+HANDLE WINAPI HeapCreate (DWORD, SIZE_T, SIZE_T) {
+    return (HANDLE) new char;
+}
+BOOL WINAPI HeapDestroy (HANDLE hHeap) {
+    delete (char *) hHeap;
+    return TRUE;
+}
+LPVOID WINAPI HeapAlloc (HANDLE, DWORD dwFlags, SIZE_T dwBytes) {
+    nHeapOperations++;
+    auto header = (HeapHeader *) ((dwFlags & HEAP_ZERO_MEMORY) ? std::calloc (1, sizeof (HeapHeader) + dwBytes)
+                                                                  : std::malloc (sizeof (HeapHeader) + dwBytes));
+    if (!header) {
+        SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+        return nullptr;
+    }
+    header->size = dwBytes;
+    nHeapBlocks++;
+    return header + 1;
+}
+LPVOID WINAPI HeapReAlloc (HANDLE, DWORD dwFlags, LPVOID lpMem, SIZE_T dwBytes) {
+    nHeapOperations++;
+    if (dwFlags & HEAP_REALLOC_IN_PLACE_ONLY) {
+        auto header = (HeapHeader *) lpMem - 1;
+        if (dwBytes <= header->size) {
+            header->size = dwBytes;
+            return lpMem;
+        }
+        SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+        return nullptr;
+    }
+    auto old = (HeapHeader *) lpMem - 1;
+    auto oldSize = old->size;
+    auto header = (HeapHeader *) std::realloc (old, sizeof (HeapHeader) + dwBytes);
+    if (!header) {
+        SetLastError (ERROR_NOT_ENOUGH_MEMORY);
+        return nullptr;
+    }
+    if ((dwFlags & HEAP_ZERO_MEMORY) && dwBytes > oldSize) {
+        std::memset ((char *) (header + 1) + oldSize, 0, dwBytes - oldSize);
+    }
+    header->size = dwBytes;
+    return header + 1;
+}
+BOOL WINAPI HeapFree (HANDLE, DWORD, LPVOID lpMem) {
+    nHeapOperations++;
+    if (lpMem) {
+        std::free ((HeapHeader *) lpMem - 1);
+        nHeapBlocks--;
+    }
+    return TRUE;
+}
+SIZE_T WINAPI HeapSize (HANDLE, DWORD, LPCVOID lpMem) {
+    nHeapOperations++;
+    return ((const HeapHeader *) lpMem - 1)->size;
+}
+
+// handles
+
+BOOL WINAPI CloseHandle (HANDLE h) {
+    Syscall ();
+    std::lock_guard <std::mutex> guard (dispatcher);
+
+    auto value = (ULONG_PTR) h;
+    if (value == 0 || (value & 3) || (value / 4 - 1) >= handles.size () || !handles [value / 4 - 1]) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+
+    auto index = value / 4 - 1;
+    auto object = std::move (handles [index]);
+    freeHandles.push_back (index);
+
+    if (--object->nHandles == 0) {
+        object->LastHandleClosed ();
+    }
+    return TRUE;
+}
+
+extern "C" NTSTATUS WINAPI NtClose (HANDLE h) {
+    if (CloseHandle (h))
+        return STATUS_SUCCESS;
+    else
+        return STATUS_INVALID_HANDLE;
+}
+
+BOOL WINAPI DuplicateHandle (HANDLE, HANDLE hSourceHandle, HANDLE, LPHANDLE lpTargetHandle, DWORD, BOOL, DWORD) {
+    Syscall ();
+    std::lock_guard <std::mutex> guard (dispatcher);
+    if (auto object = Lookup (hSourceHandle)) {
+        *lpTargetHandle = Insert (object);
+        return TRUE;
+    }
+    SetLastError (ERROR_INVALID_HANDLE);
+    return FALSE;
+}
+
+// events and semaphores
+
+HANDLE WINAPI CreateEventW (LPSECURITY_ATTRIBUTES, BOOL bManualReset, BOOL bInitialState, LPCWSTR) {
+    Syscall ();
+    std::lock_guard <std::mutex> guard (dispatcher);
+    auto event = std::make_shared <Waitable> (Type::Event);
+    event->manual = bManualReset;
+    event->state = bInitialState ? 1 : 0;
+    return Insert (event);
+}
+
+namespace {
+    BOOL SetEventState (HANDLE h, LONG state, bool pulse) {
+        Syscall ();
+        std::lock_guard <std::mutex> guard (dispatcher);
+        if (auto event = Lookup <Waitable> (h, Type::Event)) {
+            event->state = state;
+            if (state) {
+                Satisfy (event.get ());
+            }
+            if (pulse) {
+                event->state = 0;
+            }
+            return TRUE;
+        }
+        SetLastError (ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+}
+
+BOOL WINAPI SetEvent (HANDLE h) { return SetEventState (h, 1, false); }
+BOOL WINAPI ResetEvent (HANDLE h) { return SetEventState (h, 0, false); }
+BOOL WINAPI PulseEvent (HANDLE h) { return SetEventState (h, 1, true); }
+
+HANDLE WINAPI CreateSemaphoreW (LPSECURITY_ATTRIBUTES, LONG lInitialCount, LONG lMaximumCount, LPCWSTR) {
+    Syscall ();
+    if (lInitialCount < 0 || lMaximumCount <= 0 || lInitialCount > lMaximumCount) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return NULL;
+    }
+    std::lock_guard <std::mutex> guard (dispatcher);
+    auto semaphore = std::make_shared <Waitable> (Type::Semaphore);
+    semaphore->state = lInitialCount;
+    semaphore->maximum = lMaximumCount;
+    return Insert (semaphore);
+}
+
+BOOL WINAPI ReleaseSemaphore (HANDLE h, LONG lReleaseCount, LPLONG lpPreviousCount) {
+    Syscall ();
+    std::lock_guard <std::mutex> guard (dispatcher);
+    if (auto semaphore = Lookup <Waitable> (h, Type::Semaphore)) {
+        if (lReleaseCount <= 0 || semaphore->state + lReleaseCount > semaphore->maximum) {
+            SetLastError (298); // ERROR_TOO_MANY_POSTS
+            return FALSE;
+        }
+        if (lpPreviousCount) {
+            *lpPreviousCount = semaphore->state;
+        }
+        semaphore->state += lReleaseCount;
+        Satisfy (semaphore.get ());
+        return TRUE;
+    }
+    SetLastError (ERROR_INVALID_HANDLE);
+    return FALSE;
+}
+
+// waits
+
+DWORD WINAPI WaitForSingleObjectEx (HANDLE h, DWORD dwMilliseconds, BOOL bAlertable) {
+    Syscall ();
+    std::unique_lock <std::mutex> lock (dispatcher);
+
+    auto object = LookupWaitable (h);
+    if (!object) {
+        SetLastError (ERROR_INVALID_HANDLE);
+        return WAIT_FAILED;
+    }
+    switch (Block (lock, changed, Deadline (dwMilliseconds), bAlertable, [&object] { return IsSignalled (object.get ()); })) {
+        case STATUS_USER_APC:
+            DeliverApcs (lock);
+            return WAIT_IO_COMPLETION;
+        case STATUS_TIMEOUT:
+            return WAIT_TIMEOUT;
+    }
+    Consume (object.get ());
+    return WAIT_OBJECT_0;
+}
+
+DWORD WINAPI WaitForSingleObject (HANDLE h, DWORD dwMilliseconds) {
+    return WaitForSingleObjectEx (h, dwMilliseconds, FALSE);
+}
+
+DWORD WINAPI SleepEx (DWORD dwMilliseconds, BOOL bAlertable) {
+    Syscall ();
+    std::unique_lock <std::mutex> lock (dispatcher);
+    std::condition_variable never;
+    if (Block (lock, never, Deadline (dwMilliseconds), bAlertable, [] { return false; }) == STATUS_USER_APC) {
+        DeliverApcs (lock);
+        return WAIT_IO_COMPLETION;
+    }
+    return 0;
+}
+
+void WINAPI Sleep (DWORD dwMilliseconds) {
+    if (dwMilliseconds == 0) {
+        sched_yield ();
+    } else {
+        std::this_thread::sleep_for (std::chrono::milliseconds (dwMilliseconds));
+    }
+}
+
+BOOL WINAPI SwitchToThread () {
+    sched_yield ();
+    return TRUE;
+}
+
+// threads and processes
+
+namespace {
+    void ThreadExit (ThreadObject * object, DWORD code) {
+        std::lock_guard <std::mutex> guard (dispatcher);
+        object->exitCode = code;
+        object->exited = Now ();
+        object->state = 1;
+        Satisfy (object);
+    }
+}
+
+HANDLE WINAPI CreateThread (LPSECURITY_ATTRIBUTES, SIZE_T, LPTHREAD_START_ROUTINE lpStartAddress,
+                            LPVOID lpParameter, DWORD dwCreationFlags, LPDWORD lpThreadId) {
+    Syscall ();
+    auto object = std::make_shared <ThreadObject> ();
+    object->routine = lpStartAddress;
+    object->parameter = lpParameter;
+    object->id = nextThreadId++;
+    object->created = Now ();
+    object->suspended = (dwCreationFlags & CREATE_SUSPENDED) ? 1 : 0;
+
+    HANDLE h;
+    {
+        std::lock_guard <std::mutex> guard (dispatcher);
+        h = Insert (object);
+    }
+    if (lpThreadId) {
+        *lpThreadId = object->id;
+    }
+
+    std::thread ([object] {
+        {
+            std::unique_lock <std::mutex> lock (dispatcher);
+            changed.wait (lock, [&object] { return object->suspended == 0; });
+        }
+        auto thread = new ThreadState;
+        thread->object = object;
+        object->state = 0;
+        object->thread = thread;
+        currentThread = thread;
+
+        auto code = object->routine (object->parameter);
+        ThreadExit (object.get (), code);
+
+        {
+            std::lock_guard <std::mutex> guard (dispatcher);
+            object->thread = nullptr;
+            thread->object.reset ();
+        }
+        currentThread = nullptr;
+        delete thread;
+    }).detach ();
+    return h;
+}
+
+DWORD WINAPI ResumeThread (HANDLE h) {
+    Syscall ();
+    std::lock_guard <std::mutex> guard (dispatcher);
+    if (auto thread = Lookup <ThreadObject> (h, Type::Thread)) {
+        auto previous = thread->suspended;
+        if (previous) {
+            thread->suspended--;
+            changed.notify_all ();
+        }
+        return previous;
+    }
+    SetLastError (ERROR_INVALID_HANDLE);
+    return (DWORD) -1;
+}
+
+HANDLE WINAPI GetCurrentThread () { return (HANDLE) (LONG_PTR) -2; }
+HANDLE WINAPI GetCurrentProcess () { return (HANDLE) (LONG_PTR) -1; }
+DWORD WINAPI GetCurrentThreadId () { return CurrentThread ()->object->id; }
+
+DWORD WINAPI GetCurrentProcessorNumber () {
+    auto cpu = sched_getcpu ();
+    return cpu < 0 ? 0 : (DWORD) cpu;
+}
+void WINAPI GetCurrentProcessorNumberEx (PPROCESSOR_NUMBER ProcNumber) {
+    auto cpu = GetCurrentProcessorNumber ();
+    ProcNumber->Group = (WORD) (cpu / 64);
+    ProcNumber->Number = (BYTE) (cpu % 64);
+    ProcNumber->Reserved = 0;
+}
+// processors are split into groups of 64, like the system does, the last group gets the remainder
+
+DWORD WINAPI GetActiveProcessorCount (WORD GroupNumber) {
+    auto n = std::thread::hardware_concurrency ();
+    if (!n) {
+        n = 1;
+    }
+    if (GroupNumber == ALL_PROCESSOR_GROUPS)
+        return n;
+    if (GroupNumber > (n - 1) / 64)
+        return 0;
+    if (GroupNumber < (n - 1) / 64)
+        return 64;
+    return n - GroupNumber * 64;
+}
+WORD WINAPI GetActiveProcessorGroupCount () {
+    return (WORD) ((GetActiveProcessorCount (ALL_PROCESSOR_GROUPS) + 63) / 64);
+}
+DWORD_PTR WINAPI SetThreadAffinityMask (HANDLE, DWORD_PTR dwThreadAffinityMask) {
+    Syscall ();
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    for (unsigned i = 0; i != sizeof (DWORD_PTR) * 8; ++i) {
+        if (dwThreadAffinityMask & ((DWORD_PTR) 1 << i)) {
+            CPU_SET (i, &set);
+        }
+    }
+    sched_setaffinity (0, sizeof set, &set);
+    return ~(DWORD_PTR) 0;
+}
+BOOL WINAPI SetThreadGroupAffinity (HANDLE, const GROUP_AFFINITY * GroupAffinity, PGROUP_AFFINITY PreviousGroupAffinity) {
+    Syscall ();
+    if ((GroupAffinity->Group >= GetActiveProcessorGroupCount ()) || !GroupAffinity->Mask) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    for (unsigned i = 0; i != 64; ++i) {
+        if (GroupAffinity->Mask & ((KAFFINITY) 1 << i)) {
+            CPU_SET (GroupAffinity->Group * 64 + i, &set);
+        }
+    }
+    sched_setaffinity (0, sizeof set, &set);
+
+    if (PreviousGroupAffinity) {
+        PreviousGroupAffinity->Mask = ~(KAFFINITY) 0;
+        PreviousGroupAffinity->Group = 0;
+    }
+    return TRUE;
+}
+DWORD WINAPI SetThreadIdealProcessor (HANDLE, DWORD) {
+    Syscall ();
+    return 0;
+}
+BOOL WINAPI SetThreadIdealProcessorEx (HANDLE, PPROCESSOR_NUMBER lpIdealProcessor, PPROCESSOR_NUMBER lpPreviousIdealProcessor) {
+    Syscall ();
+    if (lpIdealProcessor->Number >= GetActiveProcessorCount (lpIdealProcessor->Group)) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+    if (lpPreviousIdealProcessor) {
+        lpPreviousIdealProcessor->Group = 0;
+        lpPreviousIdealProcessor->Number = 0;
+        lpPreviousIdealProcessor->Reserved = 0;
+    }
+    return TRUE;
+}
+
+DWORD WINAPI QueueUserAPC (PAPCFUNC pfnAPC, HANDLE hThread, ULONG_PTR dwData) {
+    Syscall ();
+    std::lock_guard <std::mutex> guard (dispatcher);
+    if (auto thread = Lookup <ThreadObject> (hThread, Type::Thread)) {
+        if (auto state = thread->thread) {
+            state->apcs.emplace_back (pfnAPC, dwData);
+            if (state->waiting) {
+                state->waiting->notify_all ();
+            }
+            return 1;
+        }
+    }
+    SetLastError (ERROR_INVALID_HANDLE);
+    return 0;
+}
+
+namespace {
+    void ToFileTime (ULONGLONG ns, LPFILETIME ft) {
+        auto t = ns / 100;
+        ft->dwLowDateTime = (DWORD) t;
+        ft->dwHighDateTime = (DWORD) (t >> 32);
+    }
+}
+
+BOOL WINAPI GetExitCodeThread (HANDLE h, LPDWORD lpExitCode) {
+    Syscall ();
+    std::lock_guard <std::mutex> guard (dispatcher);
+    if (auto thread = Lookup <ThreadObject> (h, Type::Thread)) {
+        *lpExitCode = thread->exitCode;
+        return TRUE;
+    }
+    SetLastError (ERROR_INVALID_HANDLE);
+    return FALSE;
+}
+
+BOOL WINAPI GetThreadTimes (HANDLE h, LPFILETIME lpCreationTime, LPFILETIME lpExitTime, LPFILETIME lpKernelTime, LPFILETIME lpUserTime) {
+    Syscall ();
+    std::lock_guard <std::mutex> guard (dispatcher);
+    if (auto thread = Lookup <ThreadObject> (h, Type::Thread)) {
+        ToFileTime (thread->created, lpCreationTime);
+        ToFileTime (thread->exited, lpExitTime);
+        ToFileTime (0, lpKernelTime);
+        ToFileTime (thread->exited ? thread->exited - thread->created : 0, lpUserTime);
+        return TRUE;
+    }
+    SetLastError (ERROR_INVALID_HANDLE);
+    return FALSE;
+}
+
+HANDLE SimCreateProcess (DWORD dwLifetime, DWORD dwExitCode) {
+    auto process = std::make_shared <ProcessObject> ();
+    process->created = Now ();
+
+    HANDLE h;
+    {
+        std::lock_guard <std::mutex> guard (dispatcher);
+        h = Insert (process);
+    }
+    std::thread ([process, dwLifetime, dwExitCode] {
+        std::this_thread::sleep_for (std::chrono::milliseconds (dwLifetime));
+
+        std::lock_guard <std::mutex> guard (dispatcher);
+        process->exitCode = dwExitCode;
+        process->exited = Now ();
+        process->state = 1;
+        Satisfy (process.get ());
+    }).detach ();
+    return h;
+}
+
+BOOL WINAPI GetExitCodeProcess (HANDLE h, LPDWORD lpExitCode) {
+    Syscall ();
+    std::lock_guard <std::mutex> guard (dispatcher);
+    if (auto process = Lookup <ProcessObject> (h, Type::Process)) {
+        *lpExitCode = process->exitCode;
+        return TRUE;
+    }
+    SetLastError (ERROR_INVALID_HANDLE);
+    return FALSE;
+}
+
+BOOL WINAPI GetProcessTimes (HANDLE h, LPFILETIME lpCreationTime, LPFILETIME lpExitTime, LPFILETIME lpKernelTime, LPFILETIME lpUserTime) {
+    Syscall ();
+    std::lock_guard <std::mutex> guard (dispatcher);
+    if (auto process = Lookup <ProcessObject> (h, Type::Process)) {
+        ToFileTime (process->created, lpCreationTime);
+        ToFileTime (process->exited, lpExitTime);
+        ToFileTime (0, lpKernelTime);
+        ToFileTime (process->exited ? process->exited - process->created : 0, lpUserTime);
+        return TRUE;
+    }
+    SetLastError (ERROR_INVALID_HANDLE);
+    return FALSE;
+}
+
+BOOL WINAPI GetProcessIoCounters (HANDLE h, PIO_COUNTERS lpIoCounters) {
+    Syscall ();
+    std::lock_guard <std::mutex> guard (dispatcher);
+    if (Lookup <ProcessObject> (h, Type::Process)) {
+        std::memset (lpIoCounters, 0, sizeof (IO_COUNTERS));
+        return TRUE;
+    }
+    SetLastError (ERROR_INVALID_HANDLE);
+    return FALSE;
+}
+
+// TLS
+
+namespace {
+    constexpr DWORD nTlsSlots = 1088;
+    std::atomic <bool> tlsUsed [nTlsSlots];
+    thread_local LPVOID tlsValues [nTlsSlots];
+}
+
+DWORD WINAPI TlsAlloc () {
+    for (DWORD i = 0; i != nTlsSlots; ++i) {
+        bool expected = false;
+        if (tlsUsed [i].compare_exchange_strong (expected, true))
+            return i;
+    }
+    return TLS_OUT_OF_INDEXES;
+}
+BOOL WINAPI TlsFree (DWORD i) {
+    if (i < nTlsSlots) {
+        tlsUsed [i] = false;
+        return TRUE;
+    }
+    return FALSE;
+}
+LPVOID WINAPI TlsGetValue (DWORD i) {
+    SetLastError (ERROR_SUCCESS);
+    return i < nTlsSlots ? tlsValues [i] : nullptr;
+}
+BOOL WINAPI TlsSetValue (DWORD i, LPVOID value) {
+    if (i < nTlsSlots) {
+        tlsValues [i] = value;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// time
+
+DWORD WINAPI GetTickCount () { return (DWORD) (Now () / 1000000); }
+ULONGLONG WINAPI GetTickCount64 () { return Now () / 1000000; }
+
+BOOL WINAPI QueryPerformanceCounter (LARGE_INTEGER * lpPerformanceCount) {
+    lpPerformanceCount->QuadPart = (LONGLONG) Now ();
+    return TRUE;
+}
+BOOL WINAPI QueryPerformanceFrequency (LARGE_INTEGER * lpFrequency) {
+    lpFrequency->QuadPart = 1000000000;
+    return TRUE;
+}
+void WINAPI GetSystemTimePreciseAsFileTime (LPFILETIME ft) {
+    // 1601 to 1970 offset in 100ns units
+    auto t = (ULONGLONG) std::chrono::duration_cast <std::chrono::nanoseconds> (
+        std::chrono::system_clock::now ().time_since_epoch ()).count () / 100 + 116444736000000000ull;
+    ft->dwLowDateTime = (DWORD) t;
+    ft->dwHighDateTime = (DWORD) (t >> 32);
+}
+void WINAPI GetSystemTimeAsFileTime (LPFILETIME ft) {
+    GetSystemTimePreciseAsFileTime (ft);
+}
+BOOL WINAPI QueryInterruptTimePrecise (PULONGLONG lpInterruptTimePrecise) {
+    *lpInterruptTimePrecise = Now () / 100;
+    return TRUE;
+}
+
+// thread pool
+
+BOOL WINAPI TrySubmitThreadpoolCallback (PTP_SIMPLE_CALLBACK pfns, PVOID pv, PTP_CALLBACK_ENVIRON) {
+    std::thread ([pfns, pv] {
+        pfns (nullptr, pv);
+        delete currentThread;
+        currentThread = nullptr;
+    }).detach ();
+    return TRUE;
+}
+BOOL WINAPI CallbackMayRunLong (PTP_CALLBACK_INSTANCE) {
+    return TRUE; // every callback has its own thread
+}
+
+// I/O completion ports
+
+HANDLE WINAPI CreateIoCompletionPort (HANDLE FileHandle, HANDLE, ULONG_PTR, DWORD) {
+    Syscall ();
+    if (FileHandle != INVALID_HANDLE_VALUE) {
+        SetLastError (ERROR_NOT_SUPPORTED);
+        return NULL;
+    }
+    std::lock_guard <std::mutex> guard (dispatcher);
+    return Insert (std::make_shared <IoCompletion> ());
+}
+
+BOOL WINAPI PostQueuedCompletionStatus (HANDLE hPort, DWORD dwNumberOfBytesTransferred, ULONG_PTR dwCompletionKey, LPOVERLAPPED lpOverlapped) {
+    Syscall ();
+    std::lock_guard <std::mutex> guard (dispatcher);
+    if (auto port = Lookup <IoCompletion> (hPort, Type::IoCompletion)) {
+        Entry entry {};
+        entry.data.lpCompletionKey = dwCompletionKey;
+        entry.data.lpOverlapped = lpOverlapped;
+        entry.data.dwNumberOfBytesTransferred = dwNumberOfBytesTransferred;
+
+        nCompletionsPosted++;
+        Enqueue (port.get (), std::move (entry));
+        return TRUE;
+    }
+    SetLastError (ERROR_INVALID_HANDLE);
+    return FALSE;
+}
+
+BOOL WINAPI GetQueuedCompletionStatusEx (HANDLE hPort, LPOVERLAPPED_ENTRY entries, ULONG ulCount,
+                                         PULONG ulNumEntriesRemoved, DWORD dwMilliseconds, BOOL fAlertable) {
+    ULONG n = 0;
+    auto status = RemoveCompletions (hPort, entries, ulCount, &n, Deadline (dwMilliseconds), fAlertable);
+    if (status == STATUS_SUCCESS) {
+        *ulNumEntriesRemoved = n;
+        return TRUE;
+    }
+    *ulNumEntriesRemoved = 0;
+    SetLastError (WaitResult (status));
+    return FALSE;
+}
+
+BOOL WINAPI GetQueuedCompletionStatus (HANDLE hPort, LPDWORD lpNumberOfBytesTransferred, PULONG_PTR lpCompletionKey,
+                                       LPOVERLAPPED * lpOverlapped, DWORD dwMilliseconds) {
+    OVERLAPPED_ENTRY entry {};
+    ULONG n;
+    if (GetQueuedCompletionStatusEx (hPort, &entry, 1, &n, dwMilliseconds, FALSE)) {
+        *lpNumberOfBytesTransferred = entry.dwNumberOfBytesTransferred;
+        *lpCompletionKey = entry.lpCompletionKey;
+        *lpOverlapped = entry.lpOverlapped;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// NT API
+
+extern "C" {
+    NTSTATUS WINAPI NtCreateWaitCompletionPacket (PHANDLE WaitCompletionPacketHandle, ACCESS_MASK, POBJECT_ATTRIBUTES) {
+        Syscall ();
+        std::lock_guard <std::mutex> guard (dispatcher);
+        *WaitCompletionPacketHandle = Insert (std::make_shared <WaitPacket> ());
+        nWaitPacketsCreated++;
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS WINAPI NtAssociateWaitCompletionPacket (HANDLE WaitCompletionPacketHandle, HANDLE IoCompletionHandle, HANDLE TargetObjectHandle,
+                                                     PVOID KeyContext, PVOID ApcContext, NTSTATUS IoStatus, ULONG_PTR IoStatusInformation,
+                                                     PBOOLEAN AlreadySignaled) {
+        Syscall ();
+        std::lock_guard <std::mutex> guard (dispatcher);
+        nAssociations++;
+
+        auto packet = Lookup <WaitPacket> (WaitCompletionPacketHandle, Type::WaitPacket);
+        if (!packet)
+            return STATUS_INVALID_HANDLE;
+        if (packet->state != WaitPacket::State::Idle)
+            return STATUS_INVALID_PARAMETER_1;
+
+        auto port = Lookup <IoCompletion> (IoCompletionHandle, Type::IoCompletion);
+        if (!port)
+            return STATUS_INVALID_PARAMETER_2;
+
+        auto target = LookupWaitable (TargetObjectHandle);
+        if (!target)
+            return STATUS_INVALID_PARAMETER_3;
+
+        packet->port = port;
+        packet->data.lpCompletionKey = (ULONG_PTR) KeyContext;
+        packet->data.lpOverlapped = (LPOVERLAPPED) ApcContext;
+        packet->data.Internal = (ULONG_PTR) (LONG_PTR) IoStatus;
+        packet->data.dwNumberOfBytesTransferred = (DWORD) IoStatusInformation;
+
+        if (IsSignalled (target.get ())) {
+            if (AlreadySignaled) {
+                *AlreadySignaled = TRUE;
+            }
+            Consume (target.get ());
+            Queue (packet);
+        } else {
+            if (AlreadySignaled) {
+                *AlreadySignaled = FALSE;
+            }
+            packet->state = WaitPacket::State::Waiting;
+            packet->target = target;
+            target->packets.push_back (packet);
+        }
+        return STATUS_SUCCESS;
+    }
+
+    // NtCancelWaitCompletionPacket
+    //  - STATUS_SUCCESS - the wait was cancelled before the object got signalled
+    //  - STATUS_CANCELLED - the object was already signalled, completion was queued (and removed if 'RemoveSignaledPacket')
+    //
+    NTSTATUS WINAPI NtCancelWaitCompletionPacket (HANDLE WaitCompletionPacketHandle, BOOLEAN RemoveSignaledPacket) {
+        Syscall ();
+        std::lock_guard <std::mutex> guard (dispatcher);
+        nCancellations++;
+
+        auto packet = Lookup <WaitPacket> (WaitCompletionPacketHandle, Type::WaitPacket);
+        if (!packet)
+            return STATUS_INVALID_HANDLE;
+
+        switch (packet->state) {
+            case WaitPacket::State::Idle:
+                return STATUS_SUCCESS;
+            case WaitPacket::State::Waiting:
+                Detach (packet.get ());
+                return STATUS_SUCCESS;
+            case WaitPacket::State::Queued:
+                if (RemoveSignaledPacket) {
+                    auto & queue = packet->port->queue;
+                    for (auto i = queue.begin (); i != queue.end (); ++i) {
+                        if (i->packet == packet) {
+                            queue.erase (i);
+                            break;
+                        }
+                    }
+                    packet->state = WaitPacket::State::Idle;
+                }
+                return STATUS_CANCELLED;
+        }
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS WINAPI NtRemoveIoCompletionEx (HANDLE IoCompletionHandle, PVOID IoCompletionInformation, ULONG Count,
+                                            PULONG NumEntriesRemoved, PLARGE_INTEGER Timeout, BOOLEAN Alertable) {
+        ULONG n = 0;
+        auto status = RemoveCompletions (IoCompletionHandle, (OVERLAPPED_ENTRY *) IoCompletionInformation, Count, &n, Deadline (Timeout), Alertable);
+        *NumEntriesRemoved = n;
+        return status;
+    }
+
+    // NtQueryEvent/NtQuerySemaphore
+    //  - only the basic information class, the state is reported without changing it
+    //
+    NTSTATUS WINAPI NtQueryEvent (HANDLE EventHandle, ULONG, PVOID EventInformation, ULONG EventInformationLength, PULONG ReturnLength) {
+        Syscall ();
+        std::lock_guard <std::mutex> guard (dispatcher);
+        auto object = LookupWaitable (EventHandle);
+        if (!object)
+            return STATUS_INVALID_HANDLE;
+        if (object->type != Type::Event)
+            return STATUS_OBJECT_TYPE_MISMATCH;
+        if (EventInformationLength < 2 * sizeof (LONG))
+            return STATUS_INVALID_PARAMETER;
+
+        ((LONG *) EventInformation) [0] = object->manual ? 0 : 1; // NotificationEvent, SynchronizationEvent
+        ((LONG *) EventInformation) [1] = object->state;
+        if (ReturnLength) {
+            *ReturnLength = 2 * sizeof (LONG);
+        }
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS WINAPI NtQuerySemaphore (HANDLE SemaphoreHandle, ULONG, PVOID SemaphoreInformation, ULONG SemaphoreInformationLength, PULONG ReturnLength) {
+        Syscall ();
+        std::lock_guard <std::mutex> guard (dispatcher);
+        auto object = LookupWaitable (SemaphoreHandle);
+        if (!object)
+            return STATUS_INVALID_HANDLE;
+        if (object->type != Type::Semaphore)
+            return STATUS_OBJECT_TYPE_MISMATCH;
+        if (SemaphoreInformationLength < 2 * sizeof (LONG))
+            return STATUS_INVALID_PARAMETER;
+
+        ((LONG *) SemaphoreInformation) [0] = object->state;
+        ((LONG *) SemaphoreInformation) [1] = object->maximum;
+        if (ReturnLength) {
+            *ReturnLength = 2 * sizeof (LONG);
+        }
+        return STATUS_SUCCESS;
+    }
+
+    // NtQueryIoCompletion
+    //  - only the basic information class, the number of entries queued in the port
+    //
+    NTSTATUS WINAPI NtQueryIoCompletion (HANDLE IoCompletionHandle, ULONG, PVOID IoCompletionInformation, ULONG IoCompletionInformationLength, PULONG ReturnLength) {
+        Syscall ();
+        std::lock_guard <std::mutex> guard (dispatcher);
+        auto object = LookupWaitable (IoCompletionHandle);
+        if (!object)
+            return STATUS_INVALID_HANDLE;
+        if (object->type != Type::IoCompletion)
+            return STATUS_OBJECT_TYPE_MISMATCH;
+        if (IoCompletionInformationLength < sizeof (LONG))
+            return STATUS_INVALID_PARAMETER;
+
+        ((LONG *) IoCompletionInformation) [0] = (LONG) std::static_pointer_cast <IoCompletion> (object)->queue.size ();
+        if (ReturnLength) {
+            *ReturnLength = sizeof (LONG);
+        }
+        return STATUS_SUCCESS;
+    }
+
+    // NtQueryTimerResolution
+    //  - reports the default 15.625 ms tick, the simulated timeouts themselves are not rounded
+    //
+    NTSTATUS WINAPI NtQueryTimerResolution (PULONG MaximumTime, PULONG MinimumTime, PULONG CurrentTime) {
+        *MaximumTime = 156250;
+        *MinimumTime = 5000;
+        *CurrentTime = 156250;
+        return STATUS_SUCCESS;
+    }
+}
+
+// instrumentation
+
+void SimGetLockStatistics (SimLockStatistics * stats) {
+    stats->nExclusiveAcquisitions = nExclusiveAcquisitions;
+    stats->nSharedAcquisitions = nSharedAcquisitions;
+    stats->nContendedAcquisitions = nContendedAcquisitions;
+    stats->nsExclusiveWait = nsExclusiveWait;
+    stats->nsSharedWait = nsSharedWait;
+    stats->nsExclusiveHold = nsExclusiveHold;
+    stats->nsSharedHold = nsSharedHold;
+    stats->nsMaxExclusiveWait = nsMaxExclusiveWait;
+    stats->nsMaxSharedWait = nsMaxSharedWait;
+}
+
+void SimGetKernelStatistics (SimKernelStatistics * stats) {
+    stats->nHeapOperations = nHeapOperations;
+    stats->nWaitPacketsCreated = nWaitPacketsCreated;
+    stats->nWaitPacketsClosed = nWaitPacketsClosed;
+    stats->nAssociations = nAssociations;
+    stats->nCancellations = nCancellations;
+    stats->nCompletionsQueued = nCompletionsQueued;
+    stats->nCompletionsPosted = nCompletionsPosted;
+    stats->nCompletionsRemoved = nCompletionsRemoved;
+    stats->nSystemCalls = nSystemCalls;
+    stats->nHeapBlocks = nHeapBlocks;
+
+    std::lock_guard <std::mutex> guard (dispatcher);
+    stats->nOpenHandles = handles.size () - freeHandles.size ();
+}
+
+void SimResetStatistics () {
+    for (auto * counter : { &nHeapOperations, &nWaitPacketsCreated, &nWaitPacketsClosed, &nAssociations, &nCancellations,
+                            &nCompletionsQueued, &nCompletionsPosted, &nCompletionsRemoved, &nSystemCalls,
+                            &nExclusiveAcquisitions, &nSharedAcquisitions, &nContendedAcquisitions,
+                            &nsExclusiveWait, &nsSharedWait, &nsExclusiveHold, &nsSharedHold,
+                            &nsMaxExclusiveWait, &nsMaxSharedWait }) {
+        counter->store (0);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef STRESS_SIM_SIM_H
+#define STRESS_SIM_SIM_H
+
+// Simulator-only instrumentation
+//  - not part of the simulated Win32 API, used by the stress harness to observe the library
+
+#include "Windows.h"
+
+struct SimLockStatistics {
+    ULONGLONG nExclusiveAcquisitions;
+    ULONGLONG nSharedAcquisitions;
+    ULONGLONG nContendedAcquisitions;  // acquisitions that could not proceed immediately
+    ULONGLONG nsExclusiveWait;         // total time spent waiting for exclusive ownership
+    ULONGLONG nsSharedWait;            // total time spent waiting for shared ownership
+    ULONGLONG nsExclusiveHold;         // total time exclusive ownership was held
+    ULONGLONG nsSharedHold;            // total time shared ownership was held (summed over owners)
+    ULONGLONG nsMaxExclusiveWait;
+    ULONGLONG nsMaxSharedWait;
+};
+
+struct SimKernelStatistics {
+    ULONGLONG nHeapOperations;         // HeapAlloc, HeapReAlloc, HeapFree and HeapSize calls
+    ULONGLONG nWaitPacketsCreated;
+    ULONGLONG nWaitPacketsClosed;
+    ULONGLONG nAssociations;
+    ULONGLONG nCancellations;
+    ULONGLONG nCompletionsQueued;      // by signalled wait packets
+    ULONGLONG nCompletionsPosted;      // by PostQueuedCompletionStatus
+    ULONGLONG nCompletionsRemoved;     // dequeued by GetQueuedCompletionStatus(Ex) or NtRemoveIoCompletionEx
+    ULONGLONG nSystemCalls;            // all simulated kernel transitions
+    ULONGLONG nHeapBlocks;             // allocated and not freed yet, not reset by SimResetStatistics
+    ULONGLONG nOpenHandles;            // not closed yet, not reset by SimResetStatistics
+};
+
+void SimGetLockStatistics (SimLockStatistics *);
+void SimGetKernelStatistics (SimKernelStatistics *);
+void SimResetStatistics ();
+
+// SimCreateProcess
+//  - creates simulated process object, that terminates with 'dwExitCode' after 'dwLifetime' milliseconds
+//
+HANDLE SimCreateProcess (DWORD dwLifetime, DWORD dwExitCode);
+
+#endif
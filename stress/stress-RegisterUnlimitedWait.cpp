@@ -0,0 +1,261 @@
+// Test harness for RegisterUnlimitedWaitForSingleObject and UnregisterUnlimitedWait(Ex)
+//  - runs against the simulated kernel object layer in sim/, see Makefile
+//  - every check uses own registrations, on the single dispatcher thread shared by the process:
+//     - once     - WT_EXECUTEONLYONCE calls back only once, for signal or for timeout, and never again
+//     - periodic - timeout restarts after signal callback, and then keeps repeating
+//     - blocking - UnregisterUnlimitedWaitEx with INVALID_HANDLE_VALUE, from other thread, returns only after
+//                  the thread pool callback in progress finished, and nothing is called back after it
+//     - self     - callback unregisters its own registration, blocking, without waiting for itself,
+//                  both on thread pool and with WT_EXECUTEINWAITTHREAD
+//     - nested   - WT_EXECUTEINWAITTHREAD callback registers other wait, which is then called back
+//     - failed   - invalid handle, and object that can't be waited for, fail to register, with no handle,
+//                  memory or callback left behind
+
+#include <Windows.h>
+#include "sim.h"
+
+#include "../RegisterUnlimitedWait.h"
+#include "../WaitCompletionPacketPool.h"
+
+#include <cstdio>
+
+namespace {
+    struct Calls {
+        volatile LONG nSignalled;
+        volatile LONG nTimedOut;
+        ULONGLONG     tFirstTimedOut;
+    };
+
+    VOID NTAPI Count (PVOID context, BOOLEAN bTimedOut) {
+        Calls * calls = (Calls *) context;
+        if (bTimedOut) {
+            if (InterlockedIncrement (&calls->nTimedOut) == 1) {
+                calls->tFirstTimedOut = GetTickCount64 ();
+            }
+        } else {
+            InterlockedIncrement (&calls->nSignalled);
+        }
+    }
+
+    // Await
+    //  - polls until 'n' reaches 'expected', returns false if it doesn't within 'dwMilliseconds'
+    //
+    bool Await (volatile LONG & n, LONG expected, DWORD dwMilliseconds) {
+        ULONGLONG tStart = GetTickCount64 ();
+        while (n < expected) {
+            if (GetTickCount64 () - tStart > dwMilliseconds)
+                return false;
+
+            Sleep (1);
+        }
+        return true;
+    }
+
+    bool Once () {
+        Calls signalled = {};
+        Calls timedout = {};
+        HANDLE hEvent = CreateEvent (NULL, FALSE, FALSE, NULL);
+        HANDLE hQuiet = CreateEvent (NULL, FALSE, FALSE, NULL);
+        HANDLE hSignalled = NULL;
+        HANDLE hTimedOut = NULL;
+
+        bool result = RegisterUnlimitedWaitForSingleObject (&hSignalled, hEvent, Count, &signalled, 50, WT_EXECUTEONLYONCE)
+                   && RegisterUnlimitedWaitForSingleObject (&hTimedOut, hQuiet, Count, &timedout, 20, WT_EXECUTEONLYONCE);
+
+        // past both timeouts, the signalled one must not time out after its signal, then signal both again
+
+        SetEvent (hEvent);
+        Sleep (150);
+        SetEvent (hEvent);
+        SetEvent (hQuiet);
+        Sleep (100);
+
+        result = result && UnregisterUnlimitedWaitEx (hSignalled, INVALID_HANDLE_VALUE)
+                        && UnregisterUnlimitedWaitEx (hTimedOut, INVALID_HANDLE_VALUE);
+        CloseHandle (hEvent);
+        CloseHandle (hQuiet);
+
+        std::printf ("once: signalled %ld signals %ld timeouts, timed out %ld signals %ld timeouts\n",
+                     (long) signalled.nSignalled, (long) signalled.nTimedOut, (long) timedout.nSignalled, (long) timedout.nTimedOut);
+        return result && (signalled.nSignalled == 1) && (signalled.nTimedOut == 0)
+                      && (timedout.nSignalled == 0) && (timedout.nTimedOut == 1);
+    }
+
+    bool Periodic () {
+        Calls calls = {};
+        HANDLE hEvent = CreateEvent (NULL, FALSE, FALSE, NULL);
+        HANDLE hRegistration = NULL;
+
+        bool result = RegisterUnlimitedWaitForSingleObject (&hRegistration, hEvent, Count, &calls, 100, 0);
+
+        // signalled 60 ms in, without the restart the first timeout would follow 40 ms later
+
+        Sleep (60);
+        ULONGLONG tSignalled = GetTickCount64 ();
+        SetEvent (hEvent);
+
+        result = result && Await (calls.nSignalled, 1, 1000) && Await (calls.nTimedOut, 3, 1000);
+        ULONGLONG tRestarted = calls.tFirstTimedOut - tSignalled;
+
+        result = result && UnregisterUnlimitedWaitEx (hRegistration, INVALID_HANDLE_VALUE);
+        CloseHandle (hEvent);
+
+        std::printf ("periodic: first timeout %llu ms after signal, %ld timeouts\n", tRestarted, (long) calls.nTimedOut);
+        return result && (calls.nSignalled == 1) && (tRestarted >= 90);
+    }
+
+    struct Slow {
+        volatile LONG nStarted;
+        volatile LONG nFinished;
+    };
+
+    VOID NTAPI SlowCallback (PVOID context, BOOLEAN) {
+        Slow * slow = (Slow *) context;
+        InterlockedIncrement (&slow->nStarted);
+        Sleep (100);
+        InterlockedIncrement (&slow->nFinished);
+    }
+
+    bool Blocking () {
+        Slow slow = {};
+        HANDLE hEvent = CreateEvent (NULL, FALSE, FALSE, NULL);
+        HANDLE hRegistration = NULL;
+
+        bool result = RegisterUnlimitedWaitForSingleObject (&hRegistration, hEvent, SlowCallback, &slow, INFINITE, WT_EXECUTELONGFUNCTION);
+
+        SetEvent (hEvent);
+        result = result && Await (slow.nStarted, 1, 1000)
+                        && UnregisterUnlimitedWaitEx (hRegistration, INVALID_HANDLE_VALUE);
+        LONG nFinished = slow.nFinished;
+
+        SetEvent (hEvent);
+        Sleep (50);
+        CloseHandle (hEvent);
+
+        std::printf ("blocking: callback %s when unregistered, %ld calls\n", nFinished ? "finished" : "in progress", (long) slow.nStarted);
+        return result && (nFinished == 1) && (slow.nStarted == 1);
+    }
+
+    struct Self {
+        HANDLE        hRegistration;
+        BOOL          bUnregistered;
+        volatile LONG nCalls;
+    };
+
+    VOID NTAPI SelfCallback (PVOID context, BOOLEAN) {
+        Self * self = (Self *) context;
+        self->bUnregistered = UnregisterUnlimitedWaitEx (self->hRegistration, INVALID_HANDLE_VALUE);
+        InterlockedIncrement (&self->nCalls);
+    }
+
+    bool SelfUnregister (ULONG dwFlags) {
+        Self self = {};
+        HANDLE hEvent = CreateEvent (NULL, FALSE, FALSE, NULL);
+
+        bool result = RegisterUnlimitedWaitForSingleObject (&self.hRegistration, hEvent, SelfCallback, &self, INFINITE, dwFlags);
+
+        SetEvent (hEvent);
+        result = result && Await (self.nCalls, 1, 1000);
+
+        SetEvent (hEvent);
+        Sleep (50);
+        CloseHandle (hEvent);
+
+        std::printf ("self%s: unregistered %s, %ld calls\n", (dwFlags & WT_EXECUTEINWAITTHREAD) ? " in wait thread" : "",
+                     self.bUnregistered ? "ok" : "failed", (long) self.nCalls);
+        return result && self.bUnregistered && (self.nCalls == 1);
+    }
+
+    struct Nested {
+        HANDLE hEvent;
+        HANDLE hRegistration;
+        BOOL   bRegistered;
+        Calls  calls;
+    };
+
+    VOID NTAPI NestingCallback (PVOID context, BOOLEAN) {
+        Nested * nested = (Nested *) context;
+        if (!nested->hRegistration) {
+            nested->bRegistered = RegisterUnlimitedWaitForSingleObject (&nested->hRegistration, nested->hEvent, Count,
+                                                                         &nested->calls, INFINITE, 0);
+        }
+    }
+
+    bool Nesting () {
+        Nested nested = {};
+        nested.hEvent = CreateEvent (NULL, FALSE, FALSE, NULL);
+        HANDLE hEvent = CreateEvent (NULL, FALSE, FALSE, NULL);
+        HANDLE hRegistration = NULL;
+
+        bool result = RegisterUnlimitedWaitForSingleObject (&hRegistration, hEvent, NestingCallback, &nested, INFINITE, WT_EXECUTEINWAITTHREAD);
+
+        SetEvent (hEvent);
+        Sleep (50);
+        SetEvent (nested.hEvent);
+        result = result && Await (nested.calls.nSignalled, 1, 1000);
+
+        result = result && UnregisterUnlimitedWaitEx (hRegistration, INVALID_HANDLE_VALUE);
+        if (nested.hRegistration && !UnregisterUnlimitedWaitEx (nested.hRegistration, INVALID_HANDLE_VALUE)) {
+            result = false;
+        }
+        CloseHandle (nested.hEvent);
+        CloseHandle (hEvent);
+
+        std::printf ("nested: registered %s, %ld calls\n", nested.bRegistered ? "ok" : "failed", (long) nested.calls.nSignalled);
+        return result && nested.bRegistered && (nested.calls.nSignalled == 1);
+    }
+
+    bool Failed () {
+        Calls calls = {};
+        HANDLE hClosed = CreateEvent (NULL, FALSE, FALSE, NULL);
+        HANDLE hPacket = AcquireWaitCompletionPacket ();
+        HANDLE hInvalid = NULL;
+        HANDLE hUnsupported = NULL;
+        CloseHandle (hClosed);
+        Sleep (100);
+
+        SimKernelStatistics before;
+        SimKernelStatistics after;
+        SimGetKernelStatistics (&before);
+
+        BOOL bInvalid = RegisterUnlimitedWaitForSingleObject (&hInvalid, hClosed, Count, &calls, 10, 0);
+        DWORD dwInvalidError = GetLastError ();
+        BOOL bUnsupported = RegisterUnlimitedWaitForSingleObject (&hUnsupported, hPacket, Count, &calls, 10, 0);
+        DWORD dwUnsupportedError = GetLastError ();
+
+        SimGetKernelStatistics (&after);
+        ReleaseWaitCompletionPacket (hPacket);
+        Sleep (50);
+
+        std::printf ("failed: invalid handle error %u, unsupported object error %u, %lld handles, %lld heap blocks left, %ld calls\n",
+                     (unsigned) dwInvalidError, (unsigned) dwUnsupportedError,
+                     (LONGLONG) (after.nOpenHandles - before.nOpenHandles), (LONGLONG) (after.nHeapBlocks - before.nHeapBlocks),
+                     (long) (calls.nSignalled + calls.nTimedOut));
+        return !bInvalid && !hInvalid && (dwInvalidError == ERROR_INVALID_HANDLE)
+            && !bUnsupported && !hUnsupported && (dwUnsupportedError != ERROR_SUCCESS)
+            && (after.nOpenHandles == before.nOpenHandles) && (after.nHeapBlocks == before.nHeapBlocks)
+            && (calls.nSignalled + calls.nTimedOut == 0);
+    }
+}
+
+int main () {
+    bool result = Once ();
+    if (!Periodic ()) {
+        result = false;
+    }
+    if (!Blocking ()) {
+        result = false;
+    }
+    if (!SelfUnregister (0) || !SelfUnregister (WT_EXECUTEINWAITTHREAD)) {
+        result = false;
+    }
+    if (!Nesting ()) {
+        result = false;
+    }
+    if (!Failed ()) {
+        result = false;
+    }
+
+    std::printf ("\n%s\n", result ? "PASSED" : "FAILED");
+    return result ? 0 : 1;
+}
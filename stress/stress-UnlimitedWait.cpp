@@ -0,0 +1,980 @@
+// Stress harness for concurrent Add/Remove/Wait/Delete on UnlimitedWait
+//  - runs against the simulated kernel object layer in sim/, see Makefile
+//  - every worker thread performs random mix of operations on single shared UnlimitedWait:
+//     - wait  - WaitUnlimitedWaitEx, up to 16 notifications, with configurable timeout
+//     - set   - releases one unit of random semaphore
+//     - churn - removes random object (keeping signals enqueued) and adds it back
+//     - cycle - creates private UnlimitedWait, adds few events, signals, waits and deletes it
+//     - compact - compacts the shared UnlimitedWait, keeping few free slots
+//  - semaphores are used so that every released unit must be delivered exactly once:
+//    released == delivered + reclaimed (units drained from removed semaphores), per object
+//  - reports operations per second, latencies and SRW lock statistics for each thread count
+//  - before that, verifies that signal/wait loop in steady state does no heap operations
+//    and that signals of objects compacted or moved while signalled are reported exactly once, even when the objects
+//    are removed or moved again, that objects kept signalled, raced for by multiple threads, stay armed,
+//    that ShardedUnlimitedWait finds explicitly placed objects and serves shards without threads by stealing,
+//    and with -S that the adaptive spin is entered when signals arrive back to back
+//  - with -W the shared UnlimitedWait dispatches callbacks on worker pool (StartUnlimitedWaitWorkers)
+
+#include <Windows.h>
+#include "sim.h"
+
+#include "../UnlimitedWait.h"
+#include "../ShardedUnlimitedWait.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+    enum Operation {
+        OpWait = 0,
+        OpSet,
+        OpChurn,
+        OpCycle,
+        OpCompact,
+        OpCount
+    };
+    const char * const names [OpCount] = { "wait", "set", "churn", "cycle", "compact" };
+
+    struct Configuration {
+        std::vector <unsigned> threads = { 1, 2, 4, 8 };
+        unsigned nObjects = 1024;
+        unsigned dwDuration = 500;   // milliseconds for each thread count
+        unsigned dwWaitTimeout = 1;  // milliseconds
+        unsigned weights [OpCount] = { 40, 40, 15, 5, 1 };
+        unsigned nWorkers = 0;       // StartUnlimitedWaitWorkers, 0 for inline callbacks
+        unsigned dwSpin = 0;         // SetUnlimitedWaitSpin maximum in microseconds, 0 to block right away
+        unsigned dwBudget = 0;       // SetUnlimitedWaitBatchPolicy time budget in microseconds, 0 for fixed batches
+    } configuration;
+
+    struct Object {
+        HANDLE                  hSemaphore;
+        std::atomic <bool>      busy;      // being churned
+        std::atomic <ULONGLONG> released;  // units released by 'set'
+        std::atomic <ULONGLONG> delivered; // notifications retrieved
+        std::atomic <ULONGLONG> reclaimed; // units drained after removal
+    };
+
+    struct Counters {
+        ULONGLONG n [OpCount];
+        ULONGLONG ns [OpCount];
+        ULONGLONG nsMax [OpCount];
+        ULONGLONG nFailures;
+    };
+
+    UnlimitedWait *    wait = NULL;
+    Object *           objects = NULL;
+    std::atomic <bool> stop;
+
+    ULONGLONG Now () {
+        LARGE_INTEGER counter;
+        LARGE_INTEGER frequency;
+        QueryPerformanceCounter (&counter);
+        QueryPerformanceFrequency (&frequency);
+        return (ULONGLONG) (counter.QuadPart * (1000000000.0 / frequency.QuadPart));
+    }
+
+    ULONG Random (ULONG & state) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    LONG Drain (HANDLE hSemaphore) {
+        LONG n = 0;
+        while (WaitForSingleObject (hSemaphore, 0) == WAIT_OBJECT_0) {
+            ++n;
+        }
+        return n;
+    }
+
+    void Deliver (PVOID * contexts, ULONG n) {
+        for (ULONG i = 0; i != n; ++i) {
+            objects [(ULONG_PTR) contexts [i]].delivered.fetch_add (1, std::memory_order_relaxed);
+        }
+    }
+
+    // Release
+    //  - releases one unit of every object in [begin, end)
+    //
+    void Release (unsigned begin, unsigned end) {
+        for (unsigned i = begin; i != end; ++i) {
+            objects [i].released++;
+            ReleaseSemaphore (objects [i].hSemaphore, 1, NULL);
+        }
+    }
+
+    // Retrieve
+    //  - retrieves everything enqueued, returns false if any wait failed other than by timing out
+    //
+    bool Retrieve (UnlimitedWait * instance) {
+        PVOID contexts [64];
+        ULONG n;
+        while (WaitUnlimitedWaitEx (instance, contexts, NULL, 64, &n, 0, FALSE)) {
+            Deliver (contexts, n);
+        }
+        return GetLastError () == WAIT_TIMEOUT;
+    }
+
+    bool Wait (Counters &) {
+        PVOID contexts [16];
+        OVERLAPPED_ENTRY buffer [16];
+        ULONG n = 0;
+
+        if (WaitUnlimitedWaitEx (wait, contexts, buffer, 16, &n, configuration.dwWaitTimeout, FALSE)) {
+            Deliver (contexts, n);
+            return true;
+        }
+        return GetLastError () == WAIT_TIMEOUT;
+    }
+
+    bool Set (Counters &, ULONG & seed) {
+        Object & object = objects [Random (seed) % configuration.nObjects];
+
+        object.released.fetch_add (1, std::memory_order_relaxed);
+        return ReleaseSemaphore (object.hSemaphore, 1, NULL);
+    }
+
+    bool Churn (Counters &, ULONG & seed) {
+        ULONG i = Random (seed) % configuration.nObjects;
+        Object & object = objects [i];
+
+        if (object.busy.exchange (true))
+            return true;
+
+        bool result = false;
+        if (RemoveUnlimitedWaitObject (wait, object.hSemaphore, TRUE)) {
+            object.reclaimed.fetch_add (Drain (object.hSemaphore), std::memory_order_relaxed);
+
+            result = AddUnlimitedWaitObject (wait, object.hSemaphore, NULL, (PVOID) (ULONG_PTR) i, 0);
+        }
+        object.busy = false;
+        return result;
+    }
+
+    bool Cycle (Counters &) {
+        HANDLE events [4] = {};
+        bool result = false;
+
+        if (UnlimitedWait * local = CreateUnlimitedWait (NULL, 4, NULL, NULL)) {
+            result = true;
+            for (auto & hEvent : events) {
+                hEvent = CreateEvent (NULL, FALSE, FALSE, NULL);
+                if (!AddUnlimitedWaitObject (local, hEvent, NULL, NULL, UNLIMITED_WAIT_OBJECT_CLOSE_HANDLE)) {
+                    CloseHandle (hEvent);
+                    result = false;
+                }
+            }
+            SetEvent (events [0]);
+            SetEvent (events [2]);
+
+            PVOID contexts [4];
+            ULONG n;
+            WaitUnlimitedWaitEx (local, contexts, NULL, 4, &n, 0, FALSE);
+
+            if (!DeleteUnlimitedWait (local)) {
+                result = false;
+            }
+        }
+        return result;
+    }
+
+    bool Compact (Counters &) {
+        return CompactUnlimitedWait (wait, 16);
+    }
+
+    DWORD WINAPI Worker (LPVOID parameter) {
+        Counters & counters = *(Counters *) parameter;
+        ULONG seed = (ULONG) (ULONG_PTR) parameter | 1;
+
+        unsigned total = 0;
+        for (auto weight : configuration.weights) {
+            total += weight;
+        }
+
+        while (!stop.load (std::memory_order_relaxed)) {
+            unsigned pick = Random (seed) % total;
+            unsigned op = 0;
+            while (pick >= configuration.weights [op]) {
+                pick -= configuration.weights [op++];
+            }
+
+            ULONGLONG t0 = Now ();
+            bool result = false;
+            switch (op) {
+                case OpWait: result = Wait (counters); break;
+                case OpSet: result = Set (counters, seed); break;
+                case OpChurn: result = Churn (counters, seed); break;
+                case OpCycle: result = Cycle (counters); break;
+                case OpCompact: result = Compact (counters); break;
+            }
+            ULONGLONG t = Now () - t0;
+
+            counters.n [op]++;
+            counters.ns [op] += t;
+            if (t > counters.nsMax [op]) {
+                counters.nsMax [op] = t;
+            }
+            if (!result) {
+                counters.nFailures++;
+            }
+        }
+        return 0;
+    }
+
+    // Verify
+    //  - removes all objects, retrieves what's left and compares released and accounted units
+    //
+    void Verify (ULONGLONG & nLost, ULONGLONG & nDuplicated) {
+        for (unsigned i = 0; i != configuration.nObjects; ++i) {
+            if (RemoveUnlimitedWaitObject (wait, objects [i].hSemaphore, TRUE)) {
+                objects [i].reclaimed += Drain (objects [i].hSemaphore);
+            }
+        }
+
+        Retrieve (wait);
+
+        nLost = 0;
+        nDuplicated = 0;
+        for (unsigned i = 0; i != configuration.nObjects; ++i) {
+            ULONGLONG released = objects [i].released;
+            ULONGLONG accounted = objects [i].delivered + objects [i].reclaimed;
+
+            if (accounted < released) {
+                nLost += released - accounted;
+            }
+            if (accounted > released) {
+                nDuplicated += accounted - released;
+            }
+        }
+    }
+
+    bool Setup () {
+        wait = CreateUnlimitedWait (NULL, configuration.nObjects, NULL, NULL);
+        if (!wait) {
+            std::printf ("CreateUnlimitedWait failed, error %u\n", (unsigned) GetLastError ());
+            return false;
+        }
+
+        objects = new Object [configuration.nObjects];
+        for (unsigned i = 0; i != configuration.nObjects; ++i) {
+            objects [i].hSemaphore = CreateSemaphore (NULL, 0, MAXLONG, NULL);
+            objects [i].busy = false;
+            objects [i].released = 0;
+            objects [i].delivered = 0;
+            objects [i].reclaimed = 0;
+
+            if (!AddUnlimitedWaitObject (wait, objects [i].hSemaphore, NULL, (PVOID) (ULONG_PTR) i, 0)) {
+                std::printf ("AddUnlimitedWaitObject failed, error %u\n", (unsigned) GetLastError ());
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void Cleanup () {
+        for (unsigned i = 0; i != configuration.nObjects; ++i) {
+            CloseHandle (objects [i].hSemaphore);
+        }
+        DeleteUnlimitedWait (wait);
+        delete [] objects;
+    }
+
+    // Run
+    //  - single measurement for 'nThreads', returns false on lost or duplicated signals
+    //
+    bool Run (unsigned nThreads, double (&baseline) [OpCount]) {
+        if (!Setup ())
+            return false;
+
+        if (configuration.dwSpin) {
+            SetUnlimitedWaitSpin (wait, configuration.dwSpin);
+        }
+        if (configuration.dwBudget) {
+            SetUnlimitedWaitBatchPolicy (wait, configuration.dwBudget);
+        }
+        if (configuration.nWorkers) {
+            if (!StartUnlimitedWaitWorkers (wait, configuration.nWorkers, 1024)) {
+                std::printf ("StartUnlimitedWaitWorkers failed, error %u\n", (unsigned) GetLastError ());
+                Cleanup ();
+                return false;
+            }
+        }
+
+        std::vector <Counters> counters (nThreads);
+        std::vector <HANDLE> threads;
+
+        std::memset (counters.data (), 0, nThreads * sizeof (Counters));
+        stop = false;
+        SimResetStatistics ();
+
+        for (unsigned i = 0; i != nThreads; ++i) {
+            threads.push_back (CreateThread (NULL, 0, Worker, &counters [i], 0, NULL));
+        }
+        Sleep (configuration.dwDuration);
+        stop = true;
+
+        for (auto hThread : threads) {
+            WaitForSingleObject (hThread, INFINITE);
+            CloseHandle (hThread);
+        }
+
+        SimLockStatistics locks;
+        SimKernelStatistics kernel;
+        SimGetLockStatistics (&locks);
+        SimGetKernelStatistics (&kernel);
+
+        UNLIMITED_WAIT_STATISTICS statistics;
+        GetUnlimitedWaitStatistics (wait, &statistics);
+
+        ULONGLONG nLost;
+        ULONGLONG nDuplicated;
+        Verify (nLost, nDuplicated);
+        Cleanup ();
+
+        Counters sum = {};
+        for (auto & c : counters) {
+            for (unsigned op = 0; op != OpCount; ++op) {
+                sum.n [op] += c.n [op];
+                sum.ns [op] += c.ns [op];
+                if (c.nsMax [op] > sum.nsMax [op]) {
+                    sum.nsMax [op] = c.nsMax [op];
+                }
+            }
+            sum.nFailures += c.nFailures;
+        }
+
+        std::printf ("\n%u thread(s), %u ms\n", nThreads, configuration.dwDuration);
+        std::printf ("  %-6s %12s %10s %12s %12s %8s\n", "op", "count", "ops/s", "avg us", "max us", "scaling");
+        for (unsigned op = 0; op != OpCount; ++op) {
+            double rate = sum.n [op] * 1000.0 / configuration.dwDuration;
+            if (baseline [op] == 0.0) {
+                baseline [op] = rate;
+            }
+            std::printf ("  %-6s %12llu %10.0f %12.2f %12.2f %7.2fx\n", names [op], sum.n [op], rate,
+                         sum.n [op] ? sum.ns [op] / 1000.0 / sum.n [op] : 0.0, sum.nsMax [op] / 1000.0,
+                         baseline [op] ? rate / baseline [op] : 0.0);
+        }
+
+        std::printf ("  lock: %llu exclusive, %llu shared, %.1f%% contended\n",
+                     locks.nExclusiveAcquisitions, locks.nSharedAcquisitions,
+                     100.0 * locks.nContendedAcquisitions / ((locks.nExclusiveAcquisitions + locks.nSharedAcquisitions) | 1));
+        std::printf ("        exclusive wait avg %.2f us max %.2f us, hold avg %.2f us\n",
+                     locks.nsExclusiveWait / 1000.0 / (locks.nExclusiveAcquisitions | 1), locks.nsMaxExclusiveWait / 1000.0,
+                     locks.nsExclusiveHold / 1000.0 / (locks.nExclusiveAcquisitions | 1));
+        std::printf ("        shared wait avg %.2f us max %.2f us, hold avg %.2f us\n",
+                     locks.nsSharedWait / 1000.0 / (locks.nSharedAcquisitions | 1), locks.nsMaxSharedWait / 1000.0,
+                     locks.nsSharedHold / 1000.0 / (locks.nSharedAcquisitions | 1));
+        std::printf ("  kernel: %llu syscalls, %llu associations, %llu cancellations, %llu packets created, %llu heap ops\n",
+                     kernel.nSystemCalls, kernel.nAssociations, kernel.nCancellations, kernel.nWaitPacketsCreated, kernel.nHeapOperations);
+        std::printf ("  signals: %llu delivered inline, %llu lost, %llu duplicated, %llu failed operations\n",
+                     statistics.nInlineDeliveries, nLost, nDuplicated, sum.nFailures);
+        if (configuration.dwSpin) {
+            std::printf ("  spin: %llu hits, %llu misses\n", statistics.nSpinHits, statistics.nSpinMisses);
+        }
+        if (configuration.dwBudget) {
+            std::printf ("  batches: %llu signals carried over, batch size %u\n", statistics.nCarriedOver, (unsigned) statistics.nBatchSize);
+        }
+
+        return (nLost == 0) && (nDuplicated == 0) && (sum.nFailures == 0);
+    }
+
+    // SteadyState
+    //  - signals and retrieves objects, without temporary buffer, and checks nothing touched the heap
+    //    after the first round has warmed up the scratch buffers
+    //  - two units are released at once, a few objects at a time, so that the second unit is found by the re-arming
+    //    association while there's room in the batch, and must be delivered inline
+    //
+    bool SteadyState () {
+        if (!Setup ())
+            return false;
+
+        UNLIMITED_WAIT_STATISTICS before;
+        UNLIMITED_WAIT_STATISTICS after;
+        SimKernelStatistics kernel;
+        ULONGLONG nProcessHeapOperations = 0;
+
+        for (unsigned round = 0; round != 2; ++round) {
+            GetUnlimitedWaitStatistics (wait, &before);
+            SimResetStatistics ();
+
+            for (unsigned i = 0; i != configuration.nObjects; ++i) {
+                ReleaseSemaphore (objects [i].hSemaphore, 2, NULL);
+
+                if ((i % 8 == 7) || (i + 1 == configuration.nObjects)) {
+                    PVOID contexts [16];
+                    ULONG n;
+                    while (WaitUnlimitedWaitEx (wait, contexts, NULL, 16, &n, 0, FALSE)) {
+                        Deliver (contexts, n);
+                    }
+                }
+            }
+
+            GetUnlimitedWaitStatistics (wait, &after);
+            SimGetKernelStatistics (&kernel);
+            nProcessHeapOperations = kernel.nHeapOperations;
+        }
+
+        ULONGLONG nDelivered = 0;
+        for (unsigned i = 0; i != configuration.nObjects; ++i) {
+            nDelivered += objects [i].delivered;
+        }
+        Cleanup ();
+
+        std::printf ("\nsteady state: %llu signals delivered, %llu inline, %llu instance heap operations, %llu process heap operations\n",
+                     nDelivered, after.nInlineDeliveries - before.nInlineDeliveries,
+                     after.nHeapOperations - before.nHeapOperations, nProcessHeapOperations);
+
+        return (nDelivered == 4 * configuration.nObjects)
+            && (after.nInlineDeliveries != before.nInlineDeliveries)
+            && (after.nHeapOperations == before.nHeapOperations)
+            && (nProcessHeapOperations == 0);
+    }
+
+    // CompactPending
+    //  - compacts while the moved objects have signals enqueued, so those are posted again with new slot index,
+    //    then removes the moved objects and reuses their slots for others before anything is retrieved
+    //  - the re-posted signals must be reported once, for the removed objects, and must not re-arm the reused slots
+    //
+    bool CompactPending () {
+        if (!Setup ())
+            return false;
+
+        bool result = true;
+        unsigned half = configuration.nObjects / 2;
+
+        for (unsigned i = 0; i != half; ++i) {
+            if (!RemoveUnlimitedWaitObject (wait, objects [i].hSemaphore, FALSE)) {
+                result = false;
+            }
+        }
+        Release (half, configuration.nObjects);
+
+        if (!CompactUnlimitedWait (wait, 0)) {
+            result = false;
+        }
+        for (unsigned i = half; i != configuration.nObjects; ++i) {
+            if (RemoveUnlimitedWaitObject (wait, objects [i].hSemaphore, TRUE)) {
+                objects [i].reclaimed += Drain (objects [i].hSemaphore);
+            } else {
+                result = false;
+            }
+        }
+        for (unsigned i = 0; i != half; ++i) {
+            if (!AddUnlimitedWaitObject (wait, objects [i].hSemaphore, NULL, (PVOID) (ULONG_PTR) i, 0)) {
+                result = false;
+            }
+        }
+        Release (0, half);
+
+        if (!Retrieve (wait)) {
+            result = false;
+        }
+
+        ULONGLONG nLost;
+        ULONGLONG nDuplicated;
+        Verify (nLost, nDuplicated);
+        Cleanup ();
+
+        std::printf ("compact pending: %llu lost, %llu duplicated, %s\n", nLost, nDuplicated, result ? "no errors" : "errors");
+        return result && (nLost == 0) && (nDuplicated == 0);
+    }
+
+    // MovePending
+    //  - moves signalled objects to another UnlimitedWait, so their signals are posted there again, and before
+    //    those are retrieved: removes the first quarter (and adds it back), moves the second quarter again,
+    //    and compacts the destination with the third quarter in it
+    //  - moving again must fail with ERROR_BUSY until the destination retrieves the signal, then succeed
+    //
+    bool MovePending () {
+        if (!Setup ())
+            return false;
+
+        UnlimitedWait * other = CreateUnlimitedWait (NULL, 0, NULL, NULL);
+        if (!other) {
+            Cleanup ();
+            return false;
+        }
+
+        bool result = true;
+        unsigned quarter = configuration.nObjects / 4;
+
+        Release (0, configuration.nObjects);
+
+        for (unsigned i = 0; i != 3 * quarter; ++i) {
+            if (!MoveUnlimitedWaitObject (wait, other, objects [i].hSemaphore)) {
+                result = false;
+            }
+        }
+
+        // move -> remove
+
+        for (unsigned i = 0; i != quarter; ++i) {
+            if (RemoveUnlimitedWaitObject (other, objects [i].hSemaphore, TRUE)) {
+                objects [i].reclaimed += Drain (objects [i].hSemaphore);
+            } else {
+                result = false;
+            }
+            if (!AddUnlimitedWaitObject (other, objects [i].hSemaphore, NULL, (PVOID) (ULONG_PTR) i, 0)) {
+                result = false;
+            }
+        }
+        Release (0, quarter);
+
+        // move -> move
+
+        for (unsigned i = quarter; i != 2 * quarter; ++i) {
+            if (MoveUnlimitedWaitObject (other, wait, objects [i].hSemaphore) || (GetLastError () != ERROR_BUSY)) {
+                result = false;
+            }
+        }
+
+        // move -> compact
+
+        if (!CompactUnlimitedWait (other, 0)) {
+            result = false;
+        }
+
+        if (!Retrieve (other) || !Retrieve (wait)) {
+            result = false;
+        }
+        for (unsigned i = quarter; i != 2 * quarter; ++i) {
+            if (!MoveUnlimitedWaitObject (other, wait, objects [i].hSemaphore)) {
+                result = false;
+            }
+        }
+        Release (0, configuration.nObjects);
+
+        if (!Retrieve (other)) {
+            result = false;
+        }
+        for (unsigned i = 0; i != configuration.nObjects; ++i) {
+            if (RemoveUnlimitedWaitObject (other, objects [i].hSemaphore, TRUE)) {
+                objects [i].reclaimed += Drain (objects [i].hSemaphore);
+            }
+        }
+        if (!Retrieve (other) || !DeleteUnlimitedWait (other)) {
+            result = false;
+        }
+
+        ULONGLONG nLost;
+        ULONGLONG nDuplicated;
+        Verify (nLost, nDuplicated);
+        Cleanup ();
+
+        std::printf ("move pending: %llu lost, %llu duplicated, %s\n", nLost, nDuplicated, result ? "no errors" : "errors");
+        return result && (nLost == 0) && (nDuplicated == 0);
+    }
+
+    // SpinArrivals
+    //  - with -S, signals are released right before each wait, so the adaptive spin must be entered and poll them,
+    //    already for the first one, i.e. SetUnlimitedWaitSpin must not start with the window closed
+    //  - spinning is disabled on single processor, there's nothing to check then
+    //
+    bool SpinArrivals () {
+        if (GetActiveProcessorCount (ALL_PROCESSOR_GROUPS) < 2) {
+            std::printf ("spin arrivals: single processor, spinning disabled\n");
+            return true;
+        }
+        if (!Setup ())
+            return false;
+
+        bool result = SetUnlimitedWaitSpin (wait, configuration.dwSpin);
+        bool first = false;
+
+        UNLIMITED_WAIT_STATISTICS statistics;
+
+        for (unsigned i = 0; i != configuration.nObjects; ++i) {
+            Release (i, i + 1);
+
+            PVOID contexts [16];
+            ULONG n;
+            if (WaitUnlimitedWaitEx (wait, contexts, NULL, 16, &n, configuration.dwWaitTimeout, FALSE)) {
+                Deliver (contexts, n);
+            } else
+            if (GetLastError () != WAIT_TIMEOUT) {
+                result = false;
+            }
+            if (i == 0) {
+                GetUnlimitedWaitStatistics (wait, &statistics);
+                first = (statistics.nSpinHits + statistics.nSpinMisses != 0);
+            }
+        }
+        if (!Retrieve (wait)) {
+            result = false;
+        }
+        GetUnlimitedWaitStatistics (wait, &statistics);
+
+        ULONGLONG nLost;
+        ULONGLONG nDuplicated;
+        Verify (nLost, nDuplicated);
+        Cleanup ();
+
+        std::printf ("spin arrivals: %llu hits, %llu misses, first arrival %s, %llu lost, %llu duplicated, %s\n",
+                     statistics.nSpinHits, statistics.nSpinMisses, first ? "spun" : "not spun",
+                     nLost, nDuplicated, result ? "no errors" : "errors");
+        return result && first && (nLost == 0) && (nDuplicated == 0);
+    }
+
+    // AlwaysSignalled
+    //  - few semaphores kept signalled, every delivered unit is released back right away, waited on by as many
+    //    threads as the largest -t count; re-arming associations keep finding the objects signalled, the completion
+    //    is raced for by other threads, and those re-arm the same slots again
+    //  - afterwards every object must still be delivered, object whose association was lost never is again
+    //
+    struct AlwaysSignalledThread {
+        UnlimitedWait * instance;
+        HANDLE *        semaphores;
+        bool            result;
+    };
+
+    ULONG DeliverAndRelease (UnlimitedWait * instance, HANDLE * semaphores, ULONGLONG * delivered, DWORD dwMilliseconds, bool & result) {
+        PVOID contexts [16];
+        ULONG n = 0;
+        if (WaitUnlimitedWaitEx (instance, contexts, NULL, 16, &n, dwMilliseconds, FALSE)) {
+            for (ULONG i = 0; i != n; ++i) {
+                if (delivered) {
+                    delivered [(ULONG_PTR) contexts [i]]++;
+                }
+                ReleaseSemaphore (semaphores [(ULONG_PTR) contexts [i]], 1, NULL);
+            }
+        } else
+        if (GetLastError () != WAIT_TIMEOUT) {
+            result = false;
+        }
+        return n;
+    }
+
+    DWORD WINAPI AlwaysSignalledWorker (LPVOID parameter) {
+        AlwaysSignalledThread & thread = *(AlwaysSignalledThread *) parameter;
+        while (!stop.load (std::memory_order_relaxed)) {
+            DeliverAndRelease (thread.instance, thread.semaphores, NULL, configuration.dwWaitTimeout, thread.result);
+        }
+        return 0;
+    }
+
+    bool AlwaysSignalled () {
+        const unsigned nObjects = 8;
+        unsigned nThreads = 1;
+        for (auto n : configuration.threads) {
+            if (n > nThreads) {
+                nThreads = n;
+            }
+        }
+
+        UnlimitedWait * instance = CreateUnlimitedWait (NULL, nObjects, NULL, NULL);
+        if (!instance)
+            return false;
+
+        bool result = true;
+        HANDLE semaphores [nObjects];
+
+        for (unsigned i = 0; i != nObjects; ++i) {
+            semaphores [i] = CreateSemaphore (NULL, 2, MAXLONG, NULL);
+            if (!AddUnlimitedWaitObject (instance, semaphores [i], NULL, (PVOID) (ULONG_PTR) i, 0)) {
+                result = false;
+            }
+        }
+
+        std::vector <AlwaysSignalledThread> parameters (nThreads, AlwaysSignalledThread { instance, semaphores, true });
+        std::vector <HANDLE> threads;
+
+        stop = false;
+        for (unsigned i = 0; i != nThreads; ++i) {
+            threads.push_back (CreateThread (NULL, 0, AlwaysSignalledWorker, &parameters [i], 0, NULL));
+        }
+        Sleep (configuration.dwDuration);
+        stop = true;
+
+        for (unsigned i = 0; i != nThreads; ++i) {
+            WaitForSingleObject (threads [i], INFINITE);
+            CloseHandle (threads [i]);
+            if (!parameters [i].result) {
+                result = false;
+            }
+        }
+
+        // every object has units left, so few rounds must deliver each of them again
+
+        ULONGLONG delivered [nObjects] = {};
+        for (unsigned round = 0; round != 4 * nObjects; ++round) {
+            DeliverAndRelease (instance, semaphores, delivered, 10, result);
+        }
+
+        unsigned nLost = 0;
+        for (unsigned i = 0; i != nObjects; ++i) {
+            if (!delivered [i]) {
+                ++nLost;
+            }
+        }
+        if (!DeleteUnlimitedWait (instance)) {
+            result = false;
+        }
+        for (auto hSemaphore : semaphores) {
+            CloseHandle (hSemaphore);
+        }
+
+        std::printf ("always signalled: %u threads, %u objects lost, %s\n", nThreads, nLost, result ? "no errors" : "errors");
+        return result && (nLost == 0);
+    }
+
+    // Sharded
+    //  - objects spread over 4 shards, about every 8th one, picked at random, placed explicitly to shard given by its
+    //    index, the rest by hash; handles created in a row never collide in the placement table, the random pick does
+    //  - every other placed object is removed and added back to the next shard, the entries that followed them
+    //    in the table must be shifted back into the holes, so that all objects are then removed from the right shard
+    //  - meanwhile 2 threads wait while the objects are released, so 2 shards have no thread and are served only by
+    //    stealing; every unit must be delivered exactly once, and some of those shards' units before the final drain
+    //
+    struct ShardedThread {
+        ShardedUnlimitedWait * instance;
+        bool                   result;
+    };
+
+    DWORD WINAPI ShardedWorker (LPVOID parameter) {
+        ShardedThread & thread = *(ShardedThread *) parameter;
+        while (!stop.load (std::memory_order_relaxed)) {
+            PVOID contexts [16];
+            ULONG n;
+            if (WaitShardedUnlimitedWaitEx (thread.instance, contexts, NULL, 16, &n, configuration.dwWaitTimeout, FALSE)) {
+                Deliver (contexts, n);
+            } else
+            if (GetLastError () != WAIT_TIMEOUT) {
+                thread.result = false;
+            }
+        }
+        return 0;
+    }
+
+    bool Sharded () {
+        const DWORD nShards = 4;
+        const unsigned nThreads = 2;
+
+        ShardedUnlimitedWait * instance = CreateShardedUnlimitedWait (NULL, configuration.nObjects, nShards, NULL, NULL, 0);
+        if (!instance)
+            return false;
+
+        bool result = true;
+        std::vector <unsigned> placed;
+        ULONG seed = 0x9E3779B9;
+
+        objects = new Object [configuration.nObjects];
+        for (unsigned i = 0; i != configuration.nObjects; ++i) {
+            objects [i].hSemaphore = CreateSemaphore (NULL, 0, MAXLONG, NULL);
+            objects [i].busy = false;
+            objects [i].released = 0;
+            objects [i].delivered = 0;
+            objects [i].reclaimed = 0;
+
+            DWORD dwFlags = 0;
+            if (Random (seed) % 8 == 0) {
+                dwFlags = SHARDED_UNLIMITED_WAIT_OBJECT_SHARD (i % nShards);
+                placed.push_back (i);
+            }
+            if (!AddShardedUnlimitedWaitObject (instance, objects [i].hSemaphore, NULL, (PVOID) (ULONG_PTR) i, dwFlags)) {
+                result = false;
+            }
+        }
+
+        std::vector <ShardedThread> parameters (nThreads, ShardedThread { instance, true });
+        std::vector <HANDLE> threads;
+
+        stop = false;
+        for (unsigned i = 0; i != nThreads; ++i) {
+            threads.push_back (CreateThread (NULL, 0, ShardedWorker, &parameters [i], 0, NULL));
+        }
+
+        for (unsigned k = 0; k < placed.size (); k += 2) {
+            unsigned i = placed [k];
+            if (RemoveShardedUnlimitedWaitObject (instance, objects [i].hSemaphore, TRUE)) {
+                objects [i].reclaimed += Drain (objects [i].hSemaphore);
+            } else {
+                result = false;
+            }
+        }
+
+        ULONGLONG tStart = GetTickCount64 ();
+        while (GetTickCount64 () - tStart < configuration.dwDuration) {
+            unsigned i = Random (seed) % configuration.nObjects;
+            Release (i, i + 1);
+        }
+
+        for (unsigned k = 0; k < placed.size (); k += 2) {
+            unsigned i = placed [k];
+            if (!AddShardedUnlimitedWaitObject (instance, objects [i].hSemaphore, NULL, (PVOID) (ULONG_PTR) i,
+                                                SHARDED_UNLIMITED_WAIT_OBJECT_SHARD ((i + 1) % nShards))) {
+                result = false;
+            }
+            Release (i, i + 1);
+        }
+        Sleep (50);
+        stop = true;
+
+        for (unsigned i = 0; i != nThreads; ++i) {
+            WaitForSingleObject (threads [i], INFINITE);
+            CloseHandle (threads [i]);
+            if (!parameters [i].result) {
+                result = false;
+            }
+        }
+
+        // waiting threads were bound to shards 0 and 1, objects placed to 2 and 3 were delivered by stealing only
+
+        ULONGLONG nStolen = 0;
+        for (unsigned k = 1; k < placed.size (); k += 2) {
+            if (placed [k] % nShards >= nThreads) {
+                nStolen += objects [placed [k]].delivered;
+            }
+        }
+
+        for (unsigned i = 0; i != configuration.nObjects; ++i) {
+            if (RemoveShardedUnlimitedWaitObject (instance, objects [i].hSemaphore, TRUE)) {
+                objects [i].reclaimed += Drain (objects [i].hSemaphore);
+            } else {
+                result = false;
+            }
+        }
+
+        PVOID contexts [64];
+        ULONG n;
+        while (WaitShardedUnlimitedWaitEx (instance, contexts, NULL, 64, &n, 0, FALSE)) {
+            Deliver (contexts, n);
+        }
+        if (GetLastError () != WAIT_TIMEOUT) {
+            result = false;
+        }
+        if (!DeleteShardedUnlimitedWait (instance)) {
+            result = false;
+        }
+
+        ULONGLONG nLost = 0;
+        ULONGLONG nDuplicated = 0;
+        for (unsigned i = 0; i != configuration.nObjects; ++i) {
+            ULONGLONG released = objects [i].released;
+            ULONGLONG accounted = objects [i].delivered + objects [i].reclaimed;
+
+            if (accounted < released) {
+                nLost += released - accounted;
+            }
+            if (accounted > released) {
+                nDuplicated += accounted - released;
+            }
+            CloseHandle (objects [i].hSemaphore);
+        }
+        delete [] objects;
+
+        std::printf ("sharded: %u threads on %u shards, %u placed, %llu stolen, %llu lost, %llu duplicated, %s\n",
+                     nThreads, (unsigned) nShards, (unsigned) placed.size (), nStolen, nLost, nDuplicated, result ? "no errors" : "errors");
+        return result && nStolen && (nLost == 0) && (nDuplicated == 0);
+    }
+
+    void Usage () {
+        std::printf ("usage: stress-UnlimitedWait [-t threads,...] [-n objects] [-d milliseconds] [-w wait-timeout]\n"
+                     "                            [-m wait:set:churn:cycle:compact] [-W workers] [-S microseconds]\n"
+                     "                            [-B microseconds]\n"
+                     "  -t  comma-separated thread counts to measure, default 1,2,4,8\n"
+                     "  -n  number of semaphores in the shared UnlimitedWait, default 1024\n"
+                     "  -d  duration of each measurement, default 500 ms\n"
+                     "  -w  WaitUnlimitedWaitEx timeout, default 1 ms\n"
+                     "  -m  relative weights of operations, default 40:40:15:5:1\n"
+                     "  -W  number of callback worker threads, default 0 (callbacks run in waiting threads)\n"
+                     "  -S  maximum adaptive spin before blocking wait, default 0 (no spinning)\n"
+                     "  -B  time budget for callbacks of single wait, default 0 (fixed batch size)\n");
+    }
+
+    bool Parse (int argc, char ** argv) {
+        for (int i = 1; i < argc; ++i) {
+            if ((argv [i][0] != '-') || (i + 1 == argc)) {
+                return false;
+            }
+            char * value = argv [++i];
+            switch (argv [i - 1][1]) {
+                case 't':
+                    configuration.threads.clear ();
+                    for (char * p = std::strtok (value, ","); p; p = std::strtok (NULL, ",")) {
+                        if (unsigned n = std::strtoul (p, NULL, 0)) {
+                            configuration.threads.push_back (n);
+                        }
+                    }
+                    break;
+                case 'n':
+                    configuration.nObjects = std::strtoul (value, NULL, 0);
+                    break;
+                case 'd':
+                    configuration.dwDuration = std::strtoul (value, NULL, 0);
+                    break;
+                case 'w':
+                    configuration.dwWaitTimeout = std::strtoul (value, NULL, 0);
+                    break;
+                case 'W':
+                    configuration.nWorkers = std::strtoul (value, NULL, 0);
+                    break;
+                case 'S':
+                    configuration.dwSpin = std::strtoul (value, NULL, 0);
+                    break;
+                case 'B':
+                    configuration.dwBudget = std::strtoul (value, NULL, 0);
+                    break;
+                case 'm':
+                    for (unsigned op = 0; op != OpCount; ++op) {
+                        configuration.weights [op] = std::strtoul (value, &value, 0);
+                        if (*value == ':') {
+                            ++value;
+                        }
+                    }
+                    break;
+                default:
+                    return false;
+            }
+        }
+
+        unsigned total = 0;
+        for (auto weight : configuration.weights) {
+            total += weight;
+        }
+        return total && configuration.nObjects && configuration.dwDuration && !configuration.threads.empty ();
+    }
+}
+
+int main (int argc, char ** argv) {
+    if (!Parse (argc, argv)) {
+        Usage ();
+        return 2;
+    }
+
+    std::printf ("stress-UnlimitedWait: %u objects, mix wait:set:churn:cycle:compact = %u:%u:%u:%u:%u, wait timeout %u ms, %u workers, %u us spin, %u us budget\n",
+                 configuration.nObjects, configuration.weights [OpWait], configuration.weights [OpSet],
+                 configuration.weights [OpChurn], configuration.weights [OpCycle], configuration.weights [OpCompact],
+                 configuration.dwWaitTimeout, configuration.nWorkers, configuration.dwSpin, configuration.dwBudget);
+
+    bool result = SteadyState ();
+    if (!CompactPending ()) {
+        result = false;
+    }
+    if (!MovePending ()) {
+        result = false;
+    }
+    if (!AlwaysSignalled ()) {
+        result = false;
+    }
+    if (!Sharded ()) {
+        result = false;
+    }
+    if (configuration.dwSpin && !SpinArrivals ()) {
+        result = false;
+    }
+    double baseline [OpCount] = {};
+
+    for (auto nThreads : configuration.threads) {
+        if (!Run (nThreads, baseline)) {
+            result = false;
+        }
+    }
+
+    std::printf ("\n%s\n", result ? "PASSED" : "FAILED");
+    return result ? 0 : 1;
+}
@@ -1,15 +1,11 @@
 #pragma warning (disable:4005) // macro redefinition
 
 #include "win32-iocp-events.h"
+#include "WaitCompletionPacketPool.h"
 #include <Winternl.h>
 #include <ntstatus.h>
 
 extern "C" {
-    WINBASEAPI NTSTATUS WINAPI NtCreateWaitCompletionPacket (
-        _Out_ PHANDLE WaitCompletionPacketHandle,
-        _In_ ACCESS_MASK DesiredAccess,
-        _In_opt_ POBJECT_ATTRIBUTES ObjectAttributes
-    );
     WINBASEAPI NTSTATUS WINAPI NtAssociateWaitCompletionPacket (
         _In_ HANDLE WaitCompletionPacketHandle,
         _In_ HANDLE IoCompletionHandle,
@@ -26,13 +22,44 @@ extern "C" {
     );
 }
 
+namespace {
+
+    // TranslateStatus
+    //  - maps NtAssociateWaitCompletionPacket failure to Win32 error code
+    //
+    DWORD TranslateStatus (HRESULT hr, HANDLE hEvent) {
+        switch (hr) {
+            case STATUS_NO_MEMORY:
+                return ERROR_OUTOFMEMORY;
+            case STATUS_INVALID_HANDLE: // not valid handle passed for hIOCP
+            case STATUS_OBJECT_TYPE_MISMATCH: // incorrect handle passed for hIOCP
+            case STATUS_INVALID_PARAMETER_1:
+            case STATUS_INVALID_PARAMETER_2:
+                return ERROR_INVALID_PARAMETER;
+            case STATUS_INVALID_PARAMETER_3:
+                if (hEvent) {
+                    return ERROR_INVALID_HANDLE;
+                } else {
+                    return ERROR_INVALID_PARAMETER;
+                }
+            default:
+                return hr;
+        }
+    }
+
+    HRESULT Associate (HANDLE hPacket, HANDLE hIOCP, HANDLE hEvent, const OVERLAPPED_ENTRY * completion) {
+        return NtAssociateWaitCompletionPacket (hPacket, hIOCP, hEvent,
+                                                (PVOID) completion->lpCompletionKey,
+                                                (PVOID) completion->lpOverlapped, 0,
+                                                completion->dwNumberOfBytesTransferred, NULL);
+    }
+}
+
 _Ret_maybenull_
 HANDLE WINAPI ReportEventAsCompletion (_In_ HANDLE hIOCP, _In_ HANDLE hEvent,
                                        _In_opt_ DWORD dwNumberOfBytesTransferred, _In_opt_ ULONG_PTR dwCompletionKey, _In_opt_ LPOVERLAPPED lpOverlapped) {
-    HANDLE hPacket = NULL;
-    HRESULT hr = NtCreateWaitCompletionPacket (&hPacket, GENERIC_ALL, NULL);
-
-    if (SUCCEEDED (hr)) {
+    HANDLE hPacket = AcquireWaitCompletionPacket ();
+    if (hPacket) {
 
         OVERLAPPED_ENTRY completion {};
         completion.dwNumberOfBytesTransferred = dwNumberOfBytesTransferred;
@@ -40,16 +67,12 @@ HANDLE WINAPI ReportEventAsCompletion (_In_ HANDLE hIOCP, _In_ HANDLE hEvent,
         completion.lpOverlapped = lpOverlapped;
 
         if (!RestartEventCompletion (hPacket, hIOCP, hEvent, &completion)) {
-            NtClose (hPacket);
+            ReleaseWaitCompletionPacket (hPacket);
             hPacket = NULL;
         }
     } else {
-        switch (hr) {
-            case STATUS_NO_MEMORY:
-                SetLastError (ERROR_OUTOFMEMORY);
-                break;
-            default:
-                SetLastError (hr);
+        if (GetLastError () == ERROR_NOT_ENOUGH_MEMORY) {
+            SetLastError (ERROR_OUTOFMEMORY);
         }
     }
     return hPacket;
@@ -61,38 +84,95 @@ BOOL WINAPI RestartEventCompletion (_In_ HANDLE hPacket, _In_ HANDLE hIOCP, _In_
         return FALSE;
     }
 
-    HRESULT hr = NtAssociateWaitCompletionPacket (hPacket, hIOCP, hEvent,
-                                                  (PVOID) completion->lpCompletionKey,
-                                                  (PVOID) completion->lpOverlapped, 0,
-                                                  completion->dwNumberOfBytesTransferred, NULL);
+    HRESULT hr = Associate (hPacket, hIOCP, hEvent, completion);
     if (SUCCEEDED (hr)) {
         return TRUE;
 
     } else {
-        switch (hr) {
-            case STATUS_NO_MEMORY:
-                SetLastError (ERROR_OUTOFMEMORY);
-                break;
-            case STATUS_INVALID_HANDLE: // not valid handle passed for hIOCP
-            case STATUS_OBJECT_TYPE_MISMATCH: // incorrect handle passed for hIOCP
-            case STATUS_INVALID_PARAMETER_1:
-            case STATUS_INVALID_PARAMETER_2:
-                SetLastError (ERROR_INVALID_PARAMETER);
-                break;
-            case STATUS_INVALID_PARAMETER_3:
-                if (hEvent) {
-                    SetLastError (ERROR_INVALID_HANDLE);
-                } else {
-                    SetLastError (ERROR_INVALID_PARAMETER);
-                }
-                break;
-            default:
-                SetLastError (hr);
-        }
+        SetLastError (TranslateStatus (hr, hEvent));
         return FALSE;
     }
 }
 
+ULONG WINAPI ReportEventsAsCompletion (_In_ HANDLE hIOCP, _In_ ULONG nCount,
+                                       _In_reads_ (nCount) const HANDLE * hEvents,
+                                       _In_reads_ (nCount) const OVERLAPPED_ENTRY * completions,
+                                       _Out_writes_ (nCount) HANDLE * hPackets,
+                                       _Out_writes_opt_ (nCount) DWORD * dwErrors) {
+    if (!hEvents || !completions || !hPackets) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return 0;
+    }
+
+    ULONG nSucceeded = 0;
+    DWORD error = ERROR_SUCCESS;
+
+    for (ULONG i = 0; i != nCount; ++i) {
+        DWORD result = ERROR_SUCCESS;
+
+        hPackets [i] = AcquireWaitCompletionPacket ();
+        if (hPackets [i]) {
+            HRESULT hr = Associate (hPackets [i], hIOCP, hEvents [i], &completions [i]);
+            if (SUCCEEDED (hr)) {
+                ++nSucceeded;
+            } else {
+                result = TranslateStatus (hr, hEvents [i]);
+                ReleaseWaitCompletionPacket (hPackets [i]);
+                hPackets [i] = NULL;
+            }
+        } else {
+            result = GetLastError ();
+            if (result == ERROR_NOT_ENOUGH_MEMORY) {
+                result = ERROR_OUTOFMEMORY;
+            }
+        }
+
+        if (dwErrors) {
+            dwErrors [i] = result;
+        }
+        if (result != ERROR_SUCCESS) {
+            error = result;
+        }
+    }
+
+    SetLastError (error);
+    return nSucceeded;
+}
+
+ULONG WINAPI RestartEventCompletions (_In_ ULONG nCount,
+                                      _In_reads_ (nCount) const HANDLE * hPackets,
+                                      _In_ HANDLE hIOCP,
+                                      _In_reads_ (nCount) const HANDLE * hEvents,
+                                      _In_reads_ (nCount) const OVERLAPPED_ENTRY * completions,
+                                      _Out_writes_opt_ (nCount) DWORD * dwErrors) {
+    if (!hPackets || !hEvents || !completions) {
+        SetLastError (ERROR_INVALID_PARAMETER);
+        return 0;
+    }
+
+    ULONG nSucceeded = 0;
+    DWORD error = ERROR_SUCCESS;
+
+    for (ULONG i = 0; i != nCount; ++i) {
+        DWORD result = ERROR_SUCCESS;
+
+        HRESULT hr = Associate (hPackets [i], hIOCP, hEvents [i], &completions [i]);
+        if (SUCCEEDED (hr)) {
+            ++nSucceeded;
+        } else {
+            result = TranslateStatus (hr, hEvents [i]);
+            error = result;
+        }
+
+        if (dwErrors) {
+            dwErrors [i] = result;
+        }
+    }
+
+    SetLastError (error);
+    return nSucceeded;
+}
+
 BOOL WINAPI CancelEventCompletion (_In_ HANDLE hWait, _In_ BOOL cancel) {
     HRESULT hr = NtCancelWaitCompletionPacket (hWait, cancel);
     if (SUCCEEDED (hr)) {
@@ -12,12 +12,17 @@
 //                dwNumberOfBytesTransferred - user-specified value, provided back by GetQueuedCompletionStatus(Ex)
 //                dwCompletionKey - user-specified value, provided back by GetQueuedCompletionStatus(Ex)
 //                lpOverlapped - user-specified value, provided back by GetQueuedCompletionStatus(Ex)
+//  - the I/O Packet is taken from the process-wide pool (see WaitCompletionPacketPool.h)
 //  - returns: I/O Packet HANDLE for the association
 //             NULL on failure, call GetLastError () for details
+//              - ERROR_OUTOFMEMORY - no packet could be acquired, pool is empty and the kernel is out of memory
 //              - ERROR_INVALID_PARAMETER - 
 //              - ERROR_INVALID_HANDLE - provided hEvent is not supported by this API
-//              - otherwise internal HRESULT is forwarded
-//  - call CloseHandle to free the returned I/O Packet HANDLE when no longer needed
+//              - otherwise HRESULT of the failed association is forwarded,
+//                or Win32 error translated from NTSTATUS of failed packet creation
+//             on failure the acquired packet is returned to the pool, not closed
+//  - call CloseHandle to free the returned I/O Packet HANDLE when no longer needed,
+//    or cancel it and return it to the pool with ReleaseWaitCompletionPacket (see WaitCompletionPacketPool.h)
 //
 _Ret_maybenull_
 HANDLE WINAPI ReportEventAsCompletion (_In_ HANDLE hIOCP,
@@ -37,9 +42,46 @@ HANDLE WINAPI ReportEventAsCompletion (_In_ HANDLE hIOCP,
 //
 BOOL WINAPI RestartEventCompletion (_In_ HANDLE hPacket, _In_ HANDLE hIOCP, _In_ HANDLE hEvent, _In_ const OVERLAPPED_ENTRY * oEntry);
 
+// ReportEventsAsCompletion
+//  - array variant of ReportEventAsCompletion, acquires packets and associates all events in one pass
+//  - parameters: hIOCP - handle to I/O Completion Port
+//                nCount - number of items in following arrays
+//                hEvents - handles to Events, Semaphores, Threads or Processes
+//                completions - values provided back by GetQueuedCompletionStatus(Ex) for each event,
+//                              'dwNumberOfBytesTransferred', 'lpCompletionKey' and 'lpOverlapped' members are used
+//                hPackets - receives I/O Packet HANDLE for each association, NULL for those that failed
+//                dwErrors - optional, receives error code for each item, ERROR_SUCCESS for those that succeeded
+//  - returns: number of events successfully associated
+//             if less than 'nCount', GetLastError () returns error of the last failed item
+//
+ULONG WINAPI ReportEventsAsCompletion (_In_ HANDLE hIOCP, _In_ ULONG nCount,
+                                       _In_reads_ (nCount) const HANDLE * hEvents,
+                                       _In_reads_ (nCount) const OVERLAPPED_ENTRY * completions,
+                                       _Out_writes_ (nCount) HANDLE * hPackets,
+                                       _Out_writes_opt_ (nCount) DWORD * dwErrors);
+
+// RestartEventCompletions
+//  - array variant of RestartEventCompletion, re-arms whole batch dequeued by GetQueuedCompletionStatusEx
+//  - parameters: nCount - number of items in following arrays
+//                hPackets - HANDLEs returned by 'ReportEventAsCompletion' or 'ReportEventsAsCompletion'
+//                hIOCP - handle to I/O Completion Port
+//                hEvents - handles to the Event objects
+//                completions - OVERLAPPED_ENTRY array as provided back by GetQueuedCompletionStatusEx
+//                dwErrors - optional, receives error code for each item, ERROR_SUCCESS for those that succeeded
+//  - returns: number of events successfully re-armed
+//             if less than 'nCount', GetLastError () returns error of the last failed item
+//
+ULONG WINAPI RestartEventCompletions (_In_ ULONG nCount,
+                                      _In_reads_ (nCount) const HANDLE * hPackets,
+                                      _In_ HANDLE hIOCP,
+                                      _In_reads_ (nCount) const HANDLE * hEvents,
+                                      _In_reads_ (nCount) const OVERLAPPED_ENTRY * completions,
+                                      _Out_writes_opt_ (nCount) DWORD * dwErrors);
+
 // CancelEventCompletion
 //  - stops the Event from completing into the I/O Completion Port
-//  - call CloseHandle to free the I/O Packet HANDLE when no longer needed
+//  - call CloseHandle to free the I/O Packet HANDLE when no longer needed,
+//    or return it to the pool with ReleaseWaitCompletionPacket
 //  - parameters: hPacket - is HANDLE returned by 'ReportEventAsCompletion'
 //                cancel - if TRUE, if already signalled, the completion packet is removed from queue
 //  - returns: TRUE on success